@@ -93,6 +93,7 @@ namespace MetriCam2.Cameras
                         {
                             RestartCamera();
                         }
+                        InvalidateCalcChannelCache();
                     }
                 }
             }
@@ -150,6 +151,7 @@ namespace MetriCam2.Cameras
                         {
                             RestartCamera();
                         }
+                        InvalidateCalcChannelCache();
                     }
                 }
             }
@@ -187,6 +189,8 @@ namespace MetriCam2.Cameras
         public AzureKinect() : base("Azure Kinect")
         {
             enableImplicitThreadSafety = true;
+            // Distance is computed from ZImage, so with both channels active the Z image is computed once per frame
+            enableCalcChannelCache = true;
         }
 
         public void Dispose()
@@ -447,9 +451,15 @@ namespace MetriCam2.Cameras
 
         private FloatImage CalcDistanceImage()
         {
-            FloatImage zImage = CalcZImage();
+            // via CalcChannel, so that the Z image of the frame is taken from the cache if it has been computed already
+            bool zImageActive = IsChannelActive(ChannelNames.ZImage);
+            FloatImage zImage = zImageActive ? (FloatImage)CalcChannel(ChannelNames.ZImage) : CalcZImage();
             ProjectiveTransformationRational projTrans = GetIntrinsics(ChannelNames.ZImage) as ProjectiveTransformationRational;
             Point3fImage p3fImage = projTrans.ZImageToWorld(zImage);
+            if (zImageActive)
+            {
+                ReleaseImage(zImage);
+            }
             return p3fImage.ToFloatImage();
         }
 
@@ -65,8 +65,7 @@ namespace MetriCam2.Cameras
 
         private MultiSourceFrameReference multiFrameReference;
 
-        private long absoluteTimeStampAtFrame0;
-        private long relativeTimeStampAtFrame0;
+        // device timestamps (RelativeTime ticks) of the latest frames
         private long lastTimeStamp = 0;
         private long timestampDepth = -1;
         private long timestampIR = -1;
@@ -140,6 +139,10 @@ namespace MetriCam2.Cameras
             CalcHandPatches = true;
             UpdateTimeoutMilliseconds = Timeout.Infinite;
             enableImplicitThreadSafety = true;
+            // channel data only change in UpdateImpl, none of the property setters affects them
+            enableCalcChannelCache = true;
+            // RelativeTime of the frames, in 100 ns
+            DeviceClock = new ClockModel(TimeSpan.TicksPerSecond);
             //depthHandBuffer = new float[(int)Width, (int)Height];
             //ampHandBuffer = new float[(int)Width, (int)Height];
         }
@@ -286,9 +289,6 @@ namespace MetriCam2.Cameras
                 throw ExceptionBuilder.BuildFromID(typeof(ConnectionFailedException), this, 004);
             }
 
-            absoluteTimeStampAtFrame0 = 0;
-            relativeTimeStampAtFrame0 = 0;
-
             log.DebugFormat("{0}: Connected", Name);
         }
 
@@ -372,7 +372,7 @@ namespace MetriCam2.Cameras
                         if (depthFrameReference != null)
                         {
                             // always synchornize on depth frames if possible.
-                            if (lastTimeStamp == GetAbsoluteTimeStamp(depthFrameReference.RelativeTime.Ticks))
+                            if (lastTimeStamp == depthFrameReference.RelativeTime.Ticks)
                             {
                                 continue;
                             }
@@ -391,7 +391,7 @@ namespace MetriCam2.Cameras
                                     lock (this.depthFrameData)
                                     {
                                         depthFrame.CopyFrameDataToArray(this.depthFrameData);
-                                        lastTimeStamp = GetAbsoluteTimeStamp(depthFrameReference.RelativeTime.Ticks);
+                                        lastTimeStamp = depthFrameReference.RelativeTime.Ticks;
                                         timestampDepth = lastTimeStamp;
                                     }
                                     depthRequired = false;
@@ -407,7 +407,7 @@ namespace MetriCam2.Cameras
                         if (irFrameReference != null)
                         {
                             // If depth data is inactive, synchronize on IR frames. If depth and IR are inactive, we synchronize on color frames.
-                            if (!(IsChannelActive(ChannelNames.Distance) || IsChannelActive(ChannelNames.Point3DImage)) && lastTimeStamp == GetAbsoluteTimeStamp(irFrameReference.RelativeTime.Ticks))
+                            if (!(IsChannelActive(ChannelNames.Distance) || IsChannelActive(ChannelNames.Point3DImage)) && lastTimeStamp == irFrameReference.RelativeTime.Ticks)
                             {
                                 continue;
                             }
@@ -427,7 +427,7 @@ namespace MetriCam2.Cameras
                                     lock (this.irFrameData)
                                     {
                                         irFrame.CopyFrameDataToArray(this.irFrameData);
-                                        lastTimeStamp = GetAbsoluteTimeStamp(irFrameReference.RelativeTime.Ticks);
+                                        lastTimeStamp = irFrameReference.RelativeTime.Ticks;
                                         timestampIR = lastTimeStamp;
                                     }
                                     amplitudeRequired = false;
@@ -466,7 +466,7 @@ namespace MetriCam2.Cameras
                             continue;
                         }
                         // If depth and IR data is inactive, synchronize on color frames. If color, depth and IR are inactive, we don't care for synchronization.
-                        if (!(IsChannelActive(ChannelNames.Distance) || IsChannelActive(ChannelNames.Point3DImage) || IsChannelActive(ChannelNames.Amplitude)) && lastTimeStamp == GetAbsoluteTimeStamp(colorFrameReference.RelativeTime.Ticks))
+                        if (!(IsChannelActive(ChannelNames.Distance) || IsChannelActive(ChannelNames.Point3DImage) || IsChannelActive(ChannelNames.Amplitude)) && lastTimeStamp == colorFrameReference.RelativeTime.Ticks)
                         {
                             continue;
                         }
@@ -483,7 +483,7 @@ namespace MetriCam2.Cameras
                                     lock (this.colorFrameData)
                                     {
                                         colorFrame.CopyConvertedFrameDataToArray(this.colorFrameData, ColorImageFormat.Bgra);
-                                        lastTimeStamp = GetAbsoluteTimeStamp(colorFrameReference.RelativeTime.Ticks);
+                                        lastTimeStamp = colorFrameReference.RelativeTime.Ticks;
                                         timestampColor = lastTimeStamp;
                                     }
                                 }
@@ -547,6 +547,25 @@ namespace MetriCam2.Cameras
                     multiSourceFrame = null;
                 }
             } while (depthRequired || colorRequired || bodyIndexRequired || longExposureIRRequired || amplitudeRequired);
+
+            // stamp the frame with the device time of the stream it is synchronized on, see above
+            long deviceTime = -1;
+            if (IsChannelActive(ChannelNames.Distance) || IsChannelActive(ChannelNames.Point3DImage))
+            {
+                deviceTime = timestampDepth;
+            }
+            else if (IsChannelActive(ChannelNames.Amplitude))
+            {
+                deviceTime = timestampIR;
+            }
+            else if (IsChannelActive(ChannelNames.Color))
+            {
+                deviceTime = timestampColor;
+            }
+            if (deviceTime >= 0)
+            {
+                SetDeviceTimeStamp(deviceTime);
+            }
         }
 
         /// <summary>Computes (image) data for a given channel.</summary>
@@ -899,17 +918,6 @@ namespace MetriCam2.Cameras
 
             return result;
         }        
-
-        private long GetAbsoluteTimeStamp(long relativeTime)
-        {
-            if (absoluteTimeStampAtFrame0 == 0)
-            {
-                absoluteTimeStampAtFrame0 = DateTime.Now.Ticks;
-                relativeTimeStampAtFrame0 = relativeTime;
-            }
-
-            return absoluteTimeStampAtFrame0 + (relativeTime - relativeTimeStampAtFrame0);
-        }
         #endregion
     }
 }
@@ -0,0 +1,102 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "DepthProjection.h"
+#include <math.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DEPTHPROJECTION_INCREMENT(x) _InterlockedIncrement(x)
+#define DEPTHPROJECTION_DECREMENT(x) _InterlockedDecrement(x)
+#else
+#define DEPTHPROJECTION_INCREMENT(x) __sync_add_and_fetch(x, 1)
+#define DEPTHPROJECTION_DECREMENT(x) __sync_sub_and_fetch(x, 1)
+#endif
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define DEPTHPROJECTION_USE_SSE2
+#endif
+
+using namespace MetriCam2::Cameras;
+
+DepthProjection::DepthProjection(int width, int height, float focalLength)
+	: m_refCount(1), m_width(width), m_height(height), m_focalLength(focalLength), m_xTable(width), m_yTable(height)
+{
+	const int cx = width / 2;
+	const int cy = height / 2;
+	for (int x = 0; x < width; x++)
+	{
+		m_xTable[x] = (x - cx) / focalLength;
+	}
+	for (int y = 0; y < height; y++)
+	{
+		m_yTable[y] = (y - cy) / focalLength;
+	}
+}
+
+void DepthProjection::AddRef()
+{
+	DEPTHPROJECTION_INCREMENT(&m_refCount);
+}
+
+void DepthProjection::Release()
+{
+	if (0 == DEPTHPROJECTION_DECREMENT(&m_refCount))
+	{
+		delete this;
+	}
+}
+
+void DepthProjection::ToPointsAndDistances(const float* z, float* points, float* distances) const
+{
+	const float* xTable = m_xTable.data();
+	for (int y = 0; y < m_height; y++)
+	{
+		const float yFactor = m_yTable[y];
+		const float* zRow = z + (size_t)y * m_width;
+		float* pointsRow = points + 3 * (size_t)y * m_width;
+		float* distancesRow = distances + (size_t)y * m_width;
+		int x = 0;
+
+#ifdef DEPTHPROJECTION_USE_SSE2
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 yf = _mm_set1_ps(yFactor);
+		for (; x + 4 <= m_width; x += 4)
+		{
+			__m128 wz = _mm_loadu_ps(zRow + x);
+			wz = _mm_andnot_ps(_mm_cmple_ps(wz, zero), wz);
+			__m128 wx = _mm_mul_ps(_mm_loadu_ps(xTable + x), wz);
+			__m128 wy = _mm_mul_ps(yf, wz);
+			_mm_storeu_ps(distancesRow + x, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(wx, wx), _mm_mul_ps(wy, wy)), _mm_mul_ps(wz, wz))));
+
+			// interleave x0..x3, y0..y3, z0..z3 into x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+			__m128 xyLow = _mm_unpacklo_ps(wx, wy); // x0 y0 x1 y1
+			__m128 xyHigh = _mm_unpackhi_ps(wx, wy); // x2 y2 x3 y3
+			__m128 z0x1 = _mm_shuffle_ps(wz, wx, _MM_SHUFFLE(1, 1, 0, 0)); // z0 z0 x1 x1
+			__m128 y1z1 = _mm_shuffle_ps(wy, wz, _MM_SHUFFLE(1, 1, 1, 1)); // y1 y1 z1 z1
+			__m128 z2x3 = _mm_shuffle_ps(wz, wx, _MM_SHUFFLE(3, 3, 3, 2)); // z2 z3 x3 x3
+			__m128 y3z3 = _mm_shuffle_ps(wy, wz, _MM_SHUFFLE(3, 3, 3, 3)); // y3 y3 z3 z3
+			float* p = pointsRow + 3 * x;
+			_mm_storeu_ps(p + 0, _mm_shuffle_ps(xyLow, z0x1, _MM_SHUFFLE(2, 0, 1, 0)));
+			_mm_storeu_ps(p + 4, _mm_shuffle_ps(y1z1, xyHigh, _MM_SHUFFLE(1, 0, 2, 0)));
+			_mm_storeu_ps(p + 8, _mm_shuffle_ps(z2x3, y3z3, _MM_SHUFFLE(2, 0, 2, 0)));
+		}
+#endif
+
+		for (; x < m_width; x++)
+		{
+			float wz = zRow[x];
+			if (wz <= 0)
+			{
+				wz = 0;
+			}
+			float wx = xTable[x] * wz;
+			float wy = yFactor * wz;
+			pointsRow[3 * x + 0] = wx;
+			pointsRow[3 * x + 1] = wy;
+			pointsRow[3 * x + 2] = wz;
+			distancesRow[x] = sqrtf(wx * wx + wy * wy + wz * wz);
+		}
+	}
+}
@@ -0,0 +1,60 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include <vector>
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	/*
+	 * Back-projection of a Z image with a pinhole model (principal point at the image center, no distortion).
+	 *
+	 * (x - cx) / f and (y - cy) / f are tabulated once per geometry, so a pixel costs two multiplications for
+	 * its point and a square root for its distance, both computed in the same pass.
+	 *
+	 * This is a plain native class. It is immutable after construction and reference counted, so that one thread
+	 * can keep using a table while another replaces it; AddRef and Release may be called from any thread.
+	 */
+	class DepthProjection
+	{
+	public:
+		/*
+		 * The new projection has one reference.
+		 */
+		DepthProjection(int width, int height, float focalLength);
+
+		void AddRef();
+
+		/*
+		 * Drops a reference and deletes the projection with the last one.
+		 */
+		void Release();
+
+		bool Matches(int width, int height, float focalLength) const
+		{
+			return width == m_width && height == m_height && focalLength == m_focalLength;
+		}
+
+		/*
+		 * Writes interleaved XYZ coordinates (3 floats per pixel) and the euclidean distance of each pixel.
+		 * Pixels with z <= 0 get the point (0, 0, 0) and distance 0.
+		 */
+		void ToPointsAndDistances(const float* z, float* points, float* distances) const;
+
+	private:
+		~DepthProjection() { }
+		DepthProjection(const DepthProjection&);
+		DepthProjection& operator=(const DepthProjection&);
+
+		volatile long m_refCount;
+		int m_width;
+		int m_height;
+		float m_focalLength;
+		std::vector<float> m_xTable; // (x - cx) / f per column
+		std::vector<float> m_yTable; // (y - cy) / f per row
+	};
+}
+}
@@ -0,0 +1,118 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "ImageConversion.h"
+#include <intrin.h>
+#include <tmmintrin.h>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define IMAGECONVERSION_USE_SSE2
+#endif
+
+using namespace MetriCam2::Cameras;
+
+bool ImageConversion::HasSsse3()
+{
+	static int hasSsse3 = -1;
+	if (hasSsse3 < 0)
+	{
+		int info[4];
+		__cpuid(info, 1);
+		hasSsse3 = (info[2] & (1 << 9)) ? 1 : 0;
+	}
+	return 1 == hasSsse3;
+}
+
+void ImageConversion::ColorToBgra32(const MV6D_ColorBuffer& src, uint8_t* dst, int dstStride)
+{
+	// The SDK pixel struct stores r, g and b in some order, possibly padded; take the layout from the struct itself.
+	const uint8_t* base = reinterpret_cast<const uint8_t*>(src.pData);
+	const int pixelSize = sizeof(*src.pData);
+	const int offsets[3] =
+	{
+		(int)(reinterpret_cast<const uint8_t*>(&src.pData[0].b) - base),
+		(int)(reinterpret_cast<const uint8_t*>(&src.pData[0].g) - base),
+		(int)(reinterpret_cast<const uint8_t*>(&src.pData[0].r) - base),
+	};
+	const bool useSsse3 = pixelSize <= 4 && HasSsse3();
+
+	for (int y = 0; y < src.iHeight; y++)
+	{
+		const uint8_t* srcRow = base + (size_t)y * src.iWidth * pixelSize;
+		uint8_t* dstRow = dst + (size_t)y * dstStride;
+		if (useSsse3)
+		{
+			ColorToBgra32Ssse3(srcRow, pixelSize, offsets, dstRow, src.iWidth);
+		}
+		else
+		{
+			ColorToBgra32Scalar(srcRow, pixelSize, offsets, dstRow, src.iWidth);
+		}
+	}
+}
+
+void ImageConversion::ColorToBgra32Scalar(const uint8_t* src, int pixelSize, const int offsets[3], uint8_t* dst, int width)
+{
+	for (int x = 0; x < width; x++)
+	{
+		dst[0] = src[offsets[0]];
+		dst[1] = src[offsets[1]];
+		dst[2] = src[offsets[2]];
+		dst[3] = 255;
+		src += pixelSize;
+		dst += 4;
+	}
+}
+
+void ImageConversion::ColorToBgra32Ssse3(const uint8_t* src, int pixelSize, const int offsets[3], uint8_t* dst, int width)
+{
+	// 4 pixels per iteration: one 16 byte load, one shuffle into B G R 0 quadruples, alpha or'ed in
+	int8_t mask[16];
+	for (int i = 0; i < 4; i++)
+	{
+		mask[4 * i + 0] = (int8_t)(i * pixelSize + offsets[0]);
+		mask[4 * i + 1] = (int8_t)(i * pixelSize + offsets[1]);
+		mask[4 * i + 2] = (int8_t)(i * pixelSize + offsets[2]);
+		mask[4 * i + 3] = (int8_t)0x80; // zero
+	}
+	const __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask));
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+	// the load reads 16 bytes, so stop early enough not to read past the row
+	const int lastSimd = width - (16 + pixelSize - 1) / pixelSize;
+	int x = 0;
+	for (; x <= lastSimd; x += 4)
+	{
+		__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+		pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), pixels);
+		src += 4 * pixelSize;
+		dst += 16;
+	}
+	ColorToBgra32Scalar(src, pixelSize, offsets, dst, width - x);
+}
+
+void ImageConversion::GrayToFloat(const uint8_t* src, float* dst, int count)
+{
+	int i = 0;
+
+#ifdef IMAGECONVERSION_USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i low = _mm_unpacklo_epi8(bytes, zero); // 8 x u16
+		__m128i high = _mm_unpackhi_epi8(bytes, zero);
+		_mm_storeu_ps(dst + i + 0, _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)));
+		_mm_storeu_ps(dst + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)));
+		_mm_storeu_ps(dst + i + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)));
+		_mm_storeu_ps(dst + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)));
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		dst[i] = src[i];
+	}
+}
@@ -0,0 +1,37 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include <mv6D.h>
+#include <stdint.h>
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	/*
+	 * Conversion of MV6D planes into the memory layout of MetriCam images, in a single pass over the source.
+	 */
+	class ImageConversion
+	{
+	public:
+		/*
+		 * Writes the color plane as 32bpp BGRA with opaque alpha (the layout of Format32bppArgb bitmaps).
+		 * Uses an SSSE3 byte shuffle if the CPU supports it.
+		 */
+		static void ColorToBgra32(const MV6D_ColorBuffer& src, uint8_t* dst, int dstStride);
+
+		/*
+		 * Widens 8-bit gray values to float, 16 pixels per SSE2 iteration.
+		 */
+		static void GrayToFloat(const uint8_t* src, float* dst, int count);
+
+	private:
+		static bool HasSsse3();
+
+		static void ColorToBgra32Scalar(const uint8_t* src, int pixelSize, const int offsets[3], uint8_t* dst, int width);
+		static void ColorToBgra32Ssse3(const uint8_t* src, int pixelSize, const int offsets[3], uint8_t* dst, int width);
+	};
+}
+}
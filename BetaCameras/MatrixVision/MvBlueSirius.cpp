@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "MvBlueSirius.h"
+#include "ImageConversion.h"
 #include <memory.h>
 
 using namespace System;
@@ -11,8 +12,14 @@ namespace MetriCam2
 {
 	namespace Cameras
 	{
+		static const int FrameTimeout = 20000; // ms
+
 		MvBlueSirius::MvBlueSirius()
-			: Camera("mvBlueSirius"), _focalLength(0.0f), _updateLock(gcnew Object())
+			: Camera("mvBlueSirius"), _maxRetainedRequests(2), _readOnlyImages(false),
+			_useAcquisitionThread(false), _queueCapacity(1), _acquisitionThread(nullptr), _stopAcquisition(false),
+			_queue(gcnew System::Collections::Generic::Queue<FrameSnapshot^>()), _queueLock(gcnew Object()),
+			_frameAvailable(gcnew System::Threading::ManualResetEvent(false)), _acquisitionError(nullptr), _droppedFrames(0), _latency(0.0f), _requestPool(nullptr), _snapshot(nullptr),
+			_projection(nullptr), _projectionMapped(nullptr), _projectionLock(gcnew Object())
 		{
 			int major = 0;
 			int minor = 0;
@@ -20,25 +27,22 @@ namespace MetriCam2
 			const char* versionString = MV6D_GetBuildVersion(&major, &minor, &patch);
 			log->DebugFormat("mv6D - {0}.{1}.{2} - Build \"{3}\"", major, minor, patch, gcnew String(versionString));
 
-			_currentMasterImage = nullptr;
-			_currentSlaveImage = nullptr;
-			_currentZImageMapped = nullptr;
-			_currentZImage = nullptr;
-			_currentDistanceImage = nullptr;
-			_currentDistanceImageMapped = nullptr;
-			_currentPointCloud = nullptr;
-			_currentPointCloudMapped = nullptr;
-
-			_master = gcnew ImageData;
-			_slave = gcnew ImageData;
-			_color = gcnew ImageData;
-			_depthMapped = gcnew ImageData;
-			_depthRaw = gcnew ImageData;
+			enableFrameSnapshots = true;
 		}
 
 		MvBlueSirius::~MvBlueSirius()
 		{
 			Disconnect(false);
+			if (nullptr != _projection)
+			{
+				_projection->Release();
+				_projection = nullptr;
+			}
+			if (nullptr != _projectionMapped)
+			{
+				_projectionMapped->Release();
+				_projectionMapped = nullptr;
+			}
 		}
 
 		void MvBlueSirius::LoadAllAvailableChannels()
@@ -56,6 +60,8 @@ namespace MetriCam2
 			Channels->Add(cr->RegisterCustomChannel((String^)CustomChannelNames::ZMapped, FloatImage::typeid));
 			Channels->Add(cr->RegisterCustomChannel((String^)CustomChannelNames::DistanceMapped, FloatImage::typeid));
 			Channels->Add(cr->RegisterCustomChannel((String^)CustomChannelNames::PointCloudMapped, Point3fImage::typeid));
+			Channels->Add(cr->RegisterCustomChannel((String^)CustomChannelNames::LeftRaw, ByteImage::typeid));
+			Channels->Add(cr->RegisterCustomChannel((String^)CustomChannelNames::RightRaw, ByteImage::typeid));
 		}
 
 		void MvBlueSirius::ConnectImpl()
@@ -66,6 +72,8 @@ namespace MetriCam2
 			MV6D_ResultCode result = MV6D_Create(&camHandle, MV6D_ANY_GPU);
 			CheckResult(result, ConnectionFailedException::typeid, 1);
 			_h6D = camHandle;
+			// the pool closes the handle once the camera and all retained requests have released it
+			_requestPool = new RequestBufferPool(_h6D, _maxRetainedRequests);
 
 			// Update list of supported cameras
 			int deviceCount = 0;
@@ -135,320 +143,737 @@ namespace MetriCam2
 
 			AutoExposure = true;
 
-			ActivateChannel(ChannelNames::Color);
-			ActivateChannel(ChannelNames::Distance);
-			ActivateChannel(ChannelNames::ZImage);
-			ActivateChannel(ChannelNames::Point3DImage);
-			ActivateChannel((String^)CustomChannelNames::ZMapped);
-			ActivateChannel((String^)CustomChannelNames::DistanceMapped);
-			ActivateChannel((String^)CustomChannelNames::PointCloudMapped);
-			ActivateChannel(ChannelNames::Left);
-			ActivateChannel(ChannelNames::Right);
-			SelectChannel(ChannelNames::Color);
+			// keep the channels chosen by the user; without a choice, everything is available as before
+			if (0 == ActiveChannels->Count)
+			{
+				ActivateChannel(ChannelNames::Color);
+				ActivateChannel(ChannelNames::Distance);
+				ActivateChannel(ChannelNames::ZImage);
+				ActivateChannel(ChannelNames::Point3DImage);
+				ActivateChannel((String^)CustomChannelNames::ZMapped);
+				ActivateChannel((String^)CustomChannelNames::DistanceMapped);
+				ActivateChannel((String^)CustomChannelNames::PointCloudMapped);
+				ActivateChannel(ChannelNames::Left);
+				ActivateChannel(ChannelNames::Right);
+				SelectChannel(ChannelNames::Color);
+			}
+			UpdateRequiredPlanes(nullptr, nullptr);
+
+			_droppedFrames = 0;
+			_latency = 0.0f;
+			if (_useAcquisitionThread)
+			{
+				StartAcquisition();
+			}
+		}
+
+		void MvBlueSirius::ActivateChannelImpl(String^ channelName)
+		{
+			UpdateRequiredPlanes(channelName, nullptr);
+		}
+
+		void MvBlueSirius::DeactivateChannelImpl(String^ channelName)
+		{
+			UpdateRequiredPlanes(nullptr, channelName);
+		}
+
+		unsigned int MvBlueSirius::PlanesOf(String^ channelName)
+		{
+			if (ChannelNames::Color == channelName)
+			{
+				return RequestPlaneColor;
+			}
+			if (ChannelNames::Left == channelName
+				|| CustomChannelNames::LeftRaw == channelName)
+			{
+				return RequestPlaneRawMaster;
+			}
+			if (ChannelNames::Right == channelName
+				|| CustomChannelNames::RightRaw == channelName)
+			{
+				return RequestPlaneRawSlave;
+			}
+			if (CustomChannelNames::ZMapped == channelName
+				|| CustomChannelNames::DistanceMapped == channelName
+				|| CustomChannelNames::PointCloudMapped == channelName)
+			{
+				return RequestPlaneDepthMapped;
+			}
+			if (ChannelNames::ZImage == channelName
+				|| ChannelNames::Distance == channelName
+				|| ChannelNames::Point3DImage == channelName)
+			{
+				return RequestPlaneDepthRaw;
+			}
+			return 0;
+		}
+
+		void MvBlueSirius::UpdateRequiredPlanes(String^ activated, String^ deactivated)
+		{
+			// called before the base class updates ActiveChannels
+			unsigned int planes = 0;
+			for each (ChannelRegistry::ChannelDescriptor^ channel in ActiveChannels)
+			{
+				if (channel->Name != deactivated)
+				{
+					planes |= PlanesOf(channel->Name);
+				}
+			}
+			if (nullptr != activated)
+			{
+				planes |= PlanesOf(activated);
+			}
+
+			if (nullptr != _requestPool)
+			{
+				_requestPool->SetRequiredPlanes(planes);
+			}
 		}
 
 		void MvBlueSirius::DisconnectImpl()
 		{
 			log->EnterMethod();
 
-			MV6D_ResultCode result = MV6D_DeviceClose(_h6D);
-			CheckResult(result, InvalidOperationException::typeid, 12);
-			result = MV6D_Close(_h6D);
-			CheckResult(result, InvalidOperationException::typeid, 13);
+			StopAcquisition();
 
-			System::Threading::Monitor::Enter(_updateLock);
-			_master->FreeData();
-			_slave->FreeData();
-			_color->FreeData();
-			_depthMapped->FreeData();
-			_depthRaw->FreeData();
-			System::Threading::Monitor::Exit(_updateLock);
+			// all requests have to be handed back before the device is closed
+			FrameSnapshot^ snapshot = System::Threading::Interlocked::Exchange<FrameSnapshot^>(_snapshot, nullptr);
+			if (nullptr != snapshot)
+			{
+				ReleaseSnapshot(snapshot);
+			}
+			// Channels still being computed from older frames hold their requests until they are done;
+			// the last of them closes the device then. Otherwise the device is closed right here.
+			RequestBufferPool* pool = _requestPool;
+			_requestPool = nullptr;
+			MV6D_ResultCode result = pool->Release();
+			CheckResult(result, InvalidOperationException::typeid, 12);
 		}
 
 		void MvBlueSirius::UpdateImpl()
+		{
+			if (nullptr != _acquisitionThread)
+			{
+				PublishSnapshot(TakeNewestQueued(FrameTimeout));
+				return;
+			}
+
+			// the current frame is released right after publishing the new one, so its request does not count against MaxRetainedRequests
+			FrameSnapshot^ current = _snapshot;
+			MV6D_ResultCode unlockResult = rcOk;
+			long long receivedAt = 0;
+			MV6D_RequestBuffer* request = TryWaitForRequest(FrameTimeout, receivedAt);
+			if (nullptr == request)
+			{
+				throw gcnew MetriCam2::Exceptions::ImageAcquisitionFailedException("No image data received in time");
+			}
+			// keep the request locked instead of copying its planes; it is unlocked when the last snapshot using it is gone
+			RequestBuffer* frame = _requestPool->Wrap(request, (nullptr == current) ? NULL : current->Frame, unlockResult);
+			PublishSnapshot(gcnew FrameSnapshot(frame, receivedAt, ImagePool));
+			CheckResult(unlockResult, InvalidOperationException::typeid, 14);
+		}
+
+		System::Threading::Tasks::Task<bool>^ MvBlueSirius::WaitForFrameAsync(System::Threading::CancellationToken cancellationToken)
+		{
+			if (nullptr == _acquisitionThread)
+			{
+				return System::Threading::Tasks::Task::FromResult<bool>(false);
+			}
+
+			System::Threading::Monitor::Enter(_queueLock);
+			try
+			{
+				if (_queue->Count > 0)
+				{
+					return System::Threading::Tasks::Task::FromResult<bool>(true);
+				}
+			}
+			finally
+			{
+				System::Threading::Monitor::Exit(_queueLock);
+			}
+			// a frame queued in the meantime sets the event, and only taking the frames resets it, so it is not missed
+			return WaitOneAsync(_frameAvailable, FrameTimeout, cancellationToken);
+		}
+
+		MV6D_RequestBuffer* MvBlueSirius::TryWaitForRequest(int timeout, long long& receivedAt)
 		{
 			// request buffer pointer
 			MV6D_RequestBuffer* requestBuffer = nullptr;
 
-			// wait up to two seconds
-			int timeout = 20000;
-
 			// dropped frames since last call
 			int dropped = 0;
 
 			// request a new buffer object
 			if (MV6D_DeviceResultWaitFor(_h6D, &requestBuffer, &dropped, timeout) != rcOk)
 			{
-				throw gcnew MetriCam2::Exceptions::ImageAcquisitionFailedException("No image data received in time");
+				return nullptr;
 			}
+			// before RequestBufferPool::Wrap, which may have to copy the planes
+			receivedAt = System::Diagnostics::Stopwatch::GetTimestamp();
+			System::Threading::Interlocked::Add(_droppedFrames, dropped);
+			return requestBuffer;
+		}
 
-			System::Threading::Monitor::Enter(_updateLock);
+		void MvBlueSirius::PublishSnapshot(FrameSnapshot^ snapshot)
+		{
+			_latency = (float)((System::Diagnostics::Stopwatch::GetTimestamp() - snapshot->ReceivedAt) * 1000.0 / System::Diagnostics::Stopwatch::Frequency);
+			// stamp queued frames with their arrival, not with the time they are taken from the queue
+			SetFrameArrival(snapshot->ReceivedAt);
+			// the same stamps as Camera.Update gives the frame, as there is no device timestamp
+			snapshot->FrameNumber = FrameNumber;
+			snapshot->TimeStamp = ToTimeStamp(snapshot->ReceivedAt);
+
+			// publish the new frame without waiting for conversions of the previous one; they keep their own reference
+			FrameSnapshot^ previousSnapshot = System::Threading::Interlocked::Exchange<FrameSnapshot^>(_snapshot, snapshot);
+			if (nullptr != previousSnapshot)
+			{
+				ReleaseSnapshot(previousSnapshot);
+			}
+		}
 
-			// get color image
-			if (requestBuffer->colorMapped.pData)
+		MvBlueSirius::FrameSnapshot^ MvBlueSirius::TakeNewestQueued(int timeout)
+		{
+			System::Collections::Generic::List<FrameSnapshot^>^ skipped = gcnew System::Collections::Generic::List<FrameSnapshot^>();
+			FrameSnapshot^ newest = nullptr;
+			while (nullptr == newest)
 			{
-				_color->Width = requestBuffer->colorMapped.iWidth;
-				_color->Height = requestBuffer->colorMapped.iHeight;
-				_color->CopyColorData(requestBuffer->colorMapped);
+				System::Threading::Monitor::Enter(_queueLock);
+				try
+				{
+					while (_queue->Count > 0)
+					{
+						if (nullptr != newest)
+						{
+							skipped->Add(newest);
+						}
+						newest = _queue->Dequeue();
+					}
+					// the queue is empty now, so WaitForFrameAsync must not report a frame any more
+					if (nullptr == _acquisitionError)
+					{
+						_frameAvailable->Reset();
+					}
+				}
+				finally
+				{
+					System::Threading::Monitor::Exit(_queueLock);
+				}
+
+				if (nullptr != newest)
+				{
+					break;
+				}
+				Exception^ acquisitionError = _acquisitionError;
+				if (nullptr != acquisitionError)
+				{
+					throw gcnew MetriCam2::Exceptions::ImageAcquisitionFailedException(acquisitionError->Message, acquisitionError);
+				}
+				if (!_frameAvailable->WaitOne(timeout))
+				{
+					throw gcnew MetriCam2::Exceptions::ImageAcquisitionFailedException("No image data received in time");
+				}
 			}
 
-			// get master raw image
-			if (requestBuffer->rawMaster.pData)
+			for each (FrameSnapshot^ snapshot in skipped)
 			{
-				_currentMasterImage = nullptr;
-				_master->Width = requestBuffer->rawMaster.iWidth;
-				_master->Height = requestBuffer->rawMaster.iHeight;
-				_master->CopyGrayData(requestBuffer->rawMaster);
+				System::Threading::Interlocked::Increment(_droppedFrames);
+				ReleaseSnapshot(snapshot);
 			}
+			return newest;
+		}
+
+		void MvBlueSirius::StartAcquisition()
+		{
+			_stopAcquisition = false;
+			_acquisitionError = nullptr;
+			_frameAvailable->Reset();
+			_acquisitionThread = gcnew System::Threading::Thread(gcnew System::Threading::ThreadStart(this, &MvBlueSirius::AcquisitionLoop));
+			_acquisitionThread->IsBackground = true;
+			_acquisitionThread->Name = "MvBlueSirius acquisition";
+			_acquisitionThread->Start();
+		}
 
-			// get slave raw image
-			if (requestBuffer->rawSlave1.pData)
+		void MvBlueSirius::StopAcquisition()
+		{
+			if (nullptr == _acquisitionThread)
 			{
-				_currentSlaveImage = nullptr;
-				_slave->Width = requestBuffer->rawSlave1.iWidth;
-				_slave->Height = requestBuffer->rawSlave1.iHeight;
-				_slave->CopyGrayData(requestBuffer->rawSlave1);
+				return;
 			}
+			_stopAcquisition = true;
+			_acquisitionThread->Join();
+			_acquisitionThread = nullptr;
 
-			// get depth mapped image
-			if (requestBuffer->depthMapped.pData)
+			while (_queue->Count > 0)
 			{
-				_currentZImageMapped = nullptr;
-				_depthMapped->Width = requestBuffer->depthMapped.iWidth;
-				_depthMapped->Height = requestBuffer->depthMapped.iHeight;
-				_depthMapped->CopyDepthData(requestBuffer->depthMapped);
+				ReleaseSnapshot(_queue->Dequeue());
 			}
+		}
+
+		void MvBlueSirius::AcquisitionLoop()
+		{
+			// short waits, so StopAcquisition does not have to wait for the SDK timeout
+			const int pollTimeout = 100;
+			System::Diagnostics::Stopwatch^ sinceLastFrame = System::Diagnostics::Stopwatch::StartNew();
 
-			// get depth raw image
-			if (requestBuffer->depthRaw.pData)
+			try
 			{
-				_currentDistanceImage = nullptr;
-				_currentDistanceImageMapped = nullptr;
-				_currentPointCloud = nullptr;
-				_currentPointCloudMapped = nullptr;
-				_currentZImage = nullptr;
+				while (!_stopAcquisition)
+				{
+					long long receivedAt = 0;
+					MV6D_RequestBuffer* request = TryWaitForRequest(pollTimeout, receivedAt);
+					if (nullptr == request)
+					{
+						if (sinceLastFrame->ElapsedMilliseconds > FrameTimeout)
+						{
+							throw gcnew MetriCam2::Exceptions::ImageAcquisitionFailedException("No image data received in time");
+						}
+						continue;
+					}
+					sinceLastFrame->Restart();
 
-				_depthRaw->Width = requestBuffer->depthRaw.iWidth;
-				_depthRaw->Height= requestBuffer->depthRaw.iHeight;
-				_depthRaw->CopyDepthData(requestBuffer->depthRaw);
+					// if the queue is full, its oldest frame is dropped below, so its request does not count against MaxRetainedRequests
+					RequestBuffer* replaced = nullptr;
+					System::Threading::Monitor::Enter(_queueLock);
+					try
+					{
+						if (_queue->Count > 0 && _queue->Count >= _queueCapacity)
+						{
+							replaced = _queue->Peek()->Frame;
+							replaced->AddRef();
+						}
+					}
+					finally
+					{
+						System::Threading::Monitor::Exit(_queueLock);
+					}
+					MV6D_ResultCode unlockResult = rcOk;
+					RequestBuffer* frame = _requestPool->Wrap(request, replaced, unlockResult);
+					if (nullptr != replaced)
+					{
+						WarnIfFailed(replaced->Release());
+					}
+					WarnIfFailed(unlockResult);
+
+					System::Collections::Generic::List<FrameSnapshot^>^ overflow = gcnew System::Collections::Generic::List<FrameSnapshot^>();
+					System::Threading::Monitor::Enter(_queueLock);
+					try
+					{
+						while (_queue->Count >= _queueCapacity)
+						{
+							overflow->Add(_queue->Dequeue());
+						}
+						_queue->Enqueue(gcnew FrameSnapshot(frame, receivedAt, ImagePool));
+						_frameAvailable->Set();
+					}
+					finally
+					{
+						System::Threading::Monitor::Exit(_queueLock);
+					}
+
+					for each (FrameSnapshot^ snapshot in overflow)
+					{
+						System::Threading::Interlocked::Increment(_droppedFrames);
+						WarnIfFailed(snapshot->Release());
+					}
+				}
+			}
+			catch (Exception^ ex)
+			{
+				// Update rethrows it; an exception escaping a thread would terminate the process
+				log->Error("Acquisition thread stopped: " + ex->Message);
+				System::Threading::Monitor::Enter(_queueLock);
+				try
+				{
+					_acquisitionError = ex;
+					_frameAvailable->Set();
+				}
+				finally
+				{
+					System::Threading::Monitor::Exit(_queueLock);
+				}
 			}
+		}
 
-			_focalLength = (float)requestBuffer->focalLength;
+		void MvBlueSirius::WarnIfFailed(MV6D_ResultCode unlockResult)
+		{
+			if (rcOk != unlockResult)
+			{
+				log->WarnFormat("Could not unlock request: {0}", gcnew String(MV6D_ResultCodeToString(unlockResult)));
+			}
+		}
 
-			System::Threading::Monitor::Exit(_updateLock);
+		MvBlueSirius::FrameSnapshot^ MvBlueSirius::AcquireSnapshot()
+		{
+			while (true)
+			{
+				FrameSnapshot^ snapshot = _snapshot;
+				// fails only if UpdateImpl has just replaced and released this snapshot; then take the new one
+				if (nullptr == snapshot || snapshot->TryAddRef())
+				{
+					return snapshot;
+				}
+			}
+		}
 
-			// unlock request buffer
-			MV6D_ResultCode result = MV6D_UnlockRequest(_h6D, requestBuffer);
+		void MvBlueSirius::ReleaseSnapshot(FrameSnapshot^ snapshot)
+		{
+			MV6D_ResultCode result = snapshot->Release();
 			CheckResult(result, InvalidOperationException::typeid, 14);
 		}
 
 		ImageBase^ MvBlueSirius::CalcChannelImpl(String^ channelName)
 		{
+			FrameSnapshot^ snapshot = AcquireSnapshot();
+			if (nullptr == snapshot)
+			{
+				return nullptr;
+			}
+
+			try
+			{
+				return CalcChannelFromSnapshot(channelName, snapshot);
+			}
+			finally
+			{
+				ReleaseSnapshot(snapshot);
+			}
+		}
+
+		Object^ MvBlueSirius::CaptureFrameImpl()
+		{
+			// called right after UpdateImpl in the camera lock, so this is the frame just published
+			return AcquireSnapshot();
+		}
+
+		ImageBase^ MvBlueSirius::CalcChannelImpl(String^ channelName, Object^ frameState)
+		{
+			return CalcChannelFromSnapshot(channelName, safe_cast<FrameSnapshot^>(frameState));
+		}
+
+		void MvBlueSirius::ReleaseFrameImpl(Object^ frameState)
+		{
+			// may run on any thread when the last snapshot is disposed, also after DisconnectImpl
+			WarnIfFailed(safe_cast<FrameSnapshot^>(frameState)->Release());
+		}
+
+		ImageBase^ MvBlueSirius::CalcChannelFromSnapshot(String^ channelName, FrameSnapshot^ snapshot)
+		{
+			const MV6D_RequestBuffer& request = snapshot->Frame->Data();
+			const bool share = _readOnlyImages;
+			if (share)
+			{
+				snapshot->SharedImages = true;
+			}
+
 			if (ChannelNames::Color == channelName)
 			{
-				return CalcColorImage(_color);
+				// never shared, because a Bitmap cannot be used by several threads at a time; the fresh image needs no copy either
+				return CalcColorImage(request.colorMapped);
 			}
 			if (ChannelNames::Left == channelName)
 			{
-				if (nullptr == _currentMasterImage)
+				if (nullptr == snapshot->MasterImage)
 				{
-					_currentMasterImage = CalcGreyImage(_master);
+					snapshot->MasterImage = CalcGreyImage(request.rawMaster);
 				}
-				return gcnew FloatImage(_currentMasterImage);
+				return HandOut(snapshot->MasterImage, snapshot, channelName, share);
 			}
 			if (ChannelNames::Right == channelName)
 			{
-				if (nullptr == _currentSlaveImage)
+				if (nullptr == snapshot->SlaveImage)
+				{
+					snapshot->SlaveImage = CalcGreyImage(request.rawSlave1);
+				}
+				return HandOut(snapshot->SlaveImage, snapshot, channelName, share);
+			}
+			if (CustomChannelNames::LeftRaw == channelName)
+			{
+				if (nullptr == snapshot->MasterRaw)
 				{
-					_currentSlaveImage = CalcGreyImage(_slave);
+					snapshot->MasterRaw = CalcRawImage(request.rawMaster);
 				}
-				return gcnew FloatImage(_currentSlaveImage);
+				return HandOut(snapshot->MasterRaw, snapshot, channelName, share);
+			}
+			if (CustomChannelNames::RightRaw == channelName)
+			{
+				if (nullptr == snapshot->SlaveRaw)
+				{
+					snapshot->SlaveRaw = CalcRawImage(request.rawSlave1);
+				}
+				return HandOut(snapshot->SlaveRaw, snapshot, channelName, share);
 			}
 			if (CustomChannelNames::ZMapped == channelName)
 			{
-				if (nullptr == _currentZImageMapped)
+				if (nullptr == snapshot->ZImageMapped)
 				{
-					_currentZImageMapped = CalcDepthImage(_depthMapped);
+					snapshot->ZImageMapped = CalcDepthImage(request.depthMapped);
 				}
-				return gcnew FloatImage(_currentZImageMapped);
+				return HandOut(snapshot->ZImageMapped, snapshot, channelName, share);
 			}
 			if (ChannelNames::ZImage == channelName)
 			{
-				if (nullptr == _currentZImage)
+				if (nullptr == snapshot->ZImage)
 				{
-					_currentZImage = CalcDepthImage(_depthRaw);
+					snapshot->ZImage = CalcDepthImage(request.depthRaw);
 				}
-				return gcnew FloatImage(_currentZImage);
+				return HandOut(snapshot->ZImage, snapshot, channelName, share);
 			}
 			if (CustomChannelNames::PointCloudMapped == channelName)
 			{
-				if (nullptr == _currentPointCloudMapped)
+				if (nullptr == snapshot->PointCloudMapped)
 				{
-					FloatImage^ zImageMapped = (FloatImage^)CalcChannelImpl((System::String^)CustomChannelNames::ZMapped);
-					_currentPointCloudMapped = CalcPointCloud(zImageMapped);
+					CalcPointsAndDistances(snapshot, true);
 				}
-				return gcnew Point3fImage(_currentPointCloudMapped);
+				return HandOut(snapshot->PointCloudMapped, snapshot, channelName, share);
 			}
 			if (CustomChannelNames::DistanceMapped == channelName)
 			{
-				if (nullptr == _currentDistanceImageMapped)
+				if (nullptr == snapshot->DistanceImageMapped)
 				{
-					Point3fImage^ pts3DMapped = (Point3fImage^)CalcChannelImpl((System::String^)CustomChannelNames::PointCloudMapped);
-					_currentDistanceImageMapped = CalcDistances(pts3DMapped);
+					CalcPointsAndDistances(snapshot, true);
 				}
-				return gcnew FloatImage(_currentDistanceImageMapped);
+				return HandOut(snapshot->DistanceImageMapped, snapshot, channelName, share);
 			}
 			if (ChannelNames::Distance == channelName)
 			{
-				if (nullptr == _currentDistanceImage)
+				if (nullptr == snapshot->DistanceImage)
 				{
-					Point3fImage^ pts3D = (Point3fImage^)CalcChannelImpl(ChannelNames::Point3DImage);
-					_currentDistanceImage = CalcDistances(pts3D);
+					CalcPointsAndDistances(snapshot, false);
 				}
-				return gcnew FloatImage(_currentDistanceImage);
+				return HandOut(snapshot->DistanceImage, snapshot, channelName, share);
 			}
 			if (ChannelNames::Point3DImage == channelName)
 			{
-				if (nullptr == _currentPointCloud)
+				if (nullptr == snapshot->PointCloud)
 				{
-					FloatImage^ zImage = (FloatImage^)CalcChannelImpl(ChannelNames::ZImage);
-					_currentPointCloud = CalcPointCloud(zImage);
+					CalcPointsAndDistances(snapshot, false);
 				}
-				return gcnew Point3fImage(_currentPointCloud);
+				return HandOut(snapshot->PointCloud, snapshot, channelName, share);
 			}
 
 			// this should not happen, because Camera checks if the channel is active.
 			return nullptr;
 		}
 
-		ProjectiveTransformation^ MvBlueSirius::GetIntrinsics(String^ channelName)
+		FloatImage^ MvBlueSirius::HandOut(FloatImage^ cached, FrameSnapshot^ snapshot, String^ channelName, bool share)
 		{
-			if (MetriCam2::ChannelNames::Distance == channelName
-				|| MetriCam2::ChannelNames::ZImage == channelName)
+			if (share)
 			{
-				return gcnew ProjectiveTransformationRational(_depthRaw->Width, _depthRaw->Height, FocalLength, FocalLength, _depthRaw->Width / 2.0f, _depthRaw->Height / 2.0f, 0, 0, 0, 0, 0, 0, 0, 0, float::NaN);
+				MarkShared(cached, channelName, snapshot->FrameNumber, snapshot->TimeStamp);
+				return cached;
 			}
-			if (MetriCam2::ChannelNames::Color == channelName)
+			FloatImage^ copy = ImagePool->RentFloatImage(cached->Width, cached->Height);
+			Array::Copy(cached->Data, copy->Data, cached->Data->Length);
+			return copy;
+		}
+
+		Point3fImage^ MvBlueSirius::HandOut(Point3fImage^ cached, FrameSnapshot^ snapshot, String^ channelName, bool share)
+		{
+			if (share)
 			{
-				return gcnew ProjectiveTransformationRational(_color->Width, _color->Height, FocalLength, FocalLength, _color->Width / 2.0f, _color->Height / 2.0f, 0, 0, 0, 0, 0, 0, 0, 0, float::NaN);
+				MarkShared(cached, channelName, snapshot->FrameNumber, snapshot->TimeStamp);
+				return cached;
 			}
-			return Camera::GetIntrinsics(channelName);
+			Point3fImage^ copy = ImagePool->RentPoint3fImage(cached->Width, cached->Height);
+			Array::Copy(cached->Data, copy->Data, cached->Data->Length);
+			return copy;
 		}
 
-		ColorImage ^ MvBlueSirius::CalcColorImage(ImageData^ image)
+		ByteImage^ MvBlueSirius::HandOut(ByteImage^ cached, FrameSnapshot^ snapshot, String^ channelName, bool share)
 		{
-			System::Threading::Monitor::Enter(_updateLock);
-
-			ColorImage^ cImage = gcnew ColorImage(image->Width, image->Height);
-			BitmapData^ bitmapData = cImage->Data->LockBits(System::Drawing::Rectangle(0, 0, image->Width, image->Height), ImageLockMode::WriteOnly, cImage->Data->PixelFormat);
-			int colorIdx = 0;
-			for (unsigned int y = 0; y < image->Height; y++)
+			if (share)
 			{
-				unsigned char* linePtr = (unsigned char*)(bitmapData->Scan0.ToPointer()) + bitmapData->Stride * y;
-				for (unsigned int x = 0; x < image->Width; x++)
-				{
-					*linePtr++ = image->Data[colorIdx++];
-					*linePtr++ = image->Data[colorIdx++];
-					*linePtr++ = image->Data[colorIdx++];
-					*linePtr++ = 255;
-				}
+				MarkShared(cached, channelName, snapshot->FrameNumber, snapshot->TimeStamp);
+				return cached;
 			}
-			cImage->Data->UnlockBits(bitmapData);
-
-			System::Threading::Monitor::Exit(_updateLock);
+			ByteImage^ copy = ImagePool->RentByteImage(cached->Width, cached->Height);
+			Array::Copy(cached->Data, copy->Data, cached->Data->Length);
+			return copy;
+		}
 
-			return cImage;
+		float MvBlueSirius::FocalLength::get()
+		{
+			FrameSnapshot^ snapshot = AcquireSnapshot();
+			if (nullptr == snapshot)
+			{
+				return 0.0f;
+			}
+			float focalLength = (float)snapshot->Frame->Data().focalLength;
+			ReleaseSnapshot(snapshot);
+			return focalLength;
 		}
 
-		FloatImage ^ MvBlueSirius::CalcGreyImage(ImageData^ image)
+		ProjectiveTransformation^ MvBlueSirius::GetIntrinsics(String^ channelName)
 		{
-			System::Threading::Monitor::Enter(_updateLock);
+			const bool depth = MetriCam2::ChannelNames::Distance == channelName || MetriCam2::ChannelNames::ZImage == channelName;
+			if (!depth && MetriCam2::ChannelNames::Color != channelName)
+			{
+				return Camera::GetIntrinsics(channelName);
+			}
 
-			FloatImage^ fImage = gcnew FloatImage(image->Width, image->Height);
-			int i = 0;
-			for (unsigned int y = 0; y < image->Height; y++)
+			// geometry and focal length of one and the same frame, also while Update publishes the next one
+			FrameSnapshot^ snapshot = AcquireSnapshot();
+			if (nullptr == snapshot)
 			{
-				for (unsigned int x = 0; x < image->Width; x++)
-				{
-					fImage[y, x] = image->Data[i++];
-				}
+				return Camera::GetIntrinsics(channelName);
 			}
+			int width;
+			int height;
+			float focalLength;
+			try
+			{
+				const MV6D_RequestBuffer& data = snapshot->Frame->Data();
+				width = depth ? data.depthRaw.iWidth : data.colorMapped.iWidth;
+				height = depth ? data.depthRaw.iHeight : data.colorMapped.iHeight;
+				focalLength = (float)data.focalLength;
+			}
+			finally
+			{
+				ReleaseSnapshot(snapshot);
+			}
+			return gcnew ProjectiveTransformationRational(width, height, focalLength, focalLength, width / 2.0f, height / 2.0f, 0, 0, 0, 0, 0, 0, 0, 0, float::NaN);
+		}
 
-			System::Threading::Monitor::Exit(_updateLock);
+		ColorImage ^ MvBlueSirius::CalcColorImage(const MV6D_ColorBuffer& buffer)
+		{
+			CheckPlane(buffer.pData, "color");
 
-			return fImage;
+			ColorImage^ cImage = gcnew ColorImage(buffer.iWidth, buffer.iHeight);
+			BitmapData^ bitmapData = cImage->Data->LockBits(System::Drawing::Rectangle(0, 0, buffer.iWidth, buffer.iHeight), ImageLockMode::WriteOnly, cImage->Data->PixelFormat);
+			ImageConversion::ColorToBgra32(buffer, (uint8_t*)bitmapData->Scan0.ToPointer(), bitmapData->Stride);
+			cImage->Data->UnlockBits(bitmapData);
+
+			return cImage;
 		}
 
-		FloatImage ^ MvBlueSirius::CalcDepthImage(ImageData^ image)
+		FloatImage ^ MvBlueSirius::CalcGreyImage(const MV6D_GrayBuffer& buffer)
 		{
-			System::Threading::Monitor::Enter(_updateLock);
-
-			FloatImage^ fImage = gcnew FloatImage(image->Width, image->Height);
-			float* imageData = (float*)image->Data;
-			int i = 0;
-			for (unsigned int y = 0; y < image->Height; y++)
-			{
-				for (unsigned int x = 0; x < image->Width; x++)
-				{
-					fImage[y, x] = imageData[i++];
-				}
-			}
+			CheckPlane(buffer.pData, "raw");
 
-			System::Threading::Monitor::Exit(_updateLock);
+			FloatImage^ fImage = ImagePool->RentFloatImage(buffer.iWidth, buffer.iHeight);
+			pin_ptr<float> data = &(fImage->Data)[0];
+			ImageConversion::GrayToFloat((const uint8_t*)buffer.pData, data, buffer.iWidth * buffer.iHeight);
 
 			return fImage;
 		}
 
-		FloatImage ^ MvBlueSirius::CalcDistances(Point3fImage^ image)
+		ByteImage ^ MvBlueSirius::CalcRawImage(const MV6D_GrayBuffer& buffer)
 		{
-			System::Threading::Monitor::Enter(_updateLock);
+			CheckPlane(buffer.pData, "raw");
 
-			FloatImage^ fImage = gcnew FloatImage(image->Width, image->Height);
+			// the plane already has the layout of a ByteImage, so one copy is all it takes
+			ByteImage^ bImage = ImagePool->RentByteImage(buffer.iWidth, buffer.iHeight);
+			pin_ptr<Byte> data = &(bImage->Data)[0];
+			memcpy(data, buffer.pData, (size_t)buffer.iWidth * buffer.iHeight);
+
+			return bImage;
+		}
+
+		FloatImage ^ MvBlueSirius::CalcDepthImage(const MV6D_DepthBuffer& buffer)
+		{
+			CheckPlane(buffer.pData, "depth");
+
+			FloatImage^ fImage = ImagePool->RentFloatImage(buffer.iWidth, buffer.iHeight);
 			int i = 0;
-			for (int y = 0; y < image->Height; y++)
+			for (int y = 0; y < buffer.iHeight; y++)
 			{
-				for (int x = 0; x < image->Width; x++)
+				for (int x = 0; x < buffer.iWidth; x++)
 				{
-					fImage[y, x] = image[y, x].GetLength();
+					fImage[y, x] = buffer.pData[i++];
 				}
 			}
 
-			System::Threading::Monitor::Exit(_updateLock);
-
 			return fImage;
 		}
 
-		Point3fImage ^ MvBlueSirius::CalcPointCloud(FloatImage^ depthImage)
+		void MvBlueSirius::CalcPointsAndDistances(FrameSnapshot^ snapshot, bool mapped)
 		{
-			System::Threading::Monitor::Enter(_updateLock);
-
-			int depthWidth = depthImage->Width;
-			int depthHeight = depthImage->Height;
+			const MV6D_RequestBuffer& request = snapshot->Frame->Data();
+			const MV6D_DepthBuffer& buffer = mapped ? request.depthMapped : request.depthRaw;
+			float focalLength = (float)request.focalLength;
+			CheckPlane(buffer.pData, "depth");
 
-			Point3fImage^ PointCloud = gcnew Point3fImage(depthWidth, depthHeight);
+			Point3fImage^ points = ImagePool->RentPoint3fImage(buffer.iWidth, buffer.iHeight);
+			FloatImage^ distances = ImagePool->RentFloatImage(buffer.iWidth, buffer.iHeight);
 
-			int halfWidth = depthWidth / 2;
-			int halfHeight = depthHeight / 2;
+			DepthProjection* projection = TakeProjection(buffer.iWidth, buffer.iHeight, focalLength, mapped);
+			try
+			{
+				pin_ptr<Point3f> pointsData = &(points->Data)[0];
+				pin_ptr<float> distancesData = &(distances->Data)[0];
+				projection->ToPointsAndDistances(buffer.pData, (float*)pointsData, distancesData);
+			}
+			finally
+			{
+				projection->Release();
+			}
 
-			for (int y = 0; y < depthHeight; y++)
+			if (mapped)
+			{
+				snapshot->PointCloudMapped = points;
+				snapshot->DistanceImageMapped = distances;
+			}
+			else
+			{
+				snapshot->PointCloud = points;
+				snapshot->DistanceImage = distances;
+			}
+		}
+	
+		DepthProjection* MvBlueSirius::TakeProjection(int width, int height, float focalLength, bool mapped)
+		{
+			// the tables only depend on the geometry, which rarely changes; the lock is only held to take a reference
+			DepthProjection* projection;
+			System::Threading::Monitor::Enter(_projectionLock);
+			try
 			{
-				for (int x = 0; x < depthWidth; x++)
+				projection = mapped ? _projectionMapped : _projection;
+				if (nullptr != projection)
 				{
-					float wz = depthImage[y, x];
-					if (wz <= 0)
-					{
-						continue;
-					}
-
-					float wx = ((x - halfWidth) / FocalLength) * wz;
-					float wy = ((y - halfHeight) / FocalLength) * wz;
-					PointCloud[y, x] = Point3f(wx, wy, wz);
+					projection->AddRef();
 				}
 			}
+			finally
+			{
+				System::Threading::Monitor::Exit(_projectionLock);
+			}
+			if (nullptr != projection && projection->Matches(width, height, focalLength))
+			{
+				return projection;
+			}
+			if (nullptr != projection)
+			{
+				projection->Release();
+			}
 
-			System::Threading::Monitor::Exit(_updateLock);
-
-			return PointCloud;
+			// build the tables outside the lock, then swap them in; users of the old ones keep their reference
+			projection = new DepthProjection(width, height, focalLength);
+			projection->AddRef(); // held by the camera
+			DepthProjection* previous;
+			System::Threading::Monitor::Enter(_projectionLock);
+			try
+			{
+				if (mapped)
+				{
+					previous = _projectionMapped;
+					_projectionMapped = projection;
+				}
+				else
+				{
+					previous = _projection;
+					_projection = projection;
+				}
+			}
+			finally
+			{
+				System::Threading::Monitor::Exit(_projectionLock);
+			}
+			if (nullptr != previous)
+			{
+				previous->Release();
+			}
+			return projection;
 		}
 	}
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 #include <msclr/marshal.h>
 #include <mv6D.h>
+#include "DepthProjection.h"
+#include "RequestBuffer.h"
 
 using namespace MetriCam2;
 using namespace MetriCam2::Exceptions;
@@ -31,93 +33,121 @@ namespace MetriCam2
 
 					// Point cloud computed from ZMapped data
 					static const String^ PointCloudMapped = "PointCloudMapped";
+
+					// 8-bit raw image of the master (left) camera, as delivered by the SDK
+					static const String^ LeftRaw = "LeftRaw";
+
+					// 8-bit raw image of the slave (right) camera, as delivered by the SDK
+					static const String^ RightRaw = "RightRaw";
 			};
 
 		private:
-			ref struct ImageData {
-				unsigned int Width;
-				unsigned int Height;
-				unsigned int BufferSize;
-				unsigned char* Data;
-
-				void FreeData()
+			/// <summary>
+			/// One acquired frame: the request with its planes and the channels computed from it so far.
+			/// </summary>
+			/// <remarks>
+			/// UpdateImpl publishes a new snapshot by swapping <see cref="_snapshot"/> and never modifies a published one, except for filling the caches.
+			/// Readers take a reference with <see cref="TryAddRef"/>; the request is released when the last reference is gone.
+			/// Each <see cref="MetriCam2::FrameSnapshot"/> of the camera holds one of them (see CaptureFrameImpl).
+			/// Then the cached images go back to the camera's image pool, unless they have been handed out in ReadOnlyImages mode.
+			/// </remarks>
+			ref class FrameSnapshot
+			{
+			public:
+				FrameSnapshot(RequestBuffer* frame, long long receivedAt, MetriCam2::ImagePool^ pool)
+					: Frame(frame), ReceivedAt(receivedAt), FrameNumber(0), TimeStamp(0), SharedImages(false), _pool(pool), _refCount(1)
 				{
-					if (nullptr != this->Data)
-					{
-						delete[] this->Data;
-					}
-					this->BufferSize = 0;
-					this->Data = nullptr;
 				}
 
-				void CopyColorData(MV6D_ColorBuffer& colorBuffer)
+				RequestBuffer* Frame;
+				long long ReceivedAt; // Stopwatch timestamp at which the SDK wait returned
+				int FrameNumber; // stamps of the frame for shared images, set when it is published
+				long long TimeStamp;
+				bool SharedImages; // set if cached images have been handed out, so they must not be recycled
+
+				FloatImage^ MasterImage;
+				FloatImage^ SlaveImage;
+				ByteImage^ MasterRaw;
+				ByteImage^ SlaveRaw;
+				FloatImage^ ZImageMapped;
+				FloatImage^ ZImage;
+				FloatImage^ DistanceImage;
+				FloatImage^ DistanceImageMapped;
+				Point3fImage^ PointCloud;
+				Point3fImage^ PointCloudMapped;
+
+				/// <summary>
+				/// Takes a reference unless the snapshot has already been released by its last owner.
+				/// </summary>
+				bool TryAddRef()
 				{
-					unsigned int numElements = this->Width * this->Height;
-					int sizeInBytes = numElements * sizeof(char) * 3;
-					ResizeBuffer(sizeInBytes);
-
-					for (unsigned int i = 0; i < numElements; i++)
+					int count = _refCount;
+					while (count > 0)
 					{
-						this->Data[(3 * i) + 0] = colorBuffer.pData[i].b;
-						this->Data[(3 * i) + 1] = colorBuffer.pData[i].g;
-						this->Data[(3 * i) + 2] = colorBuffer.pData[i].r;
+						int previous = System::Threading::Interlocked::CompareExchange(_refCount, count + 1, count);
+						if (previous == count)
+						{
+							return true;
+						}
+						count = previous;
 					}
+					return false;
 				}
 
-				void CopyDepthData(MV6D_DepthBuffer& depthBuffer)
+				MV6D_ResultCode Release()
 				{
-					int numElements = this->Width * this->Height;
-					int sizeInBytes = numElements * sizeof(float);
-					ResizeBuffer(sizeInBytes);
-					memcpy_s((void*)this->Data, sizeInBytes, (void*)depthBuffer.pData, sizeInBytes);
-				}
-
-				void CopyGrayData(MV6D_GrayBuffer& buffer)
-				{
-					int numElements = this->Width * this->Height;
-					int sizeInBytes = numElements * sizeof(char);
-					ResizeBuffer(sizeInBytes);
-					memcpy_s((void*)this->Data, sizeInBytes, (void*)buffer.pData, sizeInBytes);
+					if (0 != System::Threading::Interlocked::Decrement(_refCount))
+					{
+						return rcOk;
+					}
+					if (!SharedImages)
+					{
+						RecycleImages();
+					}
+					return Frame->Release();
 				}
 
 			private:
-				void ResizeBuffer(int sizeInBytes)
+				void RecycleImages()
 				{
-					if (nullptr != this->Data)
-					{
-						// Buffer exists
-						if (this->BufferSize == sizeInBytes)
-						{
-							// Buffer has correct size
-							return;
-						}
-
-						this->FreeData();
-					}
-
-					this->Data = new unsigned char[sizeInBytes];
-					this->BufferSize = sizeInBytes;
+					_pool->Return(MasterImage);
+					_pool->Return(SlaveImage);
+					_pool->Return(MasterRaw);
+					_pool->Return(SlaveRaw);
+					_pool->Return(ZImageMapped);
+					_pool->Return(ZImage);
+					_pool->Return(DistanceImage);
+					_pool->Return(DistanceImageMapped);
+					_pool->Return(PointCloud);
+					_pool->Return(PointCloudMapped);
 				}
+
+				MetriCam2::ImagePool^ _pool;
+				int _refCount;
 			};
 
 			MV6D_Handle _h6D;
-			System::Object^ _updateLock;
-			float _focalLength;
-
-			ImageData^ _master;
-			ImageData^ _slave;
-			ImageData^ _color;
-			ImageData^ _depthMapped;
-			ImageData^ _depthRaw;
-
-			FloatImage^ _currentMasterImage; // caches computed FloatImage
-			FloatImage^ _currentSlaveImage; // caches computed FloatImage
-			FloatImage^ _currentZImageMapped; // caches computed FloatImage
-			FloatImage^ _currentZImage; // caches computed FloatImage
-			FloatImage^ _currentDistanceImage; // caches computed FloatImage
-			FloatImage^ _currentDistanceImageMapped; // caches computed FloatImage
-			Point3fImage^ _currentPointCloud; // caches computed Point3fImage
-			Point3fImage^ _currentPointCloudMapped; // caches computed Point3fImage
+			int _maxRetainedRequests;
+			bool _readOnlyImages;
+
+			// optional acquisition thread
+			bool _useAcquisitionThread;
+			int _queueCapacity;
+			System::Threading::Thread^ _acquisitionThread;
+			volatile bool _stopAcquisition;
+			System::Collections::Generic::Queue<FrameSnapshot^>^ _queue; // oldest first, guarded by _queueLock
+			System::Object^ _queueLock;
+			System::Threading::ManualResetEvent^ _frameAvailable; // set while frames are queued or the acquisition thread has failed, guarded by _queueLock
+			Exception^ _acquisitionError; // hands errors from the acquisition thread to Update
+			int _droppedFrames;
+			float _latency;
+
+			RequestBufferPool* _requestPool;
+			FrameSnapshot^ _snapshot; // current frame, one reference held by the camera
+			// tables for depthRaw and depthMapped; each holds a reference, _projectionLock guards swapping them
+			DepthProjection* _projection;
+			DepthProjection* _projectionMapped;
+			System::Object^ _projectionLock;
 
 			property ParamDesc<bool>^ AutoExposureDesc
 			{
@@ -234,6 +264,94 @@ namespace MetriCam2
 				}
 			}
 
+			property RangeParamDesc<int>^ MaxRetainedRequestsDesc
+			{
+				inline RangeParamDesc<int> ^get()
+				{
+					RangeParamDesc<int> ^res = gcnew RangeParamDesc<int>(1, 8);
+					res->Unit = "";
+					res->Description = "Number of SDK requests held without copying";
+					res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+					res->WritableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+					return res;
+				}
+			}
+
+			property ParamDesc<bool>^ ReadOnlyImagesDesc
+			{
+				inline ParamDesc<bool> ^get()
+				{
+					ParamDesc<bool> ^res = gcnew ParamDesc<bool>();
+					res->Unit = "";
+					res->Description = "Hand out cached images instead of copies";
+					res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+					res->WritableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+					return res;
+				}
+			}
+
+			property ParamDesc<bool>^ AcquisitionThreadDesc
+			{
+				inline ParamDesc<bool> ^get()
+				{
+					ParamDesc<bool> ^res = gcnew ParamDesc<bool>();
+					res->Unit = "";
+					res->Description = "Acquire frames on a background thread";
+					res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+					res->WritableWhen = ParamDesc::ConnectionStates::Disconnected;
+					return res;
+				}
+			}
+
+			property RangeParamDesc<int>^ QueueCapacityDesc
+			{
+				inline RangeParamDesc<int> ^get()
+				{
+					RangeParamDesc<int> ^res = gcnew RangeParamDesc<int>(1, 16);
+					res->Unit = "frames";
+					res->Description = "Frames buffered by the acquisition thread";
+					res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+					res->WritableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+					return res;
+				}
+			}
+
+			property ParamDesc<int>^ QueueDepthDesc
+			{
+				inline ParamDesc<int> ^get()
+				{
+					ParamDesc<int> ^res = gcnew ParamDesc<int>();
+					res->Unit = "frames";
+					res->Description = "Frames waiting for Update";
+					res->ReadableWhen = ParamDesc::ConnectionStates::Connected;
+					return res;
+				}
+			}
+
+			property ParamDesc<int>^ DroppedFramesDesc
+			{
+				inline ParamDesc<int> ^get()
+				{
+					ParamDesc<int> ^res = gcnew ParamDesc<int>();
+					res->Unit = "frames";
+					res->Description = "Frames which never reached Update since connecting";
+					res->ReadableWhen = ParamDesc::ConnectionStates::Connected;
+					return res;
+				}
+			}
+
+			property ParamDesc<float>^ LatencyDesc
+			{
+				inline ParamDesc<float> ^get()
+				{
+					ParamDesc<float> ^res = gcnew ParamDesc<float>();
+					res->Unit = "ms";
+					res->Description = "Time from the arrival of the last frame from the SDK until Update published it";
+					res->ReadableWhen = ParamDesc::ConnectionStates::Connected;
+					return res;
+				}
+			}
+
 			property ParamDesc<float>^ FocalLengthDesc
 			{
 				inline ParamDesc<float> ^get()
@@ -376,11 +494,143 @@ namespace MetriCam2
 			}
 		}
 
+		/// <summary>
+		/// Focal length of the current frame, 0 if there is none.
+		/// </summary>
 		property float FocalLength
 		{
-			inline float get()
+			float get();
+		}
+
+		/// <summary>
+		/// Number of SDK requests whose planes are used in place, without copying them.
+		/// </summary>
+		/// <remarks>
+		/// The request of the current frame stays locked until the next frame is acquired and all channels being computed from it are done.
+		/// If more requests would be locked, the newest one is copied and handed back to the SDK immediately, so acquisition does not run out of requests.
+		/// </remarks>
+		property int MaxRetainedRequests
+		{
+			int get()
+			{
+				return _maxRetainedRequests;
+			}
+			void set(int value)
+			{
+				_maxRetainedRequests = value;
+				if (nullptr != _requestPool)
+				{
+					_requestPool->SetMaxRetained(value);
+				}
+			}
+		}
+
+		/// <summary>
+		/// If set, <see cref="Camera.CalcChannel"/> returns the image cached for the current frame instead of a copy of it.
+		/// </summary>
+		/// <remarks>
+		/// All callers computing a channel of the same frame then get the same instance. It must be treated as read-only;
+		/// clone it (e.g. <c>new FloatImage(image)</c>) before modifying it. Off by default, where every call returns a private copy.
+		/// The Color channel is never shared, because its Bitmap cannot be used by several threads at a time.
+		/// </remarks>
+		property bool ReadOnlyImages
+		{
+			bool get()
+			{
+				return _readOnlyImages;
+			}
+			void set(bool value)
+			{
+				_readOnlyImages = value;
+			}
+		}
+
+		/// <summary>
+		/// If set, a background thread continuously takes frames from the SDK into a queue of <see cref="QueueCapacity"/> frames,
+		/// and <see cref="Camera.Update"/> returns the newest of them without waiting for the SDK.
+		/// </summary>
+		/// <remarks>
+		/// Queued frames keep their SDK requests; raise <see cref="MaxRetainedRequests"/> along with the capacity to avoid copying them.
+		/// Can only be changed while disconnected.
+		/// </remarks>
+		property bool AcquisitionThread
+		{
+			bool get()
+			{
+				return _useAcquisitionThread;
+			}
+			void set(bool value)
+			{
+				if (IsConnected && value != _useAcquisitionThread)
+				{
+					throw ExceptionBuilder::Build(InvalidOperationException::typeid, Name, "error_setParameter", "AcquisitionThread can only be changed while disconnected.");
+				}
+				_useAcquisitionThread = value;
+			}
+		}
+
+		/// <summary>
+		/// Maximum number of frames queued by the acquisition thread. If the queue is full, the oldest frame is dropped.
+		/// </summary>
+		/// <remarks>
+		/// Each queued frame retains an SDK request, and so does the current frame. With the defaults (1 queued frame,
+		/// 2 retained requests) no frame is copied; keep <see cref="MaxRetainedRequests"/> at least QueueCapacity + 1.
+		/// </remarks>
+		property int QueueCapacity
+		{
+			int get()
+			{
+				return _queueCapacity;
+			}
+			void set(int value)
+			{
+				_queueCapacity = value;
+			}
+		}
+
+		/// <summary>
+		/// Number of frames currently waiting in the queue of the acquisition thread.
+		/// </summary>
+		property int QueueDepth
+		{
+			int get()
+			{
+				System::Threading::Monitor::Enter(_queueLock);
+				try
+				{
+					return _queue->Count;
+				}
+				finally
+				{
+					System::Threading::Monitor::Exit(_queueLock);
+				}
+			}
+		}
+
+		/// <summary>
+		/// Number of frames since connecting which did not reach <see cref="Camera.Update"/>:
+		/// dropped by the SDK, pushed out of the full queue, or skipped because a newer frame was queued.
+		/// </summary>
+		property int DroppedFrames
+		{
+			int get()
+			{
+				return _droppedFrames;
+			}
+		}
+
+		/// <summary>
+		/// Time in ms from the arrival of the current frame from the SDK until <see cref="Camera.Update"/> published it.
+		/// </summary>
+		/// <remarks>
+		/// Without <see cref="AcquisitionThread"/>, Update waits for the SDK itself, so this is only the time to take over the request (about 0,
+		/// unless the request has to be copied). With the acquisition thread, it is the time the frame waited in the queue.
+		/// </remarks>
+		property float Latency
+		{
+			float get()
 			{
-				return _focalLength;
+				return _latency;
 			}
 		}
 
@@ -411,19 +661,72 @@ namespace MetriCam2
 			/// <seealso cref="Camera.Update"/>
 			virtual void UpdateImpl() override;
 
+			/// <summary>
+			/// Activates a channel. Only the SDK planes backing active channels are used.
+			/// </summary>
+			/// <remarks>This method is implicitely called by <see cref="Camera.ActivateChannel"/> inside a camera lock.</remarks>
+			/// <seealso cref="Camera.ActivateChannel"/>
+			virtual void ActivateChannelImpl(String^ channelName) override;
+
+			/// <summary>
+			/// Deactivates a channel. Planes no longer backing any active channel are not copied anymore.
+			/// </summary>
+			/// <remarks>This method is implicitely called by <see cref="Camera.DeactivateChannel"/> inside a camera lock.</remarks>
+			/// <seealso cref="Camera.DeactivateChannel"/>
+			virtual void DeactivateChannelImpl(String^ channelName) override;
+
 			/// <summary>Computes (image) data for a given channel.</summary>
 			/// <param name="channelName">Channel name.</param>
 			/// <returns>(Image) Data.</returns>
 			/// <seealso cref="Camera.CalcChannel"/>
 			virtual ImageBase^ CalcChannelImpl(String^ channelName) override;
 
+			/// <summary>Takes a reference to the current frame for a <see cref="MetriCam2::FrameSnapshot"/>.</summary>
+			/// <returns>The frame; its request stays locked until <see cref="ReleaseFrameImpl"/>.</returns>
+			/// <seealso cref="Camera.AcquireCurrentFrame"/>
+			virtual Object^ CaptureFrameImpl() override;
+
+			/// <summary>Computes (image) data for a given channel of a frame snapshot.</summary>
+			/// <param name="channelName">Channel name.</param>
+			/// <param name="frameState">The frame, as returned by <see cref="CaptureFrameImpl"/>.</param>
+			/// <returns>(Image) Data.</returns>
+			/// <seealso cref="Camera.CalcChannel"/>
+			virtual ImageBase^ CalcChannelImpl(String^ channelName, Object^ frameState) override;
+
+			/// <summary>Drops the reference taken by <see cref="CaptureFrameImpl"/>.</summary>
+			/// <param name="frameState">The frame, as returned by <see cref="CaptureFrameImpl"/>.</param>
+			virtual void ReleaseFrameImpl(Object^ frameState) override;
+
+			/// <summary>
+			/// Waits asynchronously until the acquisition thread has queued a frame.
+			/// </summary>
+			/// <returns><c>true</c> if a frame is queued, <c>false</c> without acquisition thread or on timeout.</returns>
+			/// <seealso cref="Camera.UpdateAsync"/>
+			virtual System::Threading::Tasks::Task<bool>^ WaitForFrameAsync(System::Threading::CancellationToken cancellationToken) override;
+
 		private:
 			// Internal helper functions
-			ColorImage^ CalcColorImage(ImageData^ image);
-			FloatImage^ CalcGreyImage(ImageData^ image);
-			FloatImage^ CalcDepthImage(ImageData^ image);
-			FloatImage^ CalcDistances(Point3fImage^ image);
-			Point3fImage^ CalcPointCloud(FloatImage^ depthImage);
+			ImageBase^ CalcChannelFromSnapshot(String^ channelName, FrameSnapshot^ snapshot);
+			FrameSnapshot^ AcquireSnapshot();
+			MV6D_RequestBuffer* TryWaitForRequest(int timeout, long long& receivedAt);
+			void PublishSnapshot(FrameSnapshot^ snapshot);
+			FrameSnapshot^ TakeNewestQueued(int timeout);
+			void StartAcquisition();
+			void StopAcquisition();
+			void AcquisitionLoop();
+			void WarnIfFailed(MV6D_ResultCode unlockResult);
+			static unsigned int PlanesOf(String^ channelName);
+			void UpdateRequiredPlanes(String^ activated, String^ deactivated);
+			void ReleaseSnapshot(FrameSnapshot^ snapshot);
+			ColorImage^ CalcColorImage(const MV6D_ColorBuffer& buffer);
+			FloatImage^ CalcGreyImage(const MV6D_GrayBuffer& buffer);
+			ByteImage^ CalcRawImage(const MV6D_GrayBuffer& buffer);
+			FloatImage^ CalcDepthImage(const MV6D_DepthBuffer& buffer);
+			void CalcPointsAndDistances(FrameSnapshot^ snapshot, bool mapped);
+			DepthProjection* TakeProjection(int width, int height, float focalLength, bool mapped);
+			FloatImage^ HandOut(FloatImage^ cached, FrameSnapshot^ snapshot, String^ channelName, bool share);
+			Point3fImage^ HandOut(Point3fImage^ cached, FrameSnapshot^ snapshot, String^ channelName, bool share);
+			ByteImage^ HandOut(ByteImage^ cached, FrameSnapshot^ snapshot, String^ channelName, bool share);
 			inline bool CheckResult(MV6D_ResultCode r, Type^ exceptionType, int exceptionID)
 			{
 				if (r != rcOk)
@@ -439,6 +742,13 @@ namespace MetriCam2
 				}
 				return true;
 			}
+			inline void CheckPlane(const void* data, String^ planeName)
+			{
+				if (nullptr == data)
+				{
+					throw gcnew MetriCam2::Exceptions::ImageAcquisitionFailedException(String::Format("The current frame does not contain {0} data.", planeName));
+				}
+			}
 			inline bool IsNullOrWhiteSpace(char* str)
 			{
 				return (nullptr == str || 0 == strcmp("", str));
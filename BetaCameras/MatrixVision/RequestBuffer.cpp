@@ -0,0 +1,128 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "RequestBuffer.h"
+#include <intrin.h>
+#include <string.h>
+
+using namespace MetriCam2::Cameras;
+
+RequestBuffer::RequestBuffer(RequestBufferPool* pool, MV6D_RequestBuffer* request)
+	: m_pool(pool), m_request(request), m_data(*request), m_refCount(1)
+{
+	memset(m_planes, 0, sizeof(m_planes));
+}
+
+RequestBuffer::~RequestBuffer()
+{
+	for (int i = 0; i < NumPlanes; i++)
+	{
+		delete[] m_planes[i];
+	}
+}
+
+void RequestBuffer::AddRef()
+{
+	_InterlockedIncrement(&m_refCount);
+}
+
+MV6D_ResultCode RequestBuffer::Release()
+{
+	if (0 != _InterlockedDecrement(&m_refCount))
+	{
+		return rcOk;
+	}
+
+	MV6D_ResultCode result = rcOk;
+	if (NULL != m_request)
+	{
+		result = MV6D_UnlockRequest(m_pool->m_handle, m_request);
+		_InterlockedDecrement(&m_pool->m_retained);
+		// may close the device, if the camera has been disconnected meanwhile
+		MV6D_ResultCode closeResult = m_pool->Release();
+		if (rcOk == result)
+		{
+			result = closeResult;
+		}
+	}
+	delete this;
+	return result;
+}
+
+template <class Plane>
+void RequestBuffer::CopyPlane(Plane& plane, int index, unsigned int planes)
+{
+	if (0 == (planes & (1 << index)))
+	{
+		plane.pData = NULL;
+	}
+	if (NULL == plane.pData)
+	{
+		return;
+	}
+	size_t sizeInBytes = (size_t)plane.iWidth * plane.iHeight * sizeof(*plane.pData);
+	m_planes[index] = new unsigned char[sizeInBytes];
+	memcpy(m_planes[index], plane.pData, sizeInBytes);
+	plane.pData = reinterpret_cast<decltype(plane.pData)>(m_planes[index]);
+}
+
+void RequestBuffer::Detach(unsigned int planes)
+{
+	// plane indices are the bit positions of the RequestPlane flags
+	CopyPlane(m_data.colorMapped, 0, planes);
+	CopyPlane(m_data.rawMaster, 1, planes);
+	CopyPlane(m_data.rawSlave1, 2, planes);
+	CopyPlane(m_data.depthMapped, 3, planes);
+	CopyPlane(m_data.depthRaw, 4, planes);
+	m_request = NULL;
+}
+
+RequestBufferPool::RequestBufferPool(MV6D_Handle handle, int maxRetained)
+	: m_handle(handle), m_refCount(1), m_maxRetained(maxRetained), m_requiredPlanes(RequestPlaneAll), m_retained(0), m_detached(0)
+{
+}
+
+RequestBufferPool::~RequestBufferPool()
+{
+}
+
+void RequestBufferPool::AddRef()
+{
+	_InterlockedIncrement(&m_refCount);
+}
+
+MV6D_ResultCode RequestBufferPool::Release()
+{
+	if (0 != _InterlockedDecrement(&m_refCount))
+	{
+		return rcOk;
+	}
+
+	MV6D_ResultCode result = MV6D_DeviceClose(m_handle);
+	MV6D_ResultCode closeResult = MV6D_Close(m_handle);
+	delete this;
+	return (rcOk != result) ? result : closeResult;
+}
+
+RequestBuffer* RequestBufferPool::Wrap(MV6D_RequestBuffer* request, const RequestBuffer* replaced, MV6D_ResultCode& unlockResult)
+{
+	unlockResult = rcOk;
+	RequestBuffer* buffer = new RequestBuffer(this, request);
+	// Only Wrap increments m_retained, so it cannot exceed the limit between the check and the increment.
+	long retained = m_retained;
+	if (NULL != replaced && replaced->IsRetained())
+	{
+		retained--;
+	}
+	if (retained < m_maxRetained)
+	{
+		_InterlockedIncrement(&m_retained);
+		AddRef(); // released with the request
+		return buffer;
+	}
+
+	buffer->Detach(m_requiredPlanes);
+	m_detached++;
+	unlockResult = MV6D_UnlockRequest(m_handle, request);
+	return buffer;
+}
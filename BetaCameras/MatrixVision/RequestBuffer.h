@@ -0,0 +1,150 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include <mv6D.h>
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	class RequestBufferPool;
+
+	/*
+	 * Output planes of an MV6D request, as bit flags.
+	 */
+	enum RequestPlane
+	{
+		RequestPlaneColor = 1 << 0, // colorMapped
+		RequestPlaneRawMaster = 1 << 1, // rawMaster
+		RequestPlaneRawSlave = 1 << 2, // rawSlave1
+		RequestPlaneDepthMapped = 1 << 3, // depthMapped
+		RequestPlaneDepthRaw = 1 << 4, // depthRaw
+		RequestPlaneAll = (1 << 5) - 1,
+	};
+
+	/*
+	 * Reference counted handle of an MV6D request.
+	 *
+	 * A retained handle keeps the request locked in the SDK and exposes its planes without copying them;
+	 * MV6D_UnlockRequest is called when the last reference is released. A detached handle owns copies
+	 * of the planes and does not hold an SDK request (see RequestBufferPool::Wrap).
+	 *
+	 * AddRef and Release may be called from any thread.
+	 */
+	class RequestBuffer
+	{
+	public:
+		/*
+		 * The planes of the request. pData of a plane is NULL if the SDK did not produce it.
+		 */
+		const MV6D_RequestBuffer& Data() const { return m_data; }
+
+		/*
+		 * Whether the planes point into a locked SDK request (true) or into copies (false).
+		 */
+		bool IsRetained() const { return NULL != m_request; }
+
+		void AddRef();
+
+		/*
+		 * Drops a reference. Returns the result of MV6D_UnlockRequest if this was the last reference of a
+		 * retained request, rcOk otherwise. The last retained request of a disconnected camera also closes the
+		 * device (see RequestBufferPool::Release). The handle must not be used after its last reference is released.
+		 */
+		MV6D_ResultCode Release();
+
+	private:
+		friend class RequestBufferPool;
+
+		RequestBuffer(RequestBufferPool* pool, MV6D_RequestBuffer* request);
+		~RequestBuffer();
+		RequestBuffer(const RequestBuffer&);
+		RequestBuffer& operator=(const RequestBuffer&);
+
+		void Detach(unsigned int planes);
+
+		template <class Plane>
+		void CopyPlane(Plane& plane, int index, unsigned int planes);
+
+		static const int NumPlanes = 5;
+
+		RequestBufferPool* m_pool;
+		MV6D_RequestBuffer* m_request; // NULL if detached
+		MV6D_RequestBuffer m_data;
+		unsigned char* m_planes[NumPlanes]; // copies of a detached request
+		volatile long m_refCount;
+	};
+
+	/*
+	 * Creates RequestBuffer handles for one MV6D device and limits how many requests stay locked at a time.
+	 *
+	 * The SDK only has a few request objects; if all of them are held by the application, acquisition stalls.
+	 * Requests beyond MaxRetained are therefore copied and unlocked right away; only the RequiredPlanes are copied,
+	 * the others are NULL in the copy.
+	 *
+	 * The pool owns the MV6D handle and is reference counted: the camera holds one reference and every retained
+	 * request another one. The device is closed when the last of them is released, so requests still in use after
+	 * disconnecting are unlocked before the device is closed.
+	 */
+	class RequestBufferPool
+	{
+	public:
+		/*
+		 * Takes over handle, which is closed with the last reference. The pool has one reference.
+		 */
+		RequestBufferPool(MV6D_Handle handle, int maxRetained);
+
+		/*
+		 * Drops a reference. Closes the device and the handle if this was the last one and returns the first failure
+		 * of MV6D_DeviceClose and MV6D_Close; rcOk otherwise. The pool must not be used after its last reference is released.
+		 */
+		MV6D_ResultCode Release();
+
+		/*
+		 * Takes over a request returned by MV6D_DeviceResultWaitFor. The returned handle has one reference.
+		 * replaced is a retained handle the caller releases right after, e.g. the previous frame; it is not counted
+		 * against MaxRetained, so that MaxRetained 1 does not copy every frame. May be NULL.
+		 * unlockResult receives the result of MV6D_UnlockRequest if the request had to be copied, rcOk otherwise.
+		 * Must be called from one thread at a time.
+		 */
+		RequestBuffer* Wrap(MV6D_RequestBuffer* request, const RequestBuffer* replaced, MV6D_ResultCode& unlockResult);
+
+		int MaxRetained() const { return m_maxRetained; }
+		void SetMaxRetained(int maxRetained) { m_maxRetained = maxRetained; }
+
+		/*
+		 * RequestPlane flags of the planes that are used by the application.
+		 */
+		unsigned int RequiredPlanes() const { return m_requiredPlanes; }
+		void SetRequiredPlanes(unsigned int planes) { m_requiredPlanes = planes; }
+
+		/*
+		 * Number of requests currently locked by handles of this pool.
+		 */
+		int Retained() const { return m_retained; }
+
+		/*
+		 * Number of requests that were copied because too many were retained.
+		 */
+		long long Detached() const { return m_detached; }
+
+	private:
+		friend class RequestBuffer;
+
+		~RequestBufferPool();
+		RequestBufferPool(const RequestBufferPool&);
+		RequestBufferPool& operator=(const RequestBufferPool&);
+
+		void AddRef();
+
+		MV6D_Handle m_handle;
+		volatile long m_refCount;
+		int m_maxRetained;
+		unsigned int m_requiredPlanes;
+		volatile long m_retained;
+		long long m_detached;
+	};
+}
+}
@@ -856,7 +856,7 @@ FloatImage ^ MetriCam2::Cameras::AstraOpenNI::CalcZImage()
 
 	const openni::DepthPixel* pDepthRow = (const openni::DepthPixel*)depthFrame.getData();
 	const int rowSize = depthFrame.getStrideInBytes() / sizeof(openni::DepthPixel);
-	FloatImage^ depthDataMeters = gcnew FloatImage(depthFrame.getWidth(), depthFrame.getHeight());
+	FloatImage^ depthDataMeters = ImagePool->RentFloatImage(depthFrame.getWidth(), depthFrame.getHeight());
 	depthDataMeters->ChannelName = ChannelNames::ZImage;
 
 	for (int y = 0; y < depthFrame.getHeight(); ++y)
@@ -942,7 +942,7 @@ Point3fImage ^ MetriCam2::Cameras::AstraOpenNI::CalcPoint3fImage()
 
 	const openni::DepthPixel* pDepthRow = (const openni::DepthPixel*)depthFrame.getData();
 	const int rowSize = depthFrame.getStrideInBytes() / sizeof(openni::DepthPixel);
-	Point3fImage^ pointsImage = gcnew Point3fImage(depthFrame.getWidth(), depthFrame.getHeight());
+	Point3fImage^ pointsImage = ImagePool->RentPoint3fImage(depthFrame.getWidth(), depthFrame.getHeight());
 	pointsImage->ChannelName = ChannelNames::Point3DImage;
 
 	for (int y = 0; y < depthFrame.getHeight(); ++y)
@@ -0,0 +1,132 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "FrameFusion.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+using namespace MetriCam2::Cameras;
+
+FrameFusion::FrameFusion(int numPixels, int windowSize, bool hdr, uint16_t saturationLevel)
+	: m_numPixels(numPixels),
+	m_windowSize(std::min(std::max(windowSize, 1), (int)MaxWindowSize)),
+	m_hdr(hdr),
+	m_saturationLevel(saturationLevel),
+	m_numFrames(0),
+	m_next(0)
+{
+	m_phaseRing.resize((size_t)m_windowSize * m_numPixels);
+	m_amplitudeRing.resize((size_t)m_windowSize * m_numPixels);
+	m_scaleRing.resize(m_windowSize);
+	m_sumCos.resize(m_numPixels);
+	m_sumSin.resize(m_numPixels);
+	m_sumScaledAmplitude.resize(m_numPixels);
+	m_count.resize(m_numPixels);
+
+	const double twoPi = 6.283185307179586;
+	m_cos.resize(PhaseRange);
+	m_sin.resize(PhaseRange);
+	for (int p = 0; p < PhaseRange; p++)
+	{
+		double angle = twoPi * p / PhaseRange;
+		m_cos[p] = (int32_t)floor(CosSinOne * cos(angle) + 0.5);
+		m_sin[p] = (int32_t)floor(CosSinOne * sin(angle) + 0.5);
+	}
+	Reset();
+}
+
+void FrameFusion::Reset()
+{
+	m_numFrames = 0;
+	m_next = 0;
+	std::fill(m_sumCos.begin(), m_sumCos.end(), 0);
+	std::fill(m_sumSin.begin(), m_sumSin.end(), 0);
+	std::fill(m_sumScaledAmplitude.begin(), m_sumScaledAmplitude.end(), 0);
+	std::fill(m_count.begin(), m_count.end(), 0);
+}
+
+void FrameFusion::Push(const uint16_t* phases, const uint16_t* amplitudes, uint16_t integrationScale)
+{
+	uint16_t* slotPhases = &m_phaseRing[(size_t)m_next * m_numPixels];
+	uint16_t* slotAmplitudes = &m_amplitudeRing[(size_t)m_next * m_numPixels];
+	int64_t* sumCos = m_sumCos.data();
+	int64_t* sumSin = m_sumSin.data();
+	uint64_t* sumScaledAmplitude = m_sumScaledAmplitude.data();
+	uint8_t* count = m_count.data();
+	const int32_t* cosTable = m_cos.data();
+	const int32_t* sinTable = m_sin.data();
+	const uint16_t phaseMask = PhaseRange - 1;
+
+	if (m_numFrames == m_windowSize)
+	{
+		// window is full: remove the contribution of the frame we are about to overwrite
+		uint64_t slotScale = m_scaleRing[m_next];
+		for (int i = 0; i < m_numPixels; i++)
+		{
+			int64_t w = Weight(slotAmplitudes[i]);
+			uint16_t p = slotPhases[i] & phaseMask;
+			sumCos[i] -= w * cosTable[p];
+			sumSin[i] -= w * sinTable[p];
+			sumScaledAmplitude[i] -= (w != 0) ? slotScale * slotAmplitudes[i] : 0;
+			count[i] -= (w != 0);
+		}
+	}
+	else
+	{
+		m_numFrames++;
+	}
+
+	uint64_t scale = std::max(integrationScale, (uint16_t)1);
+	for (int i = 0; i < m_numPixels; i++)
+	{
+		int64_t w = Weight(amplitudes[i]);
+		uint16_t p = phases[i] & phaseMask;
+		sumCos[i] += w * cosTable[p];
+		sumSin[i] += w * sinTable[p];
+		sumScaledAmplitude[i] += (w != 0) ? scale * amplitudes[i] : 0;
+		count[i] += (w != 0);
+	}
+
+	memcpy(slotPhases, phases, m_numPixels * sizeof(uint16_t));
+	memcpy(slotAmplitudes, amplitudes, m_numPixels * sizeof(uint16_t));
+	m_scaleRing[m_next] = (uint16_t)scale;
+
+	m_next = (m_next + 1) % m_windowSize;
+}
+
+void FrameFusion::GetPhases(float* dst) const
+{
+	const int64_t* sumCos = m_sumCos.data();
+	const int64_t* sumSin = m_sumSin.data();
+	const uint8_t* count = m_count.data();
+	const double toPhase = PhaseRange / 6.283185307179586;
+
+	for (int i = 0; i < m_numPixels; i++)
+	{
+		if (count[i] == 0)
+		{
+			dst[i] = 0.0f;
+			continue;
+		}
+		double phase = atan2((double)sumSin[i], (double)sumCos[i]) * toPhase;
+		if (phase < 0)
+		{
+			phase += PhaseRange;
+		}
+		// phases just below the wrap-around may round up to exactly PhaseRange
+		float value = (float)phase;
+		dst[i] = (value >= PhaseRange) ? 0.0f : value;
+	}
+}
+
+void FrameFusion::GetAmplitudes(float* dst) const
+{
+	const uint64_t* sumScaledAmplitude = m_sumScaledAmplitude.data();
+	const uint8_t* count = m_count.data();
+
+	for (int i = 0; i < m_numPixels; i++)
+	{
+		dst[i] = (count[i] == 0) ? 0.0f : (float)sumScaledAmplitude[i] / (float)count[i];
+	}
+}
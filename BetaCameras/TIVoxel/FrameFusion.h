@@ -0,0 +1,97 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	/*
+	 * Sliding-window fusion of raw ToF frames (12-bit phase + amplitude).
+	 *
+	 * Keeps the last N raw frames and per-pixel running sums, so pushing a frame
+	 * costs O(pixels) independent of the window size:
+	 *   fused phase     = arg(sum(w_i * e^(j * phase_i)))  (mean on the circle, so samples around the wrap-around are averaged correctly)
+	 *   fused amplitude = sum(s_i * amplitude_i) / count_i
+	 * with w_i = amplitude_i and s_i the integration scale of the frame.
+	 * The sums are integers (phases via a fixed-point sin/cos table), so they do not drift.
+	 *
+	 * In HDR mode, frames of different integration times are merged by giving
+	 * saturated samples (amplitude >= saturation level) a weight of zero, so each
+	 * pixel is dominated by its strongest unsaturated sample. Amplitudes of frames
+	 * with shorter integration times are scaled to the longest one before they are averaged.
+	 *
+	 * This is a plain native class. It is not thread-safe; the owner has to serialize access.
+	 */
+	class FrameFusion
+	{
+	public:
+		static const int MaxWindowSize = 16;
+		static const uint16_t PhaseRange = 4096; // 12-bit phase data
+		static const uint16_t DefaultSaturationLevel = 4000; // 12-bit amplitude data, with some headroom
+
+		FrameFusion(int numPixels, int windowSize, bool hdr, uint16_t saturationLevel = DefaultSaturationLevel);
+
+		void Reset();
+
+		/*
+		 * Adds a frame to the window and drops the oldest one if the window is full.
+		 * Both buffers must contain numPixels values.
+		 * integrationScale is the ratio of the longest integration time to the one of this frame (1 without HDR).
+		 */
+		void Push(const uint16_t* phases, const uint16_t* amplitudes, uint16_t integrationScale = 1);
+
+		/*
+		 * Writes the amplitude-weighted circular mean phase (in raw 12-bit units, [0, PhaseRange)) to dst.
+		 * Pixels without any valid sample in the window are set to 0.
+		 */
+		void GetPhases(float* dst) const;
+
+		/*
+		 * Writes the mean amplitude of all valid samples, scaled to the longest integration time, to dst.
+		 */
+		void GetAmplitudes(float* dst) const;
+
+		int NumPixels() const { return m_numPixels; }
+		int WindowSize() const { return m_windowSize; }
+		int NumFrames() const { return m_numFrames; }
+		bool IsHdr() const { return m_hdr; }
+
+	private:
+		static const int CosSinOne = 32767;
+
+		inline uint16_t Weight(uint16_t amplitude) const
+		{
+			return (m_hdr && amplitude >= m_saturationLevel) ? 0 : amplitude;
+		}
+
+		int m_numPixels;
+		int m_windowSize;
+		bool m_hdr;
+		uint16_t m_saturationLevel;
+
+		int m_numFrames; // frames currently in the window
+		int m_next; // ring index of the slot to be overwritten next
+
+		// ring of raw frames, m_windowSize * m_numPixels each, and the integration scale of each slot
+		std::vector<uint16_t> m_phaseRing;
+		std::vector<uint16_t> m_amplitudeRing;
+		std::vector<uint16_t> m_scaleRing;
+
+		// running sums of w * cos(phase) and w * sin(phase), with sin/cos in fixed point (CosSinOne);
+		// 4095 * 32767 * MaxWindowSize needs more than 31 bits, hence 64 bit
+		std::vector<int64_t> m_sumCos;
+		std::vector<int64_t> m_sumSin;
+		std::vector<uint64_t> m_sumScaledAmplitude;
+		std::vector<uint8_t> m_count;
+
+		// cos and sin of each raw phase value, in units of 1 / CosSinOne
+		std::vector<int32_t> m_cos;
+		std::vector<int32_t> m_sin;
+	};
+}
+}
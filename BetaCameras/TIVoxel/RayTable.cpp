@@ -0,0 +1,98 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "RayTable.h"
+#include <math.h>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RAYTABLE_USE_SSE2
+#endif
+
+using namespace MetriCam2::Cameras;
+
+RayTable::RayTable(int width, int height, const LensParameters& lens)
+	: m_width(width), m_height(height)
+{
+	const int numPixels = width * height;
+	m_rays.resize(3 * (size_t)numPixels);
+	m_rayZ.resize(numPixels);
+
+	for (int v = 0; v < height; v++)
+	{
+		float yd = (v - lens.cy) / lens.fy;
+		for (int u = 0; u < width; u++)
+		{
+			float xd = (u - lens.cx) / lens.fx;
+			float x, y;
+			Undistort(lens, xd, yd, x, y);
+
+			// ray through (x, y, 1) on the normalized image plane
+			float norm = 1.0f / sqrtf(x * x + y * y + 1.0f);
+			int i = v * width + u;
+			m_rays[3 * i + 0] = x * norm;
+			m_rays[3 * i + 1] = y * norm;
+			m_rays[3 * i + 2] = norm;
+			m_rayZ[i] = norm;
+		}
+	}
+}
+
+void RayTable::Undistort(const LensParameters& lens, float xd, float yd, float& x, float& y)
+{
+	// Brown-Conrady has no closed-form inverse; use fixed-point iteration like OpenCV's undistortPoints.
+	x = xd;
+	y = yd;
+	for (int iteration = 0; iteration < 10; iteration++)
+	{
+		float r2 = x * x + y * y;
+		float radial = 1.0f + ((lens.k3 * r2 + lens.k2) * r2 + lens.k1) * r2;
+		float dx = 2.0f * lens.p1 * x * y + lens.p2 * (r2 + 2.0f * x * x);
+		float dy = lens.p1 * (r2 + 2.0f * y * y) + 2.0f * lens.p2 * x * y;
+		x = (xd - dx) / radial;
+		y = (yd - dy) / radial;
+	}
+}
+
+void RayTable::ToPoints(const float* distances, float* points) const
+{
+	const int numPixels = m_width * m_height;
+	const float* rays = m_rays.data();
+	int i = 0;
+
+#ifdef RAYTABLE_USE_SSE2
+	// 4 pixels = 12 floats per iteration: broadcast each distance to its 3 coordinates
+	for (; i + 4 <= numPixels; i += 4)
+	{
+		__m128 d = _mm_loadu_ps(distances + i); // d0 d1 d2 d3
+		__m128 d0 = _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 0, 0, 0)); // d0 d0 d0 d1
+		__m128 d1 = _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 2, 1, 1)); // d1 d1 d2 d2
+		__m128 d2 = _mm_shuffle_ps(d, d, _MM_SHUFFLE(3, 3, 3, 2)); // d2 d3 d3 d3
+		const float* r = rays + 3 * i;
+		float* p = points + 3 * i;
+		_mm_storeu_ps(p + 0, _mm_mul_ps(d0, _mm_loadu_ps(r + 0)));
+		_mm_storeu_ps(p + 4, _mm_mul_ps(d1, _mm_loadu_ps(r + 4)));
+		_mm_storeu_ps(p + 8, _mm_mul_ps(d2, _mm_loadu_ps(r + 8)));
+	}
+#endif
+
+	for (; i < numPixels; i++)
+	{
+		float d = distances[i];
+		points[3 * i + 0] = d * rays[3 * i + 0];
+		points[3 * i + 1] = d * rays[3 * i + 1];
+		points[3 * i + 2] = d * rays[3 * i + 2];
+	}
+}
+
+void RayTable::ToZ(const float* distances, float* z) const
+{
+	const int numPixels = m_width * m_height;
+	const float* rayZ = m_rayZ.data();
+
+	// simple enough for the compiler to vectorize
+	for (int i = 0; i < numPixels; i++)
+	{
+		z[i] = distances[i] * rayZ[i];
+	}
+}
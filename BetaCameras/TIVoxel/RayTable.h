@@ -0,0 +1,54 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include <vector>
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	/*
+	 * Per-pixel unit viewing rays of a lens (pinhole + Brown-Conrady distortion).
+	 *
+	 * The table is built once per lens calibration. Converting a radial distance image
+	 * to a point cloud or Z image is then a single multiplication per coordinate.
+	 *
+	 * This is a plain native class. It is immutable after construction.
+	 */
+	class RayTable
+	{
+	public:
+		struct LensParameters
+		{
+			float fx, fy, cx, cy;
+			float k1, k2, k3;
+			float p1, p2;
+		};
+
+		RayTable(int width, int height, const LensParameters& lens);
+
+		/*
+		 * Writes interleaved XYZ coordinates (3 floats per pixel) for the given radial distances.
+		 */
+		void ToPoints(const float* distances, float* points) const;
+
+		/*
+		 * Writes the Z coordinate for the given radial distances.
+		 */
+		void ToZ(const float* distances, float* z) const;
+
+		int Width() const { return m_width; }
+		int Height() const { return m_height; }
+
+	private:
+		static void Undistort(const LensParameters& lens, float xd, float yd, float& x, float& y);
+
+		int m_width;
+		int m_height;
+		std::vector<float> m_rays; // interleaved XYZ, unit length
+		std::vector<float> m_rayZ; // Z component only, for the Z image
+	};
+}
+}
@@ -17,39 +17,41 @@ static TIVoxel::TIVoxel()
 	Voxel::logger.setDefaultLogLevel(Voxel::LOG_INFO);
 	sys = new Voxel::CameraSystem();
 	connectedVoxelObjects = gcnew List<TIVoxel^>();
+	scannedDevices = new Voxel::Vector<Voxel::DevicePtr>();
+	scanAge = gcnew System::Diagnostics::Stopwatch();
+	claimedDevices = gcnew List<String^>();
 }
 
 void TIVoxel::ConnectImpl()
 {
-	System::Threading::Monitor::Enter(settingsLock);
 	Voxel::DevicePtr device;
+	System::Threading::Monitor::Enter(settingsLock);
 	try
 	{
+		// CameraSystem is shared by all instances; only selecting and opening the device is serialized
+		System::Threading::Monitor::Enter(systemLock);
+		try
 		{
-			// get number of voxel devices
-			Voxel::Vector<Voxel::DevicePtr> &devices = sys->scan();
-			size_t numDevices = devices.size();
-			if (numDevices == 0)
+			device = SelectDevice(GetDevices(), SerialNumber);
+			if (!device)
 			{
-				throw ExceptionBuilder::Build(MetriCam2::Exceptions::ConnectionFailedException::typeid, Name, "error_connectionFailed", "No devices found.");
+				// the cached scan may be outdated, e.g. the camera was plugged in recently
+				Rescan();
+				device = SelectDevice(GetDevices(), SerialNumber);
 			}
-			Voxel::DevicePtr toConnect;
-			for (int i = 0; i < numDevices; i++)
+			if (!device)
 			{
-				if (devices[i].get()->interfaceID() == Voxel::Device::USB)
-				{
-					Voxel::USBDevice &usb = (Voxel::USBDevice&)*devices[i];
-					if (usb.vendorID() == (uint16_t)1105 && usb.productID() == (uint16_t)37125)
-					{
-						toConnect = devices[i];
-						break;
-					}
-				}
+				throw ExceptionBuilder::Build(MetriCam2::Exceptions::ConnectionFailedException::typeid, Name, "error_connectionFailed", String::IsNullOrEmpty(SerialNumber) ? "No unused device found." : "No device with S/N " + SerialNumber + " found.");
 			}
-			device = toConnect; // first camera
-		}
 
-		cam = sys->connect(device).get();
+			cam = sys->connect(device).get();
+			m_deviceId = marshal_as<String^>(device->id());
+			claimedDevices->Add(m_deviceId);
+		}
+		finally
+		{
+			System::Threading::Monitor::Exit(systemLock);
+		}
 
 		if (m_CameraProfile != Profile::None)
 		{
@@ -68,13 +70,21 @@ void TIVoxel::ConnectImpl()
 		}
 
 		IsConnected = true; // set this early, because it is used by parameters later in the connect process
+		registerCache->Clear();
 
-		connectedVoxelObjects->Add(this);
+		System::Threading::Monitor::Enter(voxelObjectsLock);
+		try
+		{
+			connectedVoxelObjects->Add(this);
+		}
+		finally
+		{
+			System::Threading::Monitor::Exit(voxelObjectsLock);
+		}
 
-		Voxel::FrameSize s;
-		cam->getFrameSize(s);
-		m_height = s.height;
-		m_width = s.width;
+		RefreshFrameSize();
+		ResetFrameFusion();
+		RebuildRayTable();
 
 		Voxel::Map<Voxel::String, Voxel::ParameterPtr> params = cam->getParameters();
 
@@ -129,6 +139,8 @@ void TIVoxel::ConnectImpl()
 		m_phaseOffsetDealiasing = this->GetPhaseOffsetDealiasing();
 		m_subFrames = this->GetSubFrames();
 		m_dealiased_ph_mask = this->GetDealiased_ph_mask();
+
+		UpdateRegisterCacheVerification();
 	}
 	catch (MetriCam2::Exceptions::ConnectionFailedException^)
 	{
@@ -143,6 +155,10 @@ void TIVoxel::ConnectImpl()
 	}
 	finally
 	{
+		if (!IsConnected)
+		{
+			ReleaseDevice();
+		}
 		System::Threading::Monitor::Exit(settingsLock);
 	}
 }
@@ -205,10 +221,52 @@ bool TIVoxel::WritePT(ProjectiveTransformationRational^ proj, int profileId)
 		success = configFile->write();
 	}
 
+	if (IsConnected && profileId == cam->getCurrentCameraProfileID())
+	{
+		RebuildRayTable();
+	}
+
 	return success;
 }
 
 Object^ TIVoxel::GetParameterByName(String^ name)
+{
+	// lock-free, so that polling does not wait behind UpdateImpl or Commit, which hold settingsLock
+	Object^ value;
+	if (TryGetPendingWrite(name, value) || registerCache->TryGetValue(name, value))
+	{
+		return value;
+	}
+
+	System::Threading::Monitor::Enter(settingsLock);
+	try
+	{
+		// a write or a transaction may have been completed while waiting for the lock
+		if (TryGetPendingWrite(name, value) || registerCache->TryGetValue(name, value))
+		{
+			return value;
+		}
+		value = ReadParameterFromDevice(name);
+		if (!IsVolatileParameter(name))
+		{
+			registerCache[name] = value;
+		}
+	}
+	finally
+	{
+		System::Threading::Monitor::Exit(settingsLock);
+	}
+	return value;
+}
+
+bool TIVoxel::IsVolatileParameter(String^ name)
+{
+	// read-only registers are status values (temperatures, error flags, ...) which change without us writing them
+	Voxel::ParameterPtr param = cam->getParam(msclr::interop::marshal_as<std::string>(name));
+	return !param || param->ioType() == Voxel::Parameter::IO_READ_ONLY;
+}
+
+Object^ TIVoxel::ReadParameterFromDevice(String^ name)
 {
 	Voxel::ParameterPtr param = cam->getParam(msclr::interop::marshal_as<std::string>(name));
 
@@ -319,60 +377,94 @@ void TIVoxel::SetParameterByName(String^ name, Object^ value)
 		return;
 	}
 
-	Voxel::BoolParameter *boolParam = dynamic_cast<Voxel::BoolParameter *>(param.get());
-	Voxel::IntegerParameter *intParam = dynamic_cast<Voxel::IntegerParameter *>(param.get());
-	Voxel::UnsignedIntegerParameter *uintParam = dynamic_cast<Voxel::UnsignedIntegerParameter *>(param.get());
-	Voxel::FloatParameter *floatParam = dynamic_cast<Voxel::FloatParameter *>(param.get());
-	Voxel::EnumParameter *enumParam = dynamic_cast<Voxel::EnumParameter *>(param.get());
-
-	if (boolParam)
+	// one lock for the transaction and the device write, so that GetParameterByName cannot cache a value read before the write
+	System::Threading::Monitor::Enter(settingsLock);
+	try
 	{
-		bool val = (bool)value;
-		if (!boolParam->set(val))
+		if (nullptr != m_pendingWrites)
 		{
-			throw ExceptionBuilder::Build(MetriCam2::Exceptions::ParameterNotSupportedException::typeid, Name, "Could not set parameter " + name + " to " + val + ".");
+			// inside a configuration transaction: remember the write, it is applied in Commit
+			for (int i = 0; i < m_pendingWrites->Count; i++)
+			{
+				if (m_pendingWrites[i].Key == name)
+				{
+					m_pendingWrites->RemoveAt(i);
+					break;
+				}
+			}
+			m_pendingWrites->Add(KeyValuePair<String^, Object^>(name, value));
+
+			// publish a new copy, readers may still use the previous one
+			Dictionary<String^, Object^>^ pendingValues = gcnew Dictionary<String^, Object^>(m_pendingValues);
+			pendingValues[name] = value;
+			System::Threading::Interlocked::Exchange<Dictionary<String^, Object^>^>(m_pendingValues, pendingValues);
+			return;
 		}
-		return;
-	}
-	else if (intParam)
-	{
-		int val = (int)value;
-		if (!intParam->set(val))
+
+		Voxel::BoolParameter *boolParam = dynamic_cast<Voxel::BoolParameter *>(param.get());
+		Voxel::IntegerParameter *intParam = dynamic_cast<Voxel::IntegerParameter *>(param.get());
+		Voxel::UnsignedIntegerParameter *uintParam = dynamic_cast<Voxel::UnsignedIntegerParameter *>(param.get());
+		Voxel::FloatParameter *floatParam = dynamic_cast<Voxel::FloatParameter *>(param.get());
+		Voxel::EnumParameter *enumParam = dynamic_cast<Voxel::EnumParameter *>(param.get());
+
+		if (boolParam)
+		{
+			bool val = (bool)value;
+			if (!boolParam->set(val))
+			{
+				throw ExceptionBuilder::Build(MetriCam2::Exceptions::ParameterNotSupportedException::typeid, Name, "Could not set parameter " + name + " to " + val + ".");
+			}
+			CacheAppliedValue(name);
+			return;
+		}
+		else if (intParam)
 		{
-			throw ExceptionBuilder::Build(MetriCam2::Exceptions::ParameterNotSupportedException::typeid, Name, "Could not set parameter " + name + " to " + val + ".");
+			int val = (int)value;
+			if (!intParam->set(val))
+			{
+				throw ExceptionBuilder::Build(MetriCam2::Exceptions::ParameterNotSupportedException::typeid, Name, "Could not set parameter " + name + " to " + val + ".");
+			}
+			CacheAppliedValue(name);
+			return;
 		}
-		return;
-	}
-	else if (uintParam)
-	{
-		uint val = (uint)value;
-		if (!uintParam->set(val))
+		else if (uintParam)
 		{
-			throw ExceptionBuilder::Build(MetriCam2::Exceptions::ParameterNotSupportedException::typeid, Name, "Could not set parameter " + name + " to " + val + ".");
+			uint val = (uint)value;
+			if (!uintParam->set(val))
+			{
+				throw ExceptionBuilder::Build(MetriCam2::Exceptions::ParameterNotSupportedException::typeid, Name, "Could not set parameter " + name + " to " + val + ".");
+			}
+			CacheAppliedValue(name);
+			return;
 		}
-		return;
-	}
-	else if (floatParam)
-	{
-		float val = (float)value;
-		if (!floatParam->set(val))
+		else if (floatParam)
 		{
-			throw ExceptionBuilder::Build(MetriCam2::Exceptions::ParameterNotSupportedException::typeid, Name, "Could not set parameter " + name + " to " + val + ".");
+			float val = (float)value;
+			if (!floatParam->set(val))
+			{
+				throw ExceptionBuilder::Build(MetriCam2::Exceptions::ParameterNotSupportedException::typeid, Name, "Could not set parameter " + name + " to " + val + ".");
+			}
+			CacheAppliedValue(name);
+			return;
 		}
-		return;
-	}
-	else if (enumParam)
-	{
-		int val = (System::UInt32)value;
-		if (!enumParam->set(val))
+		else if (enumParam)
 		{
-			throw ExceptionBuilder::Build(MetriCam2::Exceptions::ParameterNotSupportedException::typeid, Name, "Could not set parameter " + name + " to " + val + ".");
+			int val = (System::UInt32)value;
+			if (!enumParam->set(val))
+			{
+				throw ExceptionBuilder::Build(MetriCam2::Exceptions::ParameterNotSupportedException::typeid, Name, "Could not set parameter " + name + " to " + val + ".");
+			}
+			CacheAppliedValue(name);
+			return;
 		}
+
+		throw ExceptionBuilder::Build(MetriCam2::Exceptions::ParameterNotSupportedException::typeid, Name, "error_setParameter", "Could not set parameter " + name + ". Parameter type is unsupported.");
 		return;
 	}
-
-	throw ExceptionBuilder::Build(MetriCam2::Exceptions::ParameterNotSupportedException::typeid, Name, "error_setParameter", "Could not set parameter " + name + ". Parameter type is unsupported.");
-	return;
+	finally
+	{
+		System::Threading::Monitor::Exit(settingsLock);
+	}
 }
 
 void TIVoxel::onNewDepthFrame(Voxel::DepthCamera &dc, const Voxel::Frame &frame, Voxel::DepthCamera::FrameType c)
@@ -387,66 +479,194 @@ void TIVoxel::onNewDepthFrame(Voxel::DepthCamera &dc, const Voxel::Frame &frame,
 
 	String^ searchedID = marshal_as<String^>(dc.id());
 
+	// only look up the instance under the lock; the frame is adopted outside of it
+	TIVoxel^ target = nullptr;
+	System::Threading::Monitor::Enter(voxelObjectsLock);
+	try
+	{
+		for each(TIVoxel^ voxel in connectedVoxelObjects)
+		{
+			if (marshal_as<String^>(((voxel->cam))->id()) == searchedID)
+			{
+				target = voxel;
+				break;
+			}
+		}
+	}
+	finally
+	{
+		System::Threading::Monitor::Exit(voxelObjectsLock);
+	}
 
-	for each(TIVoxel^ voxel in connectedVoxelObjects)
+	if (nullptr == target)
 	{
-		String^ voxelID = marshal_as<String^>(((voxel->cam))->id());
+		return;
+	}
 
-		if (voxelID == searchedID)
-		{
-			Voxel::ToFRawFramePtr current = Voxel::ToFRawFrame::typeCast(callbackFrame->copy());
+	Voxel::ToFRawFramePtr current = Voxel::ToFRawFrame::typeCast(callbackFrame->copy());
 
-			voxel->AdoptCameraData(current->amplitude(), current->phase(), current->ambient(), (int)current->amplitudeWordWidth(), (int)current->phaseWordWidth(), (int)current->ambientWordWidth());
+	uint16_t integrationScale = target->IntegrationScaleOf(current->flags(), (int)current->flagsWordWidth());
+	target->AdoptCameraData(current->amplitude(), current->phase(), current->ambient(), (int)current->amplitudeWordWidth(), (int)current->phaseWordWidth(), (int)current->ambientWordWidth(), integrationScale);
+	target->AdoptFlagData(current->flags(), (int)current->flagsWordWidth());
 
-			voxel->updateResetEvent->Set();
+	target->updateResetEvent->Set();
+	target->firstFrameEvent->Set();
+}
 
-			break;
+Voxel::Vector<Voxel::DevicePtr> TIVoxel::GetDevices()
+{
+	// CameraSystem::scan is not thread-safe either
+	System::Threading::Monitor::Enter(systemLock);
+	try
+	{
+		if (!scanAge->IsRunning || scanAge->ElapsedMilliseconds > scanTimeToLive)
+		{
+			*scannedDevices = sys->scan();
+			scanAge->Restart();
 		}
+		// copy the (shared) device pointers, so a concurrent rescan cannot invalidate them
+		return *scannedDevices;
+	}
+	finally
+	{
+		System::Threading::Monitor::Exit(systemLock);
 	}
 }
 
-Voxel::DevicePtr* TIVoxel::GetDeviceBySerialNumber(String^ _serial)
+void TIVoxel::Rescan()
 {
-	int id = -1; // -> failure
-
-	Voxel::Vector<Voxel::DevicePtr> &devices = sys->scan();
+	System::Threading::Monitor::Enter(systemLock);
+	try
+	{
+		scanAge->Reset();
+		GetDevices();
+	}
+	finally
+	{
+		System::Threading::Monitor::Exit(systemLock);
+	}
+}
 
-	size_t numCameras = devices.size();
-	if (numCameras == 0)
+Voxel::DevicePtr TIVoxel::SelectDevice(const Voxel::Vector<Voxel::DevicePtr>& devices, String^ serial)
+{
+	if (!String::IsNullOrEmpty(serial))
 	{
-		return NULL;
+		return GetDeviceBySerialNumber(devices, serial);
 	}
-	if (_serial == nullptr || _serial->Equals(""))
+
+	// first TI Voxel USB device which is not used by another instance
+	for (size_t i = 0; i < devices.size(); i++)
 	{
-		return &devices[0];
+		if (devices[i]->interfaceID() != Voxel::Device::USB)
+		{
+			continue;
+		}
+		Voxel::USBDevice &usb = (Voxel::USBDevice&)*devices[i];
+		if (usb.vendorID() == (uint16_t)1105 && usb.productID() == (uint16_t)37125
+			&& !claimedDevices->Contains(marshal_as<String^>(devices[i]->id())))
+		{
+			return devices[i];
+		}
 	}
+	return Voxel::DevicePtr();
+}
 
-	for (int i = 0; i < numCameras; ++i)
+Voxel::DevicePtr TIVoxel::GetDeviceBySerialNumber(const Voxel::Vector<Voxel::DevicePtr>& devices, String^ serial)
+{
+	for (size_t i = 0; i < devices.size(); ++i)
 	{
-		if (_serial->Equals(marshal_as<String^>(devices[i]->serialNumber())))
+		String^ deviceSerial = marshal_as<String^>(devices[i]->serialNumber());
+		if (deviceSerial->Equals("Serial_No._Placeholder"))
+		{
+			deviceSerial = "sn-not-programmed";
+		}
+		if (serial->Equals(deviceSerial) && !claimedDevices->Contains(marshal_as<String^>(devices[i]->id())))
 		{
-			return &devices[i];
+			return devices[i];
 		}
 	}
 
-	return NULL;
+	return Voxel::DevicePtr();
+}
+
+void TIVoxel::ReleaseDevice()
+{
+	System::Threading::Monitor::Enter(systemLock);
+	try
+	{
+		if (nullptr != m_deviceId)
+		{
+			claimedDevices->Remove(m_deviceId);
+			m_deviceId = nullptr;
+		}
+	}
+	finally
+	{
+		System::Threading::Monitor::Exit(systemLock);
+	}
 }
 
 void TIVoxel::DisconnectImpl()
 {
+	if (nullptr != registerCacheVerifyTimer)
+	{
+		delete registerCacheVerifyTimer;
+		registerCacheVerifyTimer = nullptr;
+	}
+	// another device may be connected next time
+	registerCache->Clear();
+
 	try
 	{
 		cam->stop();
 	}
 	catch (Exception^) {}
 	System::Threading::Thread::Sleep(200);
+	System::Threading::Monitor::Enter(voxelObjectsLock);
+	try
+	{
+		connectedVoxelObjects->Remove(this);
+	}
+	finally
+	{
+		System::Threading::Monitor::Exit(voxelObjectsLock);
+	}
+	System::Threading::Monitor::Enter(systemLock);
 	try
 	{
 		Voxel::DepthCameraPtr* ptr = new Voxel::DepthCameraPtr(cam);
 		sys->disconnect(*ptr);
 	}
 	catch (Exception^) {}
-	connectedVoxelObjects->Remove(this);
+	finally
+	{
+		System::Threading::Monitor::Exit(systemLock);
+	}
+	ReleaseDevice();
+
+	System::Threading::Monitor::Enter(fusionLock);
+	try
+	{
+		delete m_fusion;
+		m_fusion = NULL;
+		fusedPhaseData = nullptr;
+		fusedAmplitudeData = nullptr;
+	}
+	finally
+	{
+		System::Threading::Monitor::Exit(fusionLock);
+	}
+
+	System::Threading::Monitor::Enter(rayTableLock);
+	try
+	{
+		delete m_rayTable;
+		m_rayTable = NULL;
+	}
+	finally
+	{
+		System::Threading::Monitor::Exit(rayTableLock);
+	}
 }
 
 void TIVoxel::UpdateImpl()
@@ -462,6 +682,9 @@ void TIVoxel::UpdateImpl()
 		currentPhases = phaseData;
 		currentAmplitudes = amplitudeData;
 		currentAmbient = ambientData;
+		currentFlags = flagsData;
+		currentFusedPhases = fusedPhaseData;
+		currentFusedAmplitudes = fusedAmplitudeData;
 	}
 	finally
 	{
@@ -478,6 +701,10 @@ void TIVoxel::LoadAllAvailableChannels()
 	Channels->Add(cr->RegisterChannel(CHANNEL_NAME_DISTANCE));
 	Channels->Add(cr->RegisterCustomChannel(CHANNEL_NAME_AMBIENT, FloatImage::typeid));
 	Channels->Add(cr->RegisterCustomChannel(CHANNEL_NAME_PHASE, UShortImage::typeid));
+	Channels->Add(cr->RegisterCustomChannel(CHANNEL_NAME_FLAGS, ByteImage::typeid));
+	Channels->Add(cr->RegisterCustomChannel(CHANNEL_NAME_VALID_DISTANCE, FloatImage::typeid));
+	Channels->Add(cr->RegisterChannel(ChannelNames::Point3DImage));
+	Channels->Add(cr->RegisterChannel(ChannelNames::ZImage));
 }
 
 ImageBase^ TIVoxel::CalcChannelImpl(String^ channelName)
@@ -498,12 +725,35 @@ ImageBase^ TIVoxel::CalcChannelImpl(String^ channelName)
 	{
 		return CalcPhase();
 	}
+	if (channelName == CHANNEL_NAME_FLAGS)
+	{
+		return CalcFlags();
+	}
+	if (channelName == CHANNEL_NAME_VALID_DISTANCE)
+	{
+		return CalcValidDistance();
+	}
+	if (channelName == ChannelNames::Point3DImage)
+	{
+		return CalcPoint3DImage();
+	}
+	if (channelName == ChannelNames::ZImage)
+	{
+		return CalcZImage();
+	}
 	return nullptr;
 }
 
 ImageBase^ TIVoxel::CalcAmplitude()
 {
-	FloatImage^ result = gcnew FloatImage(m_width, m_height);
+	FloatImage^ result = ImagePool->RentFloatImage(m_width, m_height);
+	FloatImage^ localFusedAmplitudes = currentFusedAmplitudes;
+	if (nullptr != localFusedAmplitudes)
+	{
+		Array::Copy(localFusedAmplitudes->Data, result->Data, result->Data->Length);
+		return result;
+	}
+
 	ByteImage^ localAmplitudes = currentAmplitudes;
 	pin_ptr<Byte> localAmplitudesData = &(localAmplitudes->Data)[0];
 	unsigned short int *rawConfidence = (unsigned short int*)localAmplitudesData;
@@ -519,7 +769,7 @@ ImageBase^ TIVoxel::CalcAmplitude()
 
 ImageBase^ TIVoxel::CalcAmbient()
 {
-	FloatImage^ result = gcnew FloatImage(m_width, m_height);
+	FloatImage^ result = ImagePool->RentFloatImage(m_width, m_height);
 	ByteImage^ localAmbient = currentAmbient;
 
 	for (int i = 0; i < m_width*m_height; i++)
@@ -547,13 +797,40 @@ ImageBase^ TIVoxel::CalcPhase()
 	return result;
 }
 
+ImageBase^ TIVoxel::CalcFlags()
+{
+	ByteImage^ localFlags = currentFlags;
+	if (nullptr == localFlags || localFlags->Width != m_width || localFlags->Height != m_height)
+	{
+		// no flags delivered (yet) for this frame size
+		ByteImage^ result = ImagePool->RentByteImage(m_width, m_height);
+		pin_ptr<Byte> resultData = &(result->Data)[0];
+		memset(resultData, 0, m_width * m_height);
+		return result;
+	}
+
+	// hand out the adopted image without another copy; AdoptFlagData creates a new one for each frame, so it is never modified
+	MarkShared(localFlags, CHANNEL_NAME_FLAGS);
+	return localFlags;
+}
+
 ImageBase^ TIVoxel::CalcDistance()
 {
 	const float v_light = Camera::SpeedOfLight;
 	const float range = (v_light / (2.0f * (float)EffectiveModulationFrequency)); // FIXME: use GetUnambiguousRange or something here.
 	const float scaling = range / 4096.0f; // 12-bit phase data
 
-	FloatImage^ result = gcnew FloatImage(m_width, m_height);
+	FloatImage^ result = ImagePool->RentFloatImage(m_width, m_height);
+	FloatImage^ localFusedPhases = currentFusedPhases;
+	if (nullptr != localFusedPhases)
+	{
+		for (int i = 0; i < m_width*m_height; i++)
+		{
+			result[i] = localFusedPhases[i] * scaling;
+		}
+		return result;
+	}
+
 	ByteImage^ localPhases = currentPhases;
 	pin_ptr<Byte> localPhasesData = &(localPhases->Data)[0];
 	unsigned short int *rawPhases = (unsigned short int*)localPhasesData;
@@ -567,14 +844,124 @@ ImageBase^ TIVoxel::CalcDistance()
 	return result;
 }
 
+ImageBase^ TIVoxel::CalcValidDistance()
+{
+	const float v_light = Camera::SpeedOfLight;
+	const float range = (v_light / (2.0f * (float)EffectiveModulationFrequency));
+	const float scaling = range / 4096.0f; // 12-bit phase data
+	const float amplitudeThreshold = (float)m_amplitudeThreshold;
+	const unsigned char flagsMask = (unsigned char)m_invalidFlagsMask;
+	const int numPixels = m_width * m_height;
+
+	FloatImage^ result = ImagePool->RentFloatImage(m_width, m_height);
+	pin_ptr<float> resultData = &(result->Data)[0];
+	float* dst = resultData;
+
+	ByteImage^ localFlags = currentFlags;
+	if (nullptr == localFlags || localFlags->Width != m_width || localFlags->Height != m_height)
+	{
+		// no flags delivered (yet) for this frame size, only the amplitude decides
+		localFlags = gcnew ByteImage(m_width, m_height);
+	}
+	pin_ptr<Byte> localFlagsData = &(localFlags->Data)[0];
+	const unsigned char* flags = localFlagsData;
+
+	FloatImage^ localFusedPhases = currentFusedPhases;
+	FloatImage^ localFusedAmplitudes = currentFusedAmplitudes;
+	if (nullptr != localFusedPhases && nullptr != localFusedAmplitudes)
+	{
+		pin_ptr<float> localPhasesData = &(localFusedPhases->Data)[0];
+		pin_ptr<float> localAmplitudesData = &(localFusedAmplitudes->Data)[0];
+		const float* phases = localPhasesData;
+		const float* amplitudes = localAmplitudesData;
+		for (int i = 0; i < numPixels; i++)
+		{
+			bool valid = amplitudes[i] >= amplitudeThreshold && (flags[i] & flagsMask) == 0;
+			dst[i] = valid ? phases[i] * scaling : 0.0f;
+		}
+		return result;
+	}
+
+	pin_ptr<Byte> localPhasesData = &(currentPhases->Data)[0];
+	pin_ptr<Byte> localAmplitudesData = &(currentAmplitudes->Data)[0];
+	const unsigned short* phases = (const unsigned short*)localPhasesData;
+	const unsigned short* amplitudes = (const unsigned short*)localAmplitudesData;
+	for (int i = 0; i < numPixels; i++)
+	{
+		bool valid = amplitudes[i] >= amplitudeThreshold && (flags[i] & flagsMask) == 0;
+		dst[i] = valid ? phases[i] * scaling : 0.0f;
+	}
+
+	return result;
+}
+
+ImageBase^ TIVoxel::CalcPoint3DImage()
+{
+	FloatImage^ distances = (FloatImage^)CalcDistance();
+	Point3fImage^ result = ImagePool->RentPoint3fImage(m_width, m_height);
+
+	System::Threading::Monitor::Enter(rayTableLock);
+	try
+	{
+		if (NULL == m_rayTable)
+		{
+			ImagePool->Return(result);
+			throw gcnew MetriCam2::Exceptions::ImageAcquisitionFailedException(String::Format("{0}: No lens calibration available for the current camera profile.", Name));
+		}
+
+		pin_ptr<float> distancesData = &(distances->Data)[0];
+		pin_ptr<Point3f> pointsData = &(result->Data)[0];
+		m_rayTable->ToPoints(distancesData, (float*)pointsData);
+	}
+	finally
+	{
+		System::Threading::Monitor::Exit(rayTableLock);
+		ImagePool->Return(distances);
+	}
+
+	return result;
+}
+
+ImageBase^ TIVoxel::CalcZImage()
+{
+	FloatImage^ distances = (FloatImage^)CalcDistance();
+	FloatImage^ result = ImagePool->RentFloatImage(m_width, m_height);
+
+	System::Threading::Monitor::Enter(rayTableLock);
+	try
+	{
+		if (NULL == m_rayTable)
+		{
+			ImagePool->Return(result);
+			throw gcnew MetriCam2::Exceptions::ImageAcquisitionFailedException(String::Format("{0}: No lens calibration available for the current camera profile.", Name));
+		}
+
+		pin_ptr<float> distancesData = &(distances->Data)[0];
+		pin_ptr<float> zData = &(result->Data)[0];
+		m_rayTable->ToZ(distancesData, zData);
+	}
+	finally
+	{
+		System::Threading::Monitor::Exit(rayTableLock);
+		ImagePool->Return(distances);
+	}
+
+	return result;
+}
+
 TIVoxel::TIVoxel()
-	: Camera("TinTin"), m_width(320), m_height(240), m_devnum(0)
+	: Camera("TinTin"), m_width(320), m_height(240), m_devnum(0), m_fusion(NULL), m_rayTable(NULL), m_pllUpdatePending(false), m_reconfigurationLatency(0.0f)
 {
 	updateResetEvent = gcnew AutoResetEvent(false);
+	firstFrameEvent = gcnew ManualResetEvent(false);
 }
 
 TIVoxel::~TIVoxel()
 {
+	delete m_fusion;
+	m_fusion = NULL;
+	delete m_rayTable;
+	m_rayTable = NULL;
 }
 
 void TIVoxel::VoxelInit()
@@ -585,7 +972,7 @@ array<String^, 1>^ TIVoxel::ScanForCameras()
 {
 	array<String^, 1>^ res = nullptr;
 
-	Voxel::Vector<Voxel::DevicePtr> &devices = sys->scan();
+	Voxel::Vector<Voxel::DevicePtr> devices = GetDevices();
 
 	size_t num_cameras = devices.size();
 
@@ -750,11 +1137,7 @@ void TIVoxel::SetBaseModulationFrequency(int val)
 		}
 		SetParameterByName("mod_freq1", (float)val / (float)1000000.0f);
 		GetBaseModulationFrequency();
-		bool valBool = (bool)GetParameterByName("mod_pll_update");
-		SetParameterByName("mod_pll_update", true);
-		System::Threading::Thread::Sleep(50);
-		SetParameterByName("mod_pll_update", false);
-		System::Threading::Thread::Sleep(50);
+		UpdateModulationPll();
 	}
 	finally
 	{
@@ -775,11 +1158,7 @@ void TIVoxel::SetDealiasingModulationFrequency(int val)
 		}
 		SetParameterByName("mod_freq2", (float)val / (float)1000000.0f);
 		GetDealiasingModulationFrequency();
-		bool valBool = (bool)GetParameterByName("mod_pll_update");
-		SetParameterByName("mod_pll_update", true);
-		System::Threading::Thread::Sleep(50);
-		SetParameterByName("mod_pll_update", false);
-		System::Threading::Thread::Sleep(50);
+		UpdateModulationPll();
 	}
 	finally
 	{
@@ -787,6 +1166,129 @@ void TIVoxel::SetDealiasingModulationFrequency(int val)
 	}
 }
 
+void TIVoxel::UpdateModulationPll()
+{
+	System::Threading::Monitor::Enter(settingsLock);
+	try
+	{
+		if (nullptr != m_pendingWrites)
+		{
+			// the PLL is updated once in Commit
+			m_pllUpdatePending = true;
+			return;
+		}
+	}
+	finally
+	{
+		System::Threading::Monitor::Exit(settingsLock);
+	}
+
+	SetParameterByName("mod_pll_update", true);
+	System::Threading::Thread::Sleep(PllUpdateDwell);
+	SetParameterByName("mod_pll_update", false);
+	System::Threading::Thread::Sleep(PllUpdateDwell);
+}
+
+bool TIVoxel::TryGetPendingWrite(String^ name, Object^% value)
+{
+	Dictionary<String^, Object^>^ pendingValues = m_pendingValues;
+	return nullptr != pendingValues && pendingValues->TryGetValue(name, value);
+}
+
+void TIVoxel::CacheAppliedValue(String^ name)
+{
+	// the device may quantize or limit the value, so cache what it reports back instead of what was requested
+	if (!IsVolatileParameter(name))
+	{
+		registerCache[name] = ReadParameterFromDevice(name);
+	}
+}
+
+void TIVoxel::BeginConfiguration()
+{
+	System::Threading::Monitor::Enter(settingsLock);
+	try
+	{
+		if (nullptr != m_pendingWrites)
+		{
+			throw ExceptionBuilder::Build(InvalidOperationException::typeid, Name, "error_setParameter", "A configuration transaction is already active.");
+		}
+		m_pendingWrites = gcnew List<KeyValuePair<String^, Object^>>();
+		System::Threading::Interlocked::Exchange<Dictionary<String^, Object^>^>(m_pendingValues, gcnew Dictionary<String^, Object^>());
+		m_pllUpdatePending = false;
+	}
+	finally
+	{
+		System::Threading::Monitor::Exit(settingsLock);
+	}
+}
+
+void TIVoxel::Commit()
+{
+	System::Threading::Monitor::Enter(settingsLock);
+	try
+	{
+		if (nullptr == m_pendingWrites)
+		{
+			throw ExceptionBuilder::Build(InvalidOperationException::typeid, Name, "error_setParameter", "No configuration transaction is active. Call BeginConfiguration first.");
+		}
+
+		List<KeyValuePair<String^, Object^>>^ writes = m_pendingWrites;
+		bool pllUpdate = m_pllUpdatePending;
+		m_pendingWrites = nullptr;
+		m_pllUpdatePending = false;
+
+		if (!IsConnected || (0 == writes->Count && !pllUpdate))
+		{
+			return;
+		}
+
+		System::Diagnostics::Stopwatch^ stopwatch = System::Diagnostics::Stopwatch::StartNew();
+		cam->stop();
+		// only after stop, so that a frame still in flight does not count as the first one of the new configuration
+		firstFrameEvent->Reset();
+		try
+		{
+			for each(KeyValuePair<String^, Object^> write in writes)
+			{
+				SetParameterByName(write.Key, write.Value);
+			}
+			if (pllUpdate)
+			{
+				// hold the update bit like outside of a transaction (see UpdateModulationPll);
+				// the dwell after clearing it is covered by waiting for the first frame below
+				SetParameterByName("mod_pll_update", true);
+				System::Threading::Thread::Sleep(PllUpdateDwell);
+				SetParameterByName("mod_pll_update", false);
+			}
+		}
+		finally
+		{
+			cam->start();
+		}
+
+		// instead of fixed delays, wait until the camera delivers data again
+		bool frameReceived = firstFrameEvent->WaitOne(ReconfigurationTimeout);
+		stopwatch->Stop();
+		m_reconfigurationLatency = (float)stopwatch->Elapsed.TotalMilliseconds;
+
+		if (frameReceived)
+		{
+			log->DebugFormat("Applied {0} register write(s) in {1} ms.", writes->Count, m_reconfigurationLatency);
+		}
+		else
+		{
+			log->WarnFormat("Applied {0} register write(s), but no frame was received within {1} ms.", writes->Count, ReconfigurationTimeout);
+		}
+	}
+	finally
+	{
+		// only now, as until SetParameterByName has cached the applied values, lock-free reads would find the old ones
+		System::Threading::Interlocked::Exchange<Dictionary<String^, Object^>^>(m_pendingValues, nullptr);
+		System::Threading::Monitor::Exit(settingsLock);
+	}
+}
+
 void TIVoxel::SetEnableDealiasing(bool val)
 {
 	m_enableDealiasing = val;
@@ -827,44 +1329,20 @@ void TIVoxel::SetEnableDealiasing(bool val)
 
 int TIVoxel::GetBaseModulationFrequency()
 {
-	System::Threading::Monitor::Enter(settingsLock);
-	try
-	{
-		m_baseModulationFrequency = (int)((float)GetParameterByName("mod_freq1") * 1000000);
-		return m_baseModulationFrequency;
-	}
-	finally
-	{
-		System::Threading::Monitor::Exit(settingsLock);
-	}
+	m_baseModulationFrequency = (int)((float)GetParameterByName("mod_freq1") * 1000000);
+	return m_baseModulationFrequency;
 }
 
 int TIVoxel::GetDealiasingModulationFrequency()
 {
-	System::Threading::Monitor::Enter(settingsLock);
-	try
-	{
-		m_dealiasingModulationFrequency = (int)((float)GetParameterByName("mod_freq2") * 1000000);
-		return m_dealiasingModulationFrequency;
-	}
-	finally
-	{
-		System::Threading::Monitor::Exit(settingsLock);
-	}
+	m_dealiasingModulationFrequency = (int)((float)GetParameterByName("mod_freq2") * 1000000);
+	return m_dealiasingModulationFrequency;
 }
 
 bool TIVoxel::GetEnableDealiasing()
 {
-	System::Threading::Monitor::Enter(settingsLock);
-	try
-	{
-		m_enableDealiasing = (bool)GetParameterByName("dealias_en");
-		return m_enableDealiasing;
-	}
-	finally
-	{
-		System::Threading::Monitor::Exit(settingsLock);
-	}
+	m_enableDealiasing = (bool)GetParameterByName("dealias_en");
+	return m_enableDealiasing;
 }
 
 void TIVoxel::SetAmplitudeThreshold(uint val)
@@ -908,6 +1386,7 @@ void TIVoxel::SetIntegrationDutyCycle(uint val)
 		}
 		// Sollte der overflow-Test nicht _nach_ dem Schreiben passieren?
 		regOverflow = false;
+		// the device may limit the duty cycle, SetParameterByName caches the actual value
 		SetParameterByName("intg_duty_cycle", val);
 		setFailed = (bool)GetParameterByName("intg_duty_cycle_set_failed");
 		m_integrationDutyCycle = (uint)GetParameterByName("intg_duty_cycle");
@@ -965,15 +1444,7 @@ void TIVoxel::SetPhaseOffsetDealiasing(int val)
 
 uint TIVoxel::GetIlluminationPowerPercentage()
 {
-	System::Threading::Monitor::Enter(settingsLock);
-	try
-	{
-		m_illuminationPowerPercentage = (uint)GetParameterByName("illum_power_percentage");
-	}
-	finally
-	{
-		System::Threading::Monitor::Exit(settingsLock);
-	}
+	m_illuminationPowerPercentage = (uint)GetParameterByName("illum_power_percentage");
 	return m_illuminationPowerPercentage;
 }
 
@@ -1148,92 +1619,194 @@ void TIVoxel::SetSubFrames(uint val)
 
 uint TIVoxel::GetAmplitudeThreshold()
 {
-	System::Threading::Monitor::Enter(settingsLock);
-	try
+	if (IsVoxelA)
 	{
-		if (IsVoxelA)
-		{
-			return (uint)GetParameterByName("confidence_threshold");
-		}
-		return (uint)GetParameterByName("amplitude_threshold");
-	}
-	finally
-	{
-		System::Threading::Monitor::Exit(settingsLock);
+		return (uint)GetParameterByName("confidence_threshold");
 	}
+	return (uint)GetParameterByName("amplitude_threshold");
 }
 
 int TIVoxel::GetSensorTemperature()
 {
-	System::Threading::Monitor::Enter(settingsLock);
-	try
-	{
-		return (int)GetParameterByName("tsensor");//temp_out2
-	}
-	finally
-	{
-		System::Threading::Monitor::Exit(settingsLock);
-	}
+	return (int)GetParameterByName("tsensor");//temp_out2
 }
 
 int TIVoxel::GetIlluminationTemperature()
 {
-	System::Threading::Monitor::Enter(settingsLock);
-	try
+	return (int)GetParameterByName("tillum");//temp_out1
+}
+
+uint TIVoxel::GetIntegrationDutyCycle()
+{
+	return (uint)GetParameterByName("intg_duty_cycle");
+}
+
+int TIVoxel::GetPhaseOffsetBase()
+{
+	return (int)GetParameterByName("phase_corr_1");
+}
+
+int TIVoxel::GetPhaseOffsetDealiasing()
+{
+	return (int)GetParameterByName("phase_corr_2");
+}
+
+uint TIVoxel::GetHdrScale()
+{
+	return (uint)(int)GetParameterByName("hdr_scale");// two casts are needed here.
+}
+
+unsigned int TIVoxel::GetQuads()
+{
+	return (unsigned int)GetParameterByName("quad_cnt_max");// two casts are needed here.
+}
+
+uint TIVoxel::GetSubFrames()
+{
+	return (uint)(int)GetParameterByName("sub_frame_cnt_max");// two casts are needed here.
+}
+
+void TIVoxel::AdoptCameraData(byte* amplitudes, byte* phases, byte* ambient, int amplitudesWidth, int phasesWidth, int ambientWidth, uint16_t integrationScale)
+{
+	ByteImage^ localPhases = gcnew ByteImage(phasesWidth  * this->Width * this->Height, 1);
+	pin_ptr<Byte> localPhasesData = &(localPhases->Data)[0];
+	unsigned char * localPhasesPtr = localPhasesData;
+	memcpy(localPhasesPtr, phases, localPhases->Width);
+
+	ByteImage^ localAmplitudes = gcnew ByteImage(amplitudesWidth  * this->Width * this->Height, 1);
+	pin_ptr<Byte> localAmplitudesData = &(localAmplitudes->Data)[0];
+	unsigned char * localAmplitudesPtr = localAmplitudesData;
+	memcpy(localAmplitudesPtr, amplitudes, localAmplitudes->Width);
+
+	ByteImage^ localAmbient = gcnew ByteImage(ambientWidth * this->Width * this->Height, 1);
+	pin_ptr<Byte> localAmbientData = &(localAmbient->Data)[0];
+	unsigned char * localAmbientPtr = localAmbientData;
+	memcpy(localAmbientPtr, ambient, localAmbient->Width);
+
+	this->phaseData = localPhases;
+	this->amplitudeData = localAmplitudes;
+	this->ambientData = localAmbient;
+
+	if (phasesWidth == sizeof(uint16_t) && amplitudesWidth == sizeof(uint16_t))
 	{
-		return (int)GetParameterByName("tillum");//temp_out1
+		FuseFrame((const uint16_t*)phases, (const uint16_t*)amplitudes, integrationScale);
 	}
-	finally
+}
+
+uint16_t TIVoxel::IntegrationScaleOf(byte* flags, int flagsWidth)
+{
+	if (!m_hdrFusion || NULL == flags || flagsWidth <= 0)
 	{
-		System::Threading::Monitor::Exit(settingsLock);
+		return 1;
 	}
+	// all pixels of a short HDR frame carry the flag; its integration time is 2^HdrScale times shorter
+	return (flags[0] & HdrShortFrameFlag) ? (uint16_t)(1 << Math::Min(Math::Max(m_hdrScale, 0), 15)) : (uint16_t)1;
 }
 
-uint TIVoxel::GetIntegrationDutyCycle()
+void TIVoxel::FuseFrame(const uint16_t* phases, const uint16_t* amplitudes, uint16_t integrationScale)
 {
-	System::Threading::Monitor::Enter(settingsLock);
+	System::Threading::Monitor::Enter(fusionLock);
 	try
 	{
-		return (uint)GetParameterByName("intg_duty_cycle");
+		if (NULL == m_fusion)
+		{
+			return;
+		}
+		if (m_fusion->NumPixels() != m_width * m_height)
+		{
+			// the frame size has changed: start over instead of mixing frames of different sizes (fusionLock is reentrant)
+			ResetFrameFusion();
+		}
+
+		m_fusion->Push(phases, amplitudes, integrationScale);
+
+		FloatImage^ localPhases = gcnew FloatImage(m_width, m_height);
+		FloatImage^ localAmplitudes = gcnew FloatImage(m_width, m_height);
+		pin_ptr<float> localPhasesData = &(localPhases->Data)[0];
+		pin_ptr<float> localAmplitudesData = &(localAmplitudes->Data)[0];
+		m_fusion->GetPhases(localPhasesData);
+		m_fusion->GetAmplitudes(localAmplitudesData);
+
+		this->fusedPhaseData = localPhases;
+		this->fusedAmplitudeData = localAmplitudes;
 	}
 	finally
 	{
-		System::Threading::Monitor::Exit(settingsLock);
+		System::Threading::Monitor::Exit(fusionLock);
 	}
 }
 
-int TIVoxel::GetPhaseOffsetBase()
+void TIVoxel::ResetFrameFusion()
 {
-	System::Threading::Monitor::Enter(settingsLock);
+	System::Threading::Monitor::Enter(fusionLock);
 	try
 	{
-		return (int)GetParameterByName("phase_corr_1");
+		delete m_fusion;
+		m_fusion = NULL;
+		fusedPhaseData = nullptr;
+		fusedAmplitudeData = nullptr;
+
+		if (m_temporalFilterFrames > 1 || m_hdrFusion)
+		{
+			// HDR fusion needs at least one frame of each integration time
+			int windowSize = m_hdrFusion ? Math::Max(m_temporalFilterFrames, 2) : m_temporalFilterFrames;
+			m_fusion = new FrameFusion(m_width * m_height, windowSize, m_hdrFusion);
+		}
 	}
 	finally
 	{
-		System::Threading::Monitor::Exit(settingsLock);
+		System::Threading::Monitor::Exit(fusionLock);
 	}
 }
 
-int TIVoxel::GetPhaseOffsetDealiasing()
+void TIVoxel::RefreshParameters()
 {
-	System::Threading::Monitor::Enter(settingsLock);
-	try
+	registerCache->Clear();
+}
+
+void TIVoxel::SetVerifyRegisterCache(bool val)
+{
+	m_verifyRegisterCache = val;
+	UpdateRegisterCacheVerification();
+}
+
+void TIVoxel::UpdateRegisterCacheVerification()
+{
+	bool enable = m_verifyRegisterCache && IsConnected;
+	if (enable && nullptr == registerCacheVerifyTimer)
 	{
-		return (int)GetParameterByName("phase_corr_2");
+		registerCacheVerifyTimer = gcnew Timer(gcnew TimerCallback(this, &TIVoxel::VerifyRegisterCacheCallback), nullptr, RegisterCacheVerifyInterval, RegisterCacheVerifyInterval);
 	}
-	finally
+	else if (!enable && nullptr != registerCacheVerifyTimer)
 	{
-		System::Threading::Monitor::Exit(settingsLock);
+		delete registerCacheVerifyTimer;
+		registerCacheVerifyTimer = nullptr;
 	}
 }
 
-uint TIVoxel::GetHdrScale()
+void TIVoxel::VerifyRegisterCacheCallback(Object^ state)
 {
+	if (!IsConnected)
+	{
+		return;
+	}
+
 	System::Threading::Monitor::Enter(settingsLock);
 	try
 	{
-		return (uint)(int)GetParameterByName("hdr_scale");// two casts are needed here.
+		for each (KeyValuePair<String^, Object^> entry in registerCache)
+		{
+			Object^ deviceValue = ReadParameterFromDevice(entry.Key);
+			if (!deviceValue->Equals(entry.Value))
+			{
+				log->WarnFormat("Register cache is stale for {0}: cached {1}, device {2}", entry.Key, entry.Value, deviceValue);
+				registerCache[entry.Key] = deviceValue;
+			}
+		}
+	}
+	catch (Exception^ ex)
+	{
+		log->Warn("Register cache verification failed: " + ex->Message);
 	}
 	finally
 	{
@@ -1241,61 +1814,100 @@ uint TIVoxel::GetHdrScale()
 	}
 }
 
-unsigned int TIVoxel::GetQuads()
+void TIVoxel::RefreshFrameSize()
 {
-	System::Threading::Monitor::Enter(settingsLock);
+	Voxel::FrameSize s;
+	cam->getFrameSize(s);
+	m_height = s.height;
+	m_width = s.width;
+}
+
+void TIVoxel::RebuildRayTable()
+{
+	Voxel::ConfigurationFile* configFile = cam->configFile.getCameraProfile(cam->getCurrentCameraProfileID());
+
+	RayTable* rayTable = NULL;
+	if (NULL != configFile && configFile->isPresent("calib", "fx") && configFile->isPresent("calib", "fy"))
+	{
+		RayTable::LensParameters lens;
+		lens.fx = configFile->getFloat("calib", "fx");
+		lens.fy = configFile->getFloat("calib", "fy");
+		lens.cx = configFile->getFloat("calib", "cx");
+		lens.cy = configFile->getFloat("calib", "cy");
+		lens.k1 = configFile->getFloat("calib", "k1");
+		lens.k2 = configFile->getFloat("calib", "k2");
+		lens.k3 = configFile->getFloat("calib", "k3");
+		lens.p1 = configFile->getFloat("calib", "p1");
+		lens.p2 = configFile->getFloat("calib", "p2");
+		rayTable = new RayTable(m_width, m_height, lens);
+	}
+	else
+	{
+		log->Warn("Current camera profile has no lens calibration. Point3DImage and ZImage are not available.");
+	}
+
+	System::Threading::Monitor::Enter(rayTableLock);
 	try
 	{
-		return (unsigned int)GetParameterByName("quad_cnt_max");// two casts are needed here.
+		delete m_rayTable;
+		m_rayTable = rayTable;
 	}
 	finally
 	{
-		System::Threading::Monitor::Exit(settingsLock);
+		System::Threading::Monitor::Exit(rayTableLock);
 	}
 }
 
-uint TIVoxel::GetSubFrames()
+void TIVoxel::SetTemporalFilterFrames(int val)
 {
-	System::Threading::Monitor::Enter(settingsLock);
-	try
+	if (val < 1 || val > FrameFusion::MaxWindowSize)
 	{
-		return (uint)(int)GetParameterByName("sub_frame_cnt_max");// two casts are needed here.
+		throw ExceptionBuilder::Build(ArgumentOutOfRangeException::typeid, Name, "error_setParameter", String::Format("TemporalFilterFrames must be between 1 and {0}.", FrameFusion::MaxWindowSize));
 	}
-	finally
+
+	m_temporalFilterFrames = val;
+	if (IsConnected)
 	{
-		System::Threading::Monitor::Exit(settingsLock);
+		ResetFrameFusion();
 	}
 }
 
-void TIVoxel::AdoptCameraData(byte* amplitudes, byte* phases, byte* ambient, int amplitudesWidth, int phasesWidth, int ambientWidth)
+void TIVoxel::SetHdrFusion(bool val)
 {
-	ByteImage^ localPhases = gcnew ByteImage(phasesWidth  * this->Width * this->Height, 1);
-	pin_ptr<Byte> localPhasesData = &(localPhases->Data)[0];
-	unsigned char * localPhasesPtr = localPhasesData;
-	memcpy(localPhasesPtr, phases, localPhases->Width);
-
-	ByteImage^ localAmplitudes = gcnew ByteImage(amplitudesWidth  * this->Width * this->Height, 1);
-	pin_ptr<Byte> localAmplitudesData = &(localAmplitudes->Data)[0];
-	unsigned char * localAmplitudesPtr = localAmplitudesData;
-	memcpy(localAmplitudesPtr, amplitudes, localAmplitudes->Width);
-
-	ByteImage^ localAmbient = gcnew ByteImage(ambientWidth * this->Width * this->Height, 1);
-	pin_ptr<Byte> localAmbientData = &(localAmbient->Data)[0];
-	unsigned char * localAmbientPtr = localAmbientData;
-	memcpy(localAmbientPtr, ambient, localAmbient->Width);
-
-	this->phaseData = localPhases;
-	this->amplitudeData = localAmplitudes;
-	this->ambientData = localAmbient;
+	m_hdrFusion = val;
+	if (IsConnected)
+	{
+		ResetFrameFusion();
+	}
 }
 
 void TIVoxel::AdoptFlagData(byte* flags, int flagsWidth)
 {
-	ByteImage^ localFlags = gcnew ByteImage(flagsWidth * this->Width * this->Height, 1);
+	if (NULL == flags || flagsWidth <= 0)
+	{
+		// the frame carries no flags
+		this->flagsData = nullptr;
+		return;
+	}
+
+	// This image is handed out as the Flags channel as it is, so copy straight into its final layout.
+	ByteImage^ localFlags = gcnew ByteImage(this->Width, this->Height);
 	pin_ptr<Byte> localFlagsData = &(localFlags->Data)[0];
 	unsigned char * localFlagsPtr = localFlagsData;
-	memcpy(localFlagsPtr, flags, localFlags->Width);
+	int numPixels = this->Width * this->Height;
+
+	if (flagsWidth == 1)
+	{
+		memcpy(localFlagsPtr, flags, numPixels);
+	}
+	else
+	{
+		// only the low byte carries flags
+		for (int i = 0; i < numPixels; i++)
+		{
+			localFlagsPtr[i] = flags[i * flagsWidth];
+		}
+	}
 
-	byte flag0 = localFlags->Data[0] >> 2;
-	// TODO somehow make this information available in MC2.
+	this->flagsData = localFlags;
 }
@@ -9,6 +9,8 @@
 #include "UVCStreamer.h"
 //#include <DepthCamera.h>
 #include <msclr\marshal_cppstd.h>
+#include "FrameFusion.h"
+#include "RayTable.h"
 
 using namespace System;
 using namespace System::Threading;
@@ -38,6 +40,10 @@ namespace Cameras
 		static String^ CHANNEL_NAME_DISTANCE = "Distance";
 		static String^ CHANNEL_NAME_AMBIENT = "Ambient";
 		static String^ CHANNEL_NAME_PHASE = "Phase";
+		/// <summary>Per-pixel flags of the sensor. The image is shared, do not modify it.</summary>
+		static String^ CHANNEL_NAME_FLAGS = "Flags";
+		/// <summary>Distance with pixels below <see cref="AmplitudeThreshold"/> or with any of <see cref="InvalidFlagsMask"/> set zeroed.</summary>
+		static String^ CHANNEL_NAME_VALID_DISTANCE = "ValidDistance";
 
 		static TIVoxel();
 		TIVoxel();
@@ -48,6 +54,24 @@ namespace Cameras
 		 */
 		static array<String^, 1>^ ScanForCameras();
 
+		/*
+		 * Scan results are cached for ScanTimeToLive ms, because enumerating USB is slow.
+		 * Rescan forces a new scan, e.g. after plugging in a camera.
+		 */
+		static void Rescan();
+		static property int ScanTimeToLive
+		{
+			inline int get() { return scanTimeToLive; }
+			inline void set(int val)
+			{
+				if (val < 0)
+				{
+					throw gcnew ArgumentOutOfRangeException("val", val, "ScanTimeToLive must not be negative.");
+				}
+				scanTimeToLive = val;
+			}
+		}
+
 		/*
 		 * Non-configuration parameters!
 		 */
@@ -181,6 +205,35 @@ namespace Cameras
 			inline void set(bool val) { SetHDRFilter(val); }
 		}
 
+		/// <summary>
+		/// Number of raw frames which are fused into one Distance/Amplitude image (1 = off).
+		/// </summary>
+		/// <remarks>Frames are averaged amplitude-weighted over a sliding window on the host.</remarks>
+		property int TemporalFilterFrames
+		{
+			inline int get() { return m_temporalFilterFrames; }
+			inline void set(int val) { SetTemporalFilterFrames(val); }
+		}
+
+		/// <summary>
+		/// Merge frames of different integration times (see <see cref="HdrScale"/>) on the host by discarding saturated samples.
+		/// </summary>
+		/// <remarks>Amplitudes of the short frames are scaled by 2^<see cref="HdrScale"/> to the long integration time before they are averaged.</remarks>
+		property bool HdrFusion
+		{
+			inline bool get() { return m_hdrFusion; }
+			inline void set(bool val) { SetHdrFusion(val); }
+		}
+
+		/// <summary>
+		/// Flag bits which mark a pixel as invalid in the ValidDistance channel (0 = only use <see cref="AmplitudeThreshold"/>).
+		/// </summary>
+		property int InvalidFlagsMask
+		{
+			inline int get() { return m_invalidFlagsMask; }
+			inline void set(int val) { m_invalidFlagsMask = val; }
+		}
+
 		property int Quads
 		{
 			inline int get() { return (int)m_quadCntMax; }
@@ -263,13 +316,63 @@ namespace Cameras
 				if (IsConnected)
 				{
 					cam->setCameraProfile((int)m_CameraProfile);
+					// the ray table and the fusion buffers have the size of the new profile's frames
+					RefreshFrameSize();
+					RefreshParameters();
+					RebuildRayTable();
+					// frames of the old profile must not be fused with the new ones
+					ResetFrameFusion();
 				}
 			}
 		}
 		
+		/// <summary>
+		/// Duration of the last <see cref="Commit"/>, from stopping the camera until the first valid frame arrived.
+		/// </summary>
+		property float ReconfigurationLatency
+		{
+			inline float get() { return m_reconfigurationLatency; }
+		}
+
+		/// <summary>
+		/// Periodically compare the register cache with the device and log differences (for debugging).
+		/// </summary>
+		property bool VerifyRegisterCache
+		{
+			inline bool get() { return m_verifyRegisterCache; }
+			inline void set(bool val) { SetVerifyRegisterCache(val); }
+		}
+
+		/// <summary>
+		/// Drops all cached register values, so the next reads go to the device.
+		/// </summary>
+		/// <remarks>Register reads are served from a cache which is updated by writes through MetriCam 2. Call this if registers were changed by other means.</remarks>
+		void RefreshParameters();
+
 		bool WritePT(ProjectiveTransformationRational^ proj, int profileId);
 		List<KeyValuePair<int, String^>>^ GetCameraProfiles();
 
+		/// <summary>
+		/// Starts collecting register writes instead of sending them to the camera one by one.
+		/// </summary>
+		/// <remarks>
+		/// All parameter changes until <see cref="Commit"/> are applied in a single stop/write/start cycle.
+		/// Reads of pending registers return the pending value.
+		/// </remarks>
+		/// <exception cref="InvalidOperationException">If a configuration transaction is already active.</exception>
+		void BeginConfiguration();
+
+		/// <summary>
+		/// Applies all register writes collected since <see cref="BeginConfiguration"/>.
+		/// </summary>
+		/// <remarks>
+		/// The camera is stopped once, all registers are written, and the camera is restarted.
+		/// Returns when the first frame after the restart has arrived (or after a timeout).
+		/// The elapsed time is available as <see cref="ReconfigurationLatency"/>.
+		/// </remarks>
+		/// <exception cref="InvalidOperationException">If no configuration transaction is active.</exception>
+		void Commit();
+
 	protected:
 		virtual void ConnectImpl() override;
 		virtual void DisconnectImpl() override;
@@ -298,6 +401,18 @@ namespace Cameras
 		
 		static Voxel::CameraSystem* sys;
 		static List<TIVoxel^>^ connectedVoxelObjects;
+		// protects sys, the scan cache and claimedDevices, Voxel::CameraSystem is not thread-safe
+		static Object^ systemLock = gcnew Object();
+		// protects connectedVoxelObjects; separate from systemLock, which is held while sys waits for the frame callbacks
+		static Object^ voxelObjectsLock = gcnew Object();
+
+		// device scan cache
+		static Voxel::Vector<Voxel::DevicePtr>* scannedDevices;
+		static System::Diagnostics::Stopwatch^ scanAge;
+		static int scanTimeToLive = 10000; // ms
+		// ids of devices opened by any instance
+		static List<String^>^ claimedDevices;
+		String^ m_deviceId;
 
 		//Voxel::DevicePtr* device;
 		Voxel::DepthCamera* cam;
@@ -313,6 +428,35 @@ namespace Cameras
 		ByteImage^ ambientData;
 		ByteImage^ flagsData;
 		AutoResetEvent^ updateResetEvent;
+		ManualResetEvent^ firstFrameEvent;
+
+		// register writes collected between BeginConfiguration and Commit (in order), nullptr if no transaction is active
+		List<KeyValuePair<String^, Object^>>^ m_pendingWrites;
+		// latest pending value per register, replaced by a new copy on each write so that GetParameterByName can read it without settingsLock; nullptr if no transaction is active
+		Dictionary<String^, Object^>^ m_pendingValues;
+		bool m_pllUpdatePending;
+		float m_reconfigurationLatency;
+		static const int ReconfigurationTimeout = 2000; // ms
+		static const int PllUpdateDwell = 50; // ms the mod_pll_update bit is held, as the PLL needs time to lock
+
+		// host-side temporal / HDR fusion
+		FrameFusion* m_fusion;
+		Object^ fusionLock = gcnew Object();
+		FloatImage^ fusedPhaseData;
+		FloatImage^ fusedAmplitudeData;
+		FloatImage^ currentFusedPhases;
+		FloatImage^ currentFusedAmplitudes;
+		static const int HdrShortFrameFlag = 0x08; // flag bit of the depth engine marking frames of the short HDR integration time
+
+		// shadow copy of read-write registers as read from the device; SetParameterByName stores the value the device reports back after each write and all are cleared on profile change and disconnect
+		System::Collections::Concurrent::ConcurrentDictionary<String^, Object^>^ registerCache = gcnew System::Collections::Concurrent::ConcurrentDictionary<String^, Object^>();
+		bool m_verifyRegisterCache = false;
+		Timer^ registerCacheVerifyTimer;
+		static const int RegisterCacheVerifyInterval = 5000; // ms
+
+		// unit rays of the current profile's lens, for Point3DImage and ZImage
+		RayTable* m_rayTable;
+		Object^ rayTableLock = gcnew Object();
 
 		List<String^>^ configurationParameters;		
 
@@ -346,6 +490,9 @@ namespace Cameras
 		bool m_ind_freq_data_sel;
 		int m_dealiased_ph_mask;
 		int m_hdrScale;
+		int m_temporalFilterFrames = 1; // 1 - 16
+		bool m_hdrFusion = false;
+		int m_invalidFlagsMask = 0; // 0 - 255
 
 		// hdr filter id
 		int m_hdr_filter_id = -1;
@@ -358,12 +505,22 @@ namespace Cameras
 		ImageBase^ CalcAmplitude();
 		ImageBase^ CalcAmbient();
 		ImageBase^ CalcPhase();
+		ImageBase^ CalcFlags();
 		ImageBase^ CalcDistance();
+		ImageBase^ CalcValidDistance();
+		ImageBase^ CalcPoint3DImage();
+		ImageBase^ CalcZImage();
 		
-		Voxel::DevicePtr* GetDeviceBySerialNumber(String^ serial);
+		static Voxel::Vector<Voxel::DevicePtr> GetDevices();
+		static Voxel::DevicePtr SelectDevice(const Voxel::Vector<Voxel::DevicePtr>& devices, String^ serial);
+		static Voxel::DevicePtr GetDeviceBySerialNumber(const Voxel::Vector<Voxel::DevicePtr>& devices, String^ serial);
+		void ReleaseDevice();
 		Object^ GetParameterByName(String^ name);
+		Object^ ReadParameterFromDevice(String^ name);
+		bool IsVolatileParameter(String^ name);
 		void SetParameterByName(String^ name, Object^ value);
-		void AdoptCameraData(byte* amplitudes, byte* phases, byte* ambient, int amplitudesWidth, int phasesWidth, int ambientWidth);
+		void AdoptCameraData(byte* amplitudes, byte* phases, byte* ambient, int amplitudesWidth, int phasesWidth, int ambientWidth, uint16_t integrationScale);
+		uint16_t IntegrationScaleOf(byte* flags, int flagsWidth);
 		void AdoptFlagData(byte* flags, int flagWidth);
 		static void onNewDepthFrame(Voxel::DepthCamera &dc, const Voxel::Frame &frame, Voxel::DepthCamera::FrameType c);
 
@@ -454,6 +611,18 @@ namespace Cameras
 		void SetIndFreqDataSel(bool val);
 		void SetDealiased_ph_mask(int val);
 		void SetHDRFilter(bool val);
+		void UpdateModulationPll();
+		bool TryGetPendingWrite(String^ name, Object^% value);
+		void CacheAppliedValue(String^ name);
+		void SetTemporalFilterFrames(int val);
+		void SetHdrFusion(bool val);
+		void ResetFrameFusion();
+		void FuseFrame(const uint16_t* phases, const uint16_t* amplitudes, uint16_t integrationScale);
+		void RefreshFrameSize();
+		void RebuildRayTable();
+		void SetVerifyRegisterCache(bool val);
+		void UpdateRegisterCacheVerification();
+		void VerifyRegisterCacheCallback(Object^ state);
 
 
 		
@@ -516,6 +685,18 @@ namespace Cameras
 			}
 		}
 
+		property ParamDesc<float>^ ReconfigurationLatencyDesc
+		{
+			inline ParamDesc<float> ^get()
+			{
+				ParamDesc<float> ^res = gcnew ParamDesc<float>();
+				res->Description = "Duration of the last configuration commit";
+				res->Unit = "ms";
+				res->ReadableWhen = ParamDesc::ConnectionStates::Connected;
+				return res;
+			}
+		}
+
 		property ParamDesc<int>^ PhaseOffsetBaseDesc
 		{
 			inline ParamDesc<int> ^get()
@@ -659,6 +840,58 @@ namespace Cameras
 			}
 		}
 
+		property ParamDesc<int>^ TemporalFilterFramesDesc
+		{
+			inline ParamDesc<int> ^get()
+			{
+				ParamDesc<int> ^res = ParamDesc::BuildRangeParamDesc(1, FrameFusion::MaxWindowSize);
+				res->Unit = "frames";
+				res->Description = "Temporal Filter Frames";
+				res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+				res->WritableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+				return res;
+			}
+		}
+
+		property ParamDesc<int>^ InvalidFlagsMaskDesc
+		{
+			inline ParamDesc<int> ^get()
+			{
+				ParamDesc<int> ^res = ParamDesc::BuildRangeParamDesc(0, 255);
+				res->Unit = "";
+				res->Description = "Invalid Flags Mask";
+				res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+				res->WritableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+				return res;
+			}
+		}
+
+		property ParamDesc<bool>^ VerifyRegisterCacheDesc
+		{
+			inline ParamDesc<bool> ^get()
+			{
+				ParamDesc<bool> ^res = gcnew ParamDesc<bool>();
+				res->Unit = "";
+				res->Description = "Verify register cache";
+				res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+				res->WritableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+				return res;
+			}
+		}
+
+		property ParamDesc<bool>^ HdrFusionDesc
+		{
+			inline ParamDesc<bool> ^get()
+			{
+				ParamDesc<bool> ^res = gcnew ParamDesc<bool>();
+				res->Unit = "";
+				res->Description = "HDR Fusion";
+				res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+				res->WritableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+				return res;
+			}
+		}
+
 		property ParamDesc<int>^ QuadsDesc
 		{
 			inline ParamDesc<int> ^get()
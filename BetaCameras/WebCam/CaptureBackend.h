@@ -0,0 +1,60 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include "FrameConversion.h"
+#include "FrameRing.h"
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	/*
+	 * Video mode asked for by the user. Zero / FrameFormatUnknown means "any" or "driver default".
+	 */
+	struct CaptureRequest
+	{
+		FrameFormat format;
+		int width;
+		int height;
+		float frameRate;
+	};
+
+	/*
+	 * Layout of the frames a backend delivers.
+	 */
+	struct CaptureFormat
+	{
+		FrameFormat format;
+		int width;
+		int height;
+		int stride; // bytes per row (of the Y plane for NV12), 0 for MJPG
+		int frameSize; // bytes of an uncompressed frame, upper bound for MJPG
+		bool bottomUp; // only RGB24 DIBs
+	};
+
+	/*
+	 * Source of frames for a CaptureCore.
+	 *
+	 * A backend negotiates a format in Start and then pushes every frame into the ring from its own thread,
+	 * until Stop returns. Backends are platform specific; everything behind this interface is portable.
+	 */
+	class CaptureBackend
+	{
+	public:
+		virtual ~CaptureBackend() {}
+
+		/*
+		 * Opens the device with the mode closest to the request and starts streaming into ring.
+		 * Returns false if the device could not be opened or started.
+		 */
+		virtual bool Start(const CaptureRequest& request, FrameRing* ring, CaptureFormat& format) = 0;
+
+		/*
+		 * Stops streaming. No frame is pushed after Stop returns.
+		 */
+		virtual void Stop() = 0;
+	};
+}
+}
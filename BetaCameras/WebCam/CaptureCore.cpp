@@ -0,0 +1,167 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "CaptureCore.h"
+#ifdef _WIN32
+#include "MjpgDecoder.h"
+#endif
+#include <string.h>
+
+using namespace MetriCam2::Cameras;
+
+CaptureCore::CaptureCore()
+	: m_backend(NULL), m_mjpgDecoder(NULL)
+{
+	memset(&m_format, 0, sizeof(m_format));
+	memset(&m_current, 0, sizeof(m_current));
+}
+
+CaptureCore::~CaptureCore()
+{
+	Stop();
+#ifdef _WIN32
+	delete m_mjpgDecoder;
+#endif
+}
+
+bool CaptureCore::Start(CaptureBackend* backend, const CaptureRequest& request)
+{
+	Stop();
+	m_ring.Reset();
+	if (!backend->Start(request, &m_ring, m_format))
+	{
+		delete backend;
+		return false;
+	}
+	m_backend = backend;
+	PrepareDecoder();
+	return true;
+}
+
+void CaptureCore::SetFormat(const CaptureFormat& format)
+{
+	m_format = format;
+	PrepareDecoder();
+}
+
+void CaptureCore::PrepareDecoder()
+{
+#ifdef _WIN32
+	if (FrameFormatMjpg != m_format.format)
+	{
+		return;
+	}
+	if (NULL == m_mjpgDecoder)
+	{
+		m_mjpgDecoder = new MjpgDecoder();
+	}
+	m_mjpgDecoder->Initialize(); // on failure, Decode retries and reports it per frame
+#endif
+}
+
+void CaptureCore::Stop()
+{
+	if (NULL != m_backend)
+	{
+		m_backend->Stop();
+		delete m_backend;
+		m_backend = NULL;
+	}
+	m_ring.Close();
+	memset(&m_current, 0, sizeof(m_current));
+}
+
+CaptureFormat CaptureCore::DescribeFormat(FrameFormat format, int width, int height, bool bottomUp, int maxCompressedSize)
+{
+	CaptureFormat result;
+	result.format = format;
+	result.width = width;
+	result.height = height;
+	result.stride = FrameConversion::SourceStride(format, width);
+	result.bottomUp = (FrameFormatRgb24 == format) && bottomUp;
+	switch (format)
+	{
+	case FrameFormatNv12:
+		result.frameSize = result.stride * height * 3 / 2;
+		break;
+	case FrameFormatMjpg:
+		result.frameSize = (maxCompressedSize > 0) ? maxCompressedSize : 3 * width * height;
+		break;
+	default:
+		result.frameSize = result.stride * height;
+		break;
+	}
+	return result;
+}
+
+bool CaptureCore::Acquire(int timeoutMs)
+{
+	FrameRing::Frame frame;
+	if (!m_ring.Acquire(timeoutMs, frame))
+	{
+		return false;
+	}
+	m_current = frame;
+	return true;
+}
+
+void CaptureCore::SetFrame(const unsigned char* data, size_t size)
+{
+	m_current.data = data;
+	m_current.size = size;
+	m_current.sequence++;
+	m_current.sampleTime = 0;
+	m_current.hostTime = FrameRing::HostTime();
+}
+
+bool CaptureCore::IsComplete() const
+{
+	if (NULL == m_current.data)
+	{
+		return false;
+	}
+	// compressed frames vary in size
+	return FrameFormatMjpg == m_format.format || m_current.size >= (size_t)m_format.frameSize;
+}
+
+bool CaptureCore::Convert(uint8_t* dst, int dstStride, bool mirror)
+{
+	if (!IsComplete())
+	{
+		return false;
+	}
+
+	const uint8_t* src = m_current.data;
+	const CaptureFormat& f = m_format;
+	switch (f.format)
+	{
+	case FrameFormatRgb24:
+		if (f.bottomUp)
+		{
+			FrameConversion::FlipBgr24(src, f.stride, dst, dstStride, f.width, f.height, mirror);
+		}
+		else
+		{
+			FrameConversion::CopyBgr24(src, f.stride, dst, dstStride, f.width, f.height, mirror);
+		}
+		return true;
+	case FrameFormatYuy2:
+		FrameConversion::Yuy2ToBgr24(src, f.stride, dst, dstStride, f.width, f.height, mirror);
+		return true;
+	case FrameFormatNv12:
+		FrameConversion::Nv12ToBgr24(src, f.stride, dst, dstStride, f.width, f.height, mirror);
+		return true;
+	case FrameFormatMjpg:
+#ifdef _WIN32
+		if (NULL == m_mjpgDecoder)
+		{
+			m_mjpgDecoder = new MjpgDecoder();
+		}
+		return m_mjpgDecoder->Decode(src, m_current.size, dst, dstStride, f.width, f.height, mirror);
+#else
+		return false; // no JPEG decoder outside Windows
+#endif
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,87 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include "CaptureBackend.h"
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	class MjpgDecoder;
+
+	/*
+	 * Platform independent part of webcam capture: the frame ring, the frame format and the conversion to BGR24.
+	 *
+	 * Frames either come from a CaptureBackend started with Start, from an external producer writing into Ring()
+	 * (e.g. a DirectShow sample grabber callback, which then also has to call SetFormat), or from a caller-owned
+	 * buffer passed to SetFrame (one-shot capture).
+	 *
+	 * Acquire/SetFrame and Convert must be called from one thread at a time.
+	 */
+	class CaptureCore
+	{
+	public:
+		CaptureCore();
+		~CaptureCore();
+
+		/*
+		 * Takes ownership of backend and starts it. Returns false (and deletes backend) if it could not be started.
+		 */
+		bool Start(CaptureBackend* backend, const CaptureRequest& request);
+
+		/*
+		 * Stops the backend and fails pending and future Acquire calls.
+		 */
+		void Stop();
+
+		FrameRing& Ring() { return m_ring; }
+
+		const CaptureFormat& Format() const { return m_format; }
+		void SetFormat(const CaptureFormat& format);
+
+		/*
+		 * Describes the layout of a frame. maxCompressedSize is only used for MJPG (0: assume 3 bytes per pixel).
+		 */
+		static CaptureFormat DescribeFormat(FrameFormat format, int width, int height, bool bottomUp, int maxCompressedSize);
+
+		/*
+		 * Makes the newest frame of the ring the current frame. It stays valid until the next Acquire or Stop.
+		 * Returns false on timeout or after Stop.
+		 */
+		bool Acquire(int timeoutMs);
+
+		/*
+		 * Makes an externally owned buffer the current frame.
+		 */
+		void SetFrame(const unsigned char* data, size_t size);
+
+		const FrameRing::Frame& CurrentFrame() const { return m_current; }
+
+		/*
+		 * Whether the current frame has as many bytes as its format requires.
+		 */
+		bool IsComplete() const;
+
+		/*
+		 * Converts the current frame into a 24bpp BGR top-down image of Format().width x Format().height.
+		 * Returns false if there is no complete frame or it could not be decoded.
+		 */
+		bool Convert(uint8_t* dst, int dstStride, bool mirror);
+
+	private:
+		CaptureCore(const CaptureCore&);
+		CaptureCore& operator=(const CaptureCore&);
+
+		// creates the MJPG decoder while connecting instead of with the first frame
+		void PrepareDecoder();
+
+		FrameRing m_ring;
+		CaptureBackend* m_backend;
+		CaptureFormat m_format;
+		FrameRing::Frame m_current;
+		MjpgDecoder* m_mjpgDecoder; // Windows only
+	};
+}
+}
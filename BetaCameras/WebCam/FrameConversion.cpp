@@ -0,0 +1,134 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "FrameConversion.h"
+#include <string.h>
+
+#if defined(_M_X64)
+#include <intrin.h>
+#include <tmmintrin.h>
+#define FRAMECONVERSION_SSSE3
+static bool HasSsse3()
+{
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 9)) != 0;
+}
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define FRAMECONVERSION_SSSE3
+static bool HasSsse3()
+{
+	return true;
+}
+#endif
+
+using namespace MetriCam2::Cameras;
+
+void FrameConversion::FlipBgr24(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height, bool mirror)
+{
+	const int rowBytes = 3 * width;
+	for (int y = 0; y < height; y++)
+	{
+		const uint8_t* srcRow = src + (size_t)(height - 1 - y) * srcStride;
+		uint8_t* dstRow = dst + (size_t)y * dstStride;
+		if (mirror)
+		{
+			MirrorRowBgr24(srcRow, dstRow, width);
+		}
+		else
+		{
+			memcpy(dstRow, srcRow, rowBytes);
+		}
+	}
+}
+
+void FrameConversion::CopyBgr24(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height, bool mirror)
+{
+	const int rowBytes = 3 * width;
+	for (int y = 0; y < height; y++)
+	{
+		const uint8_t* srcRow = src + (size_t)y * srcStride;
+		uint8_t* dstRow = dst + (size_t)y * dstStride;
+		if (mirror)
+		{
+			MirrorRowBgr24(srcRow, dstRow, width);
+		}
+		else
+		{
+			memcpy(dstRow, srcRow, rowBytes);
+		}
+	}
+}
+
+void FrameConversion::Yuy2ToBgr24(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height, bool mirror)
+{
+	// write left to right, or right to left when mirroring
+	const int step = mirror ? -3 : 3;
+	for (int y = 0; y < height; y++)
+	{
+		const uint8_t* s = src + (size_t)y * srcStride;
+		uint8_t* d = dst + (size_t)y * dstStride + (mirror ? 3 * (width - 1) : 0);
+		for (int x = 0; x + 1 < width; x += 2, s += 4)
+		{
+			int u = s[1];
+			int v = s[3];
+			YuvToBgr(s[0], u, v, d);
+			d += step;
+			YuvToBgr(s[2], u, v, d);
+			d += step;
+		}
+		if (width & 1)
+		{
+			YuvToBgr(s[0], s[1], s[3], d);
+		}
+	}
+}
+
+void FrameConversion::Nv12ToBgr24(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height, bool mirror)
+{
+	const uint8_t* uvPlane = src + (size_t)height * srcStride;
+	const int step = mirror ? -3 : 3;
+	for (int y = 0; y < height; y++)
+	{
+		const uint8_t* yRow = src + (size_t)y * srcStride;
+		const uint8_t* uvRow = uvPlane + (size_t)(y / 2) * srcStride;
+		uint8_t* d = dst + (size_t)y * dstStride + (mirror ? 3 * (width - 1) : 0);
+		for (int x = 0; x < width; x++)
+		{
+			const uint8_t* uv = uvRow + (x & ~1);
+			YuvToBgr(yRow[x], uv[0], uv[1], d);
+			d += step;
+		}
+	}
+}
+
+void FrameConversion::MirrorRowBgr24(const uint8_t* src, uint8_t* dst, int width)
+{
+	int x = 0;
+
+#ifdef FRAMECONVERSION_SSSE3
+	static const bool ssse3 = HasSsse3();
+	if (ssse3)
+	{
+		// 4 pixels per iteration: load 16 bytes ending at the last byte of source pixel (width - 1 - x),
+		// reverse the pixel order within the upper 12 bytes and store them (the 4 extra bytes are overwritten
+		// by the next iteration). Both the load and the store stay within the row.
+		const __m128i reversePixels = _mm_setr_epi8(13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, -1, -1, -1, -1);
+		for (; 3 * x + 16 <= 3 * width; x += 4)
+		{
+			__m128i pixels = _mm_loadu_si128((const __m128i*)(src + 3 * (width - x) - 16));
+			_mm_storeu_si128((__m128i*)(dst + 3 * x), _mm_shuffle_epi8(pixels, reversePixels));
+		}
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		const uint8_t* s = src + 3 * (width - 1 - x);
+		uint8_t* d = dst + 3 * x;
+		d[0] = s[0];
+		d[1] = s[1];
+		d[2] = s[2];
+	}
+}
@@ -0,0 +1,87 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	/*
+	 * Pixel formats delivered by webcams.
+	 */
+	enum FrameFormat
+	{
+		FrameFormatUnknown = 0,
+		FrameFormatRgb24, // packed BGR, DIB layout (bottom-up unless the height is negative)
+		FrameFormatYuy2, // packed 4:2:2, Y0 U Y1 V, top-down
+		FrameFormatNv12, // planar 4:2:0, Y plane followed by interleaved UV plane, top-down
+		FrameFormatMjpg, // one JPEG image per frame
+	};
+
+	/*
+	 * Conversion of raw webcam frames into 24bpp BGR top-down images (the layout of Format24bppRgb bitmaps).
+	 *
+	 * Each conversion is a single pass over the source; flipping and mirroring are done while writing.
+	 * YUV formats are converted with BT.601 limited range coefficients in 8.8 fixed point.
+	 */
+	class FrameConversion
+	{
+	public:
+		/*
+		 * Row stride of an uncompressed frame in bytes (of the Y plane for NV12), 0 for MJPG.
+		 */
+		static int SourceStride(FrameFormat format, int width)
+		{
+			switch (format)
+			{
+			case FrameFormatRgb24:
+				return (3 * width + 3) & ~3;
+			case FrameFormatYuy2:
+				return (2 * width + 3) & ~3;
+			case FrameFormatNv12:
+				return width;
+			default:
+				return 0;
+			}
+		}
+
+		/*
+		 * Copies a bottom-up BGR24 DIB into a top-down image, optionally mirrored horizontally.
+		 */
+		static void FlipBgr24(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height, bool mirror);
+
+		/*
+		 * Copies a top-down BGR24 image, optionally mirrored horizontally.
+		 */
+		static void CopyBgr24(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height, bool mirror);
+
+		static void Yuy2ToBgr24(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height, bool mirror);
+
+		/*
+		 * srcStride applies to both planes; the UV plane starts at src + height * srcStride.
+		 */
+		static void Nv12ToBgr24(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height, bool mirror);
+
+	private:
+		static void MirrorRowBgr24(const uint8_t* src, uint8_t* dst, int width);
+
+		static inline uint8_t Clamp(int value)
+		{
+			return (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+		}
+
+		static inline void YuvToBgr(int y, int u, int v, uint8_t* bgr)
+		{
+			int c = 298 * (y - 16) + 128;
+			int d = u - 128;
+			int e = v - 128;
+			bgr[0] = Clamp((c + 516 * d) >> 8);
+			bgr[1] = Clamp((c - 100 * d - 208 * e) >> 8);
+			bgr[2] = Clamp((c + 409 * e) >> 8);
+		}
+	};
+}
+}
@@ -0,0 +1,158 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "FrameRing.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <vector>
+
+using namespace MetriCam2::Cameras;
+
+struct FrameRing::Impl
+{
+	struct Slot
+	{
+		std::vector<unsigned char> data;
+		size_t size;
+		uint64_t sequence;
+		double sampleTime;
+		double hostTime;
+	};
+
+	mutable std::mutex mutex;
+	std::condition_variable frameAvailable;
+	std::vector<Slot> slots;
+	int next; // round-robin start for the producer
+	int newest; // slot of the newest frame, -1 if none
+	int held; // slot held by the consumer, -1 if none
+	uint64_t pushed;
+	uint64_t lastAcquired;
+	uint64_t dropped;
+	bool closed;
+};
+
+FrameRing::FrameRing(int numBuffers)
+	: m_impl(new Impl())
+{
+	m_impl->slots.resize(std::max(numBuffers, (int)MinNumBuffers));
+	Reset();
+}
+
+FrameRing::~FrameRing()
+{
+	delete m_impl;
+}
+
+void FrameRing::Reset()
+{
+	std::lock_guard<std::mutex> lock(m_impl->mutex);
+	for (size_t i = 0; i < m_impl->slots.size(); i++)
+	{
+		m_impl->slots[i].size = 0;
+		m_impl->slots[i].sequence = 0;
+	}
+	m_impl->next = 0;
+	m_impl->newest = -1;
+	m_impl->held = -1;
+	m_impl->pushed = 0;
+	m_impl->lastAcquired = 0;
+	m_impl->dropped = 0;
+	m_impl->closed = false;
+}
+
+double FrameRing::HostTime()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FrameRing::Push(const unsigned char* data, size_t size, double sampleTime)
+{
+	const double hostTime = HostTime();
+	int slotIndex;
+	{
+		std::lock_guard<std::mutex> lock(m_impl->mutex);
+		const int numSlots = (int)m_impl->slots.size();
+		slotIndex = m_impl->next;
+		while (slotIndex == m_impl->newest || slotIndex == m_impl->held)
+		{
+			slotIndex = (slotIndex + 1) % numSlots;
+		}
+		m_impl->next = (slotIndex + 1) % numSlots;
+	}
+
+	// only the producer touches a slot which is neither newest nor held, so copy without the lock
+	Impl::Slot& slot = m_impl->slots[slotIndex];
+	if (slot.data.size() < size)
+	{
+		slot.data.resize(size);
+	}
+	memcpy(slot.data.data(), data, size);
+	slot.size = size;
+	slot.sampleTime = sampleTime;
+	slot.hostTime = hostTime;
+
+	{
+		std::lock_guard<std::mutex> lock(m_impl->mutex);
+		if (m_impl->newest >= 0 && m_impl->slots[m_impl->newest].sequence > m_impl->lastAcquired)
+		{
+			m_impl->dropped++;
+		}
+		slot.sequence = ++m_impl->pushed;
+		m_impl->newest = slotIndex;
+	}
+	m_impl->frameAvailable.notify_all();
+}
+
+bool FrameRing::Acquire(int timeoutMs, Frame& frame)
+{
+	std::unique_lock<std::mutex> lock(m_impl->mutex);
+	bool available = m_impl->frameAvailable.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]
+	{
+		return m_impl->closed || (m_impl->newest >= 0 && m_impl->slots[m_impl->newest].sequence > m_impl->lastAcquired);
+	});
+	if (!available || m_impl->closed)
+	{
+		return false;
+	}
+
+	m_impl->held = m_impl->newest;
+	const Impl::Slot& slot = m_impl->slots[m_impl->held];
+	m_impl->lastAcquired = slot.sequence;
+
+	frame.data = slot.data.data();
+	frame.size = slot.size;
+	frame.sequence = slot.sequence;
+	frame.sampleTime = slot.sampleTime;
+	frame.hostTime = slot.hostTime;
+	return true;
+}
+
+void FrameRing::Release()
+{
+	std::lock_guard<std::mutex> lock(m_impl->mutex);
+	m_impl->held = -1;
+}
+
+void FrameRing::Close()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_impl->mutex);
+		m_impl->closed = true;
+	}
+	m_impl->frameAvailable.notify_all();
+}
+
+uint64_t FrameRing::FramesPushed() const
+{
+	std::lock_guard<std::mutex> lock(m_impl->mutex);
+	return m_impl->pushed;
+}
+
+uint64_t FrameRing::FramesDropped() const
+{
+	std::lock_guard<std::mutex> lock(m_impl->mutex);
+	return m_impl->dropped;
+}
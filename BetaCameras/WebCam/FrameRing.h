@@ -0,0 +1,74 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	/*
+	 * Ring of preallocated frame buffers between a capture thread (producer) and Update (consumer).
+	 *
+	 * The producer never blocks: it writes into a slot which is neither the newest frame nor held by the
+	 * consumer, so at least 3 slots are used. The consumer always gets the newest frame; frames which were
+	 * overwritten before anybody acquired them are counted as dropped.
+	 *
+	 * Synchronization lives in the implementation file, so this header can be included from managed code.
+	 */
+	class FrameRing
+	{
+	public:
+		struct Frame
+		{
+			const unsigned char* data;
+			size_t size;
+			uint64_t sequence; // 1, 2, 3, ... in the order frames were pushed
+			double sampleTime; // stream time reported by the source
+			double hostTime; // HostTime() when the frame was pushed
+		};
+
+		static const int MinNumBuffers = 3;
+
+		explicit FrameRing(int numBuffers = MinNumBuffers);
+		~FrameRing();
+
+		/*
+		 * Seconds of a monotonic host clock (QueryPerformanceCounter on Windows), comparable across rings.
+		 */
+		static double HostTime();
+
+		/*
+		 * Copies a frame into the ring and stamps it with HostTime(). Called by the capture thread.
+		 */
+		void Push(const unsigned char* data, size_t size, double sampleTime);
+
+		/*
+		 * Waits until a frame newer than the last acquired one is available and holds it.
+		 * The frame stays valid until the next call of Acquire or Release.
+		 * Returns false on timeout or if the ring was closed.
+		 */
+		bool Acquire(int timeoutMs, Frame& frame);
+		void Release();
+
+		/*
+		 * Wakes up and fails all waiting and future Acquire calls, e.g. on disconnect.
+		 */
+		void Close();
+		void Reset();
+
+		uint64_t FramesPushed() const;
+		uint64_t FramesDropped() const;
+
+	private:
+		FrameRing(const FrameRing&);
+		FrameRing& operator=(const FrameRing&);
+
+		struct Impl;
+		Impl* m_impl;
+	};
+}
+}
@@ -0,0 +1,215 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "MjpgDecoder.h"
+#include "FrameConversion.h"
+#include <windows.h>
+#include <wincodec.h>
+
+using namespace MetriCam2::Cameras;
+
+namespace
+{
+	// DHT segment with the standard luminance and chrominance DC/AC tables (ITU T.81, K.3)
+	const uint8_t StandardHuffmanTables[] =
+	{
+	0xff, 0xc4, 0x01, 0xa2, 0x00, 0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+	0x0b, 0x10, 0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00,
+	0x01, 0x7d, 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51,
+	0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52,
+	0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26,
+	0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47,
+	0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67,
+	0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+	0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6,
+	0xf7, 0xf8, 0xf9, 0xfa, 0x01, 0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+	0x0b, 0x11, 0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04, 0x07, 0x05, 0x04, 0x04, 0x00, 0x01,
+	0x02, 0x77, 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07,
+	0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33,
+	0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19,
+	0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46,
+	0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66,
+	0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85,
+	0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+	0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba,
+	0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
+	0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6,
+	0xf7, 0xf8, 0xf9, 0xfa,
+	};
+
+	template <class T>
+	void SafeRelease(T*& p)
+	{
+		if (NULL != p)
+		{
+			p->Release();
+			p = NULL;
+		}
+	}
+}
+
+MjpgDecoder::MjpgDecoder()
+	: m_factory(NULL), m_mtaUsage(NULL)
+{
+}
+
+MjpgDecoder::~MjpgDecoder()
+{
+	SafeRelease(m_factory);
+	if (NULL != m_mtaUsage)
+	{
+		CoDecrementMTAUsage((CO_MTA_USAGE_COOKIE)m_mtaUsage);
+	}
+}
+
+bool MjpgDecoder::Initialize()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return InitializeLocked();
+}
+
+bool MjpgDecoder::InitializeLocked()
+{
+	if (NULL != m_factory)
+	{
+		return true;
+	}
+
+	// Keep the MTA alive independently of the threads using the decoder. Threads without COM initialized then belong
+	// to the MTA implicitly, so the factory can be used from the acquisition thread as well as from the caller of Update.
+	if (NULL == m_mtaUsage)
+	{
+		CO_MTA_USAGE_COOKIE cookie = NULL;
+		if (FAILED(CoIncrementMTAUsage(&cookie)))
+		{
+			return false;
+		}
+		m_mtaUsage = cookie;
+	}
+	if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&m_factory))))
+	{
+		m_factory = NULL;
+		return false;
+	}
+	return true;
+}
+
+const uint8_t* MjpgDecoder::AddMissingHuffmanTables(const uint8_t* jpeg, size_t& size, std::vector<uint8_t>& scratch)
+{
+	if (size < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8)
+	{
+		return jpeg;
+	}
+
+	// walk the marker segments up to the start of scan
+	size_t i = 2;
+	while (i + 4 <= size)
+	{
+		if (jpeg[i] != 0xFF)
+		{
+			return jpeg; // corrupt, let the decoder report it
+		}
+		uint8_t marker = jpeg[i + 1];
+		if (marker == 0xFF)
+		{
+			i++; // fill byte
+			continue;
+		}
+		if (marker == 0xC4)
+		{
+			return jpeg;
+		}
+		if (marker == 0xDA)
+		{
+			scratch.resize(size + sizeof(StandardHuffmanTables));
+			memcpy(scratch.data(), jpeg, i);
+			memcpy(scratch.data() + i, StandardHuffmanTables, sizeof(StandardHuffmanTables));
+			memcpy(scratch.data() + i + sizeof(StandardHuffmanTables), jpeg + i, size - i);
+			size = scratch.size();
+			return scratch.data();
+		}
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+		{
+			i += 2; // no length field
+			continue;
+		}
+		i += 2 + ((jpeg[i + 2] << 8) | jpeg[i + 3]);
+	}
+	return jpeg;
+}
+
+bool MjpgDecoder::Decode(const uint8_t* jpeg, size_t size, uint8_t* dst, int dstStride, int width, int height, bool mirror)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (!InitializeLocked())
+	{
+		return false;
+	}
+
+	const uint8_t* data = AddMissingHuffmanTables(jpeg, size, m_jpeg);
+
+	IWICStream* stream = NULL;
+	IWICBitmapDecoder* decoder = NULL;
+	IWICBitmapFrameDecode* frame = NULL;
+	IWICFormatConverter* converter = NULL;
+	bool success = false;
+	do
+	{
+		if (FAILED(m_factory->CreateStream(&stream)))
+		{
+			break;
+		}
+		if (FAILED(stream->InitializeFromMemory(const_cast<BYTE*>(data), (DWORD)size)))
+		{
+			break;
+		}
+		if (FAILED(m_factory->CreateDecoderFromStream(stream, NULL, WICDecodeMetadataCacheOnDemand, &decoder)))
+		{
+			break;
+		}
+		if (FAILED(decoder->GetFrame(0, &frame)))
+		{
+			break;
+		}
+		UINT frameWidth, frameHeight;
+		if (FAILED(frame->GetSize(&frameWidth, &frameHeight)) || frameWidth != (UINT)width || frameHeight != (UINT)height)
+		{
+			break;
+		}
+		if (FAILED(m_factory->CreateFormatConverter(&converter)))
+		{
+			break;
+		}
+		if (FAILED(converter->Initialize(frame, GUID_WICPixelFormat24bppBGR, WICBitmapDitherTypeNone, NULL, 0.0, WICBitmapPaletteTypeCustom)))
+		{
+			break;
+		}
+
+		if (!mirror)
+		{
+			// decode straight into the destination
+			success = SUCCEEDED(converter->CopyPixels(NULL, dstStride, (UINT)dstStride * height, dst));
+			break;
+		}
+
+		const int stride = 3 * width;
+		m_pixels.resize((size_t)stride * height);
+		if (FAILED(converter->CopyPixels(NULL, stride, (UINT)m_pixels.size(), m_pixels.data())))
+		{
+			break;
+		}
+		FrameConversion::CopyBgr24(m_pixels.data(), stride, dst, dstStride, width, height, true);
+		success = true;
+	} while (false);
+
+	SafeRelease(converter);
+	SafeRelease(frame);
+	SafeRelease(decoder);
+	SafeRelease(stream);
+	return success;
+}
@@ -0,0 +1,60 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+struct IWICImagingFactory;
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	/*
+	 * Decodes MJPG webcam frames into 24bpp BGR top-down images using the Windows Imaging Component.
+	 *
+	 * Many webcams omit the Huffman tables in their frames and rely on the standard tables (ITU T.81, K.3);
+	 * these are inserted before decoding.
+	 *
+	 * The WIC factory lives in the multithreaded apartment, which the decoder keeps alive; Decode may therefore be called
+	 * from any thread, also one without COM initialized. Calls are serialized, use one decoder per camera.
+	 */
+	class MjpgDecoder
+	{
+	public:
+		MjpgDecoder();
+		~MjpgDecoder();
+
+		/*
+		 * Creates the WIC factory, so that the first frame does not pay for it. Returns false if WIC is not available.
+		 */
+		bool Initialize();
+
+		/*
+		 * Returns false if the frame could not be decoded or does not have the expected size.
+		 */
+		bool Decode(const uint8_t* jpeg, size_t size, uint8_t* dst, int dstStride, int width, int height, bool mirror);
+
+		/*
+		 * Returns jpeg, or a copy with the standard Huffman tables in scratch if it has none.
+		 */
+		static const uint8_t* AddMissingHuffmanTables(const uint8_t* jpeg, size_t& size, std::vector<uint8_t>& scratch);
+
+	private:
+		MjpgDecoder(const MjpgDecoder&);
+		MjpgDecoder& operator=(const MjpgDecoder&);
+
+		bool InitializeLocked();
+
+		std::mutex m_lock;
+		IWICImagingFactory* m_factory;
+		void* m_mtaUsage; // CO_MTA_USAGE_COOKIE
+		std::vector<uint8_t> m_jpeg; // frame with inserted Huffman tables
+		std::vector<uint8_t> m_pixels; // decoded frame, only used when mirroring
+	};
+}
+}
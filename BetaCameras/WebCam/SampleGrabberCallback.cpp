@@ -0,0 +1,58 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "SampleGrabberCallback.h"
+
+using namespace MetriCam2::Cameras;
+
+SampleGrabberCallback::SampleGrabberCallback(FrameRing* ring)
+	: m_refCount(1), m_ring(ring)
+{
+}
+
+STDMETHODIMP SampleGrabberCallback::QueryInterface(REFIID riid, void** ppv)
+{
+	if (NULL == ppv)
+	{
+		return E_POINTER;
+	}
+	if (riid == IID_IUnknown || riid == IID_ISampleGrabberCB)
+	{
+		*ppv = static_cast<ISampleGrabberCB*>(this);
+		AddRef();
+		return S_OK;
+	}
+	*ppv = NULL;
+	return E_NOINTERFACE;
+}
+
+STDMETHODIMP_(ULONG) SampleGrabberCallback::AddRef()
+{
+	return InterlockedIncrement(&m_refCount);
+}
+
+STDMETHODIMP_(ULONG) SampleGrabberCallback::Release()
+{
+	ULONG refCount = InterlockedDecrement(&m_refCount);
+	if (0 == refCount)
+	{
+		delete this;
+	}
+	return refCount;
+}
+
+STDMETHODIMP SampleGrabberCallback::SampleCB(double sampleTime, IMediaSample* pSample)
+{
+	// we register for BufferCB only
+	return E_NOTIMPL;
+}
+
+STDMETHODIMP SampleGrabberCallback::BufferCB(double sampleTime, BYTE* pBuffer, long bufferLen)
+{
+	if (NULL == pBuffer || bufferLen <= 0)
+	{
+		return S_OK;
+	}
+	m_ring->Push(pBuffer, (size_t)bufferLen, sampleTime);
+	return S_OK;
+}
@@ -0,0 +1,39 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include <Dshow.h>
+#include "MetriQEdit.h"
+#include "FrameRing.h"
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	/*
+	 * Receives every sample of a running filter graph (ISampleGrabber::SetCallback, BufferCB) and
+	 * copies it into a FrameRing. Runs on the DirectShow streaming thread.
+	 *
+	 * Reference counted COM object: create with new, release with Release().
+	 */
+	class SampleGrabberCallback : public ISampleGrabberCB
+	{
+	public:
+		explicit SampleGrabberCallback(FrameRing* ring);
+
+		STDMETHODIMP QueryInterface(REFIID riid, void** ppv);
+		STDMETHODIMP_(ULONG) AddRef();
+		STDMETHODIMP_(ULONG) Release();
+
+		STDMETHODIMP SampleCB(double sampleTime, IMediaSample* pSample);
+		STDMETHODIMP BufferCB(double sampleTime, BYTE* pBuffer, long bufferLen);
+
+	private:
+		virtual ~SampleGrabberCallback() {}
+
+		volatile LONG m_refCount;
+		FrameRing* m_ring;
+	};
+}
+}
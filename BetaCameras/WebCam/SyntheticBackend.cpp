@@ -0,0 +1,129 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "SyntheticBackend.h"
+#include "CaptureCore.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace MetriCam2::Cameras;
+
+struct SyntheticBackend::Impl
+{
+	std::thread thread;
+	std::atomic<bool> running;
+	CaptureFormat format;
+	float frameRate;
+	FrameRing* ring;
+
+	void Run()
+	{
+		std::vector<unsigned char> frame(format.frameSize);
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		const std::chrono::duration<double> frameInterval(frameRate > 0 ? 1.0 / frameRate : 0.0);
+		for (uint64_t sequence = 0; running; sequence++)
+		{
+			if (frameRate > 0)
+			{
+				std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(frameInterval * (double)sequence));
+			}
+			Render(format, sequence, frame.data());
+			double sampleTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			ring->Push(frame.data(), frame.size(), sampleTime);
+		}
+	}
+};
+
+SyntheticBackend::SyntheticBackend()
+	: m_impl(new Impl())
+{
+	m_impl->running = false;
+}
+
+SyntheticBackend::~SyntheticBackend()
+{
+	Stop();
+	delete m_impl;
+}
+
+bool SyntheticBackend::Start(const CaptureRequest& request, FrameRing* ring, CaptureFormat& format)
+{
+	Stop();
+
+	FrameFormat frameFormat = request.format;
+	if (FrameFormatRgb24 != frameFormat && FrameFormatNv12 != frameFormat)
+	{
+		frameFormat = FrameFormatYuy2;
+	}
+	int width = (request.width > 0) ? request.width : DefaultWidth;
+	int height = (request.height > 0) ? request.height : DefaultHeight;
+	// 4:2:x chroma needs even sizes
+	width = (width + 1) & ~1;
+	height = (height + 1) & ~1;
+
+	format = CaptureCore::DescribeFormat(frameFormat, width, height, false, 0);
+	m_impl->format = format;
+	m_impl->frameRate = request.frameRate;
+	m_impl->ring = ring;
+	m_impl->running = true;
+	m_impl->thread = std::thread(&Impl::Run, m_impl);
+	return true;
+}
+
+void SyntheticBackend::Stop()
+{
+	m_impl->running = false;
+	if (m_impl->thread.joinable())
+	{
+		m_impl->thread.join();
+	}
+}
+
+void SyntheticBackend::Render(const CaptureFormat& format, uint64_t sequence, unsigned char* frame)
+{
+	// diagonal ramps which move by one pixel per frame
+	const int offset = (int)(sequence % 256);
+	for (int y = 0; y < format.height; y++)
+	{
+		unsigned char* row = frame + (size_t)y * format.stride;
+		switch (format.format)
+		{
+		case FrameFormatRgb24:
+			for (int x = 0; x < format.width; x++)
+			{
+				row[3 * x + 0] = (unsigned char)(x + offset);
+				row[3 * x + 1] = (unsigned char)(y + offset);
+				row[3 * x + 2] = (unsigned char)(x + y);
+			}
+			break;
+		case FrameFormatYuy2:
+			for (int x = 0; x + 1 < format.width; x += 2)
+			{
+				row[2 * x + 0] = (unsigned char)(x + y + offset);
+				row[2 * x + 1] = (unsigned char)(x + offset);
+				row[2 * x + 2] = (unsigned char)(x + y + offset + 1);
+				row[2 * x + 3] = (unsigned char)(y + offset);
+			}
+			break;
+		case FrameFormatNv12:
+			for (int x = 0; x < format.width; x++)
+			{
+				row[x] = (unsigned char)(x + y + offset);
+			}
+			if (0 == (y & 1))
+			{
+				unsigned char* uv = frame + (size_t)format.height * format.stride + (size_t)(y / 2) * format.stride;
+				for (int x = 0; x + 1 < format.width; x += 2)
+				{
+					uv[x + 0] = (unsigned char)(x + offset);
+					uv[x + 1] = (unsigned char)(y + offset);
+				}
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
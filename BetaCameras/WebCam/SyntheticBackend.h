@@ -0,0 +1,43 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include "CaptureBackend.h"
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	/*
+	 * Generates a deterministic moving test pattern in RGB24, YUY2 or NV12 (MJPG requests get YUY2).
+	 *
+	 * Frame n only depends on n and the format, so runs are reproducible. With a frame rate of 0 frames are
+	 * produced as fast as possible, which measures the throughput of the ring and the conversion alone.
+	 */
+	class SyntheticBackend : public CaptureBackend
+	{
+	public:
+		static const int DefaultWidth = 640;
+		static const int DefaultHeight = 480;
+
+		SyntheticBackend();
+		virtual ~SyntheticBackend();
+
+		virtual bool Start(const CaptureRequest& request, FrameRing* ring, CaptureFormat& format);
+		virtual void Stop();
+
+		/*
+		 * Writes frame number sequence of the given format into frame (format.frameSize bytes).
+		 */
+		static void Render(const CaptureFormat& format, uint64_t sequence, unsigned char* frame);
+
+	private:
+		SyntheticBackend(const SyntheticBackend&);
+		SyntheticBackend& operator=(const SyntheticBackend&);
+
+		struct Impl;
+		Impl* m_impl;
+	};
+}
+}
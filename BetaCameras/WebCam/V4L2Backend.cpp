@@ -0,0 +1,312 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#ifdef __linux__
+
+#include "V4L2Backend.h"
+#include "CaptureCore.h"
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <string.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace MetriCam2::Cameras;
+
+namespace
+{
+	const int PollTimeout = 100; // ms, bounds the time Stop waits for the capture thread
+
+	int Ioctl(int fd, unsigned long request, void* arg)
+	{
+		int result;
+		do
+		{
+			result = ioctl(fd, request, arg);
+		} while (result < 0 && EINTR == errno);
+		return result;
+	}
+
+	uint32_t ToPixelFormat(FrameFormat format)
+	{
+		switch (format)
+		{
+		case FrameFormatRgb24:
+			return V4L2_PIX_FMT_BGR24;
+		case FrameFormatYuy2:
+			return V4L2_PIX_FMT_YUYV;
+		case FrameFormatNv12:
+			return V4L2_PIX_FMT_NV12;
+		case FrameFormatMjpg:
+			return V4L2_PIX_FMT_MJPEG;
+		default:
+			return 0;
+		}
+	}
+}
+
+struct V4L2Backend::Impl
+{
+	struct Buffer
+	{
+		void* start;
+		size_t length;
+	};
+
+	std::string devicePath;
+	int fd;
+	std::vector<Buffer> buffers;
+	std::thread thread;
+	std::atomic<bool> running;
+	FrameRing* ring;
+
+	bool SetFormat(const CaptureRequest& request, CaptureFormat& format);
+	bool MapBuffers();
+	void UnmapBuffers();
+	void Close();
+	void Run();
+};
+
+bool V4L2Backend::Impl::SetFormat(const CaptureRequest& request, CaptureFormat& format)
+{
+	std::vector<FrameFormat> candidates;
+	if (FrameFormatUnknown != request.format)
+	{
+		candidates.push_back(request.format);
+	}
+	else
+	{
+		candidates.push_back(FrameFormatYuy2);
+		candidates.push_back(FrameFormatNv12);
+		candidates.push_back(FrameFormatRgb24);
+	}
+
+	for (size_t i = 0; i < candidates.size(); i++)
+	{
+		v4l2_format fmt;
+		memset(&fmt, 0, sizeof(fmt));
+		fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if (Ioctl(fd, VIDIOC_G_FMT, &fmt) < 0)
+		{
+			return false;
+		}
+		if (request.width > 0 && request.height > 0)
+		{
+			fmt.fmt.pix.width = request.width;
+			fmt.fmt.pix.height = request.height;
+		}
+		fmt.fmt.pix.pixelformat = ToPixelFormat(candidates[i]);
+		fmt.fmt.pix.field = V4L2_FIELD_NONE;
+		fmt.fmt.pix.bytesperline = 0;
+
+		// the driver adjusts the request to the closest mode it supports, possibly with another pixel format
+		if (Ioctl(fd, VIDIOC_S_FMT, &fmt) < 0 || fmt.fmt.pix.pixelformat != ToPixelFormat(candidates[i]))
+		{
+			continue;
+		}
+
+		format = CaptureCore::DescribeFormat(candidates[i], fmt.fmt.pix.width, fmt.fmt.pix.height, false, fmt.fmt.pix.sizeimage);
+		if (FrameFormatMjpg != candidates[i] && fmt.fmt.pix.bytesperline > 0)
+		{
+			// drivers may pad rows
+			format.stride = fmt.fmt.pix.bytesperline;
+			format.frameSize = (FrameFormatNv12 == candidates[i]) ? format.stride * format.height * 3 / 2 : format.stride * format.height;
+		}
+
+		if (request.frameRate > 0)
+		{
+			v4l2_streamparm parm;
+			memset(&parm, 0, sizeof(parm));
+			parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			parm.parm.capture.timeperframe.numerator = 1000;
+			parm.parm.capture.timeperframe.denominator = (uint32_t)(request.frameRate * 1000 + 0.5f);
+			Ioctl(fd, VIDIOC_S_PARM, &parm); // not all drivers support setting the frame rate
+		}
+		return true;
+	}
+	return false;
+}
+
+bool V4L2Backend::Impl::MapBuffers()
+{
+	v4l2_requestbuffers req;
+	memset(&req, 0, sizeof(req));
+	req.count = NumBuffers;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	if (Ioctl(fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2)
+	{
+		return false;
+	}
+
+	for (uint32_t i = 0; i < req.count; i++)
+	{
+		v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (Ioctl(fd, VIDIOC_QUERYBUF, &buf) < 0)
+		{
+			return false;
+		}
+
+		Buffer buffer;
+		buffer.length = buf.length;
+		buffer.start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+		if (MAP_FAILED == buffer.start)
+		{
+			return false;
+		}
+		buffers.push_back(buffer);
+
+		if (Ioctl(fd, VIDIOC_QBUF, &buf) < 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void V4L2Backend::Impl::UnmapBuffers()
+{
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		munmap(buffers[i].start, buffers[i].length);
+	}
+	buffers.clear();
+
+	v4l2_requestbuffers req;
+	memset(&req, 0, sizeof(req));
+	req.count = 0;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	Ioctl(fd, VIDIOC_REQBUFS, &req);
+}
+
+void V4L2Backend::Impl::Close()
+{
+	if (fd >= 0)
+	{
+		UnmapBuffers();
+		close(fd);
+		fd = -1;
+	}
+}
+
+void V4L2Backend::Impl::Run()
+{
+	while (running)
+	{
+		pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, PollTimeout) <= 0)
+		{
+			continue;
+		}
+
+		v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if (Ioctl(fd, VIDIOC_DQBUF, &buf) < 0)
+		{
+			if (EAGAIN == errno)
+			{
+				continue;
+			}
+			break; // device lost
+		}
+
+		if (0 == (buf.flags & V4L2_BUF_FLAG_ERROR) && buf.index < buffers.size())
+		{
+			double sampleTime = buf.timestamp.tv_sec + buf.timestamp.tv_usec * 1e-6;
+			ring->Push((const unsigned char*)buffers[buf.index].start, buf.bytesused, sampleTime);
+		}
+		Ioctl(fd, VIDIOC_QBUF, &buf);
+	}
+}
+
+V4L2Backend::V4L2Backend(const char* devicePath)
+	: m_impl(new Impl())
+{
+	m_impl->devicePath = devicePath;
+	m_impl->fd = -1;
+	m_impl->running = false;
+	m_impl->ring = NULL;
+}
+
+V4L2Backend::~V4L2Backend()
+{
+	Stop();
+	delete m_impl;
+}
+
+bool V4L2Backend::Start(const CaptureRequest& request, FrameRing* ring, CaptureFormat& format)
+{
+	Stop();
+
+	m_impl->fd = open(m_impl->devicePath.c_str(), O_RDWR | O_NONBLOCK);
+	if (m_impl->fd < 0)
+	{
+		return false;
+	}
+
+	v4l2_capability cap;
+	memset(&cap, 0, sizeof(cap));
+	if (Ioctl(m_impl->fd, VIDIOC_QUERYCAP, &cap) < 0)
+	{
+		m_impl->Close();
+		return false;
+	}
+	uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+	if (0 == (caps & V4L2_CAP_VIDEO_CAPTURE) || 0 == (caps & V4L2_CAP_STREAMING))
+	{
+		m_impl->Close();
+		return false;
+	}
+
+	if (!m_impl->SetFormat(request, format) || !m_impl->MapBuffers())
+	{
+		m_impl->Close();
+		return false;
+	}
+
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (Ioctl(m_impl->fd, VIDIOC_STREAMON, &type) < 0)
+	{
+		m_impl->Close();
+		return false;
+	}
+
+	m_impl->ring = ring;
+	m_impl->running = true;
+	m_impl->thread = std::thread(&Impl::Run, m_impl);
+	return true;
+}
+
+void V4L2Backend::Stop()
+{
+	m_impl->running = false;
+	if (m_impl->thread.joinable())
+	{
+		m_impl->thread.join();
+	}
+	if (m_impl->fd >= 0)
+	{
+		int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		Ioctl(m_impl->fd, VIDIOC_STREAMOFF, &type);
+		m_impl->Close();
+	}
+}
+
+#endif
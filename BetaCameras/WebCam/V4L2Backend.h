@@ -0,0 +1,39 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include "CaptureBackend.h"
+
+namespace MetriCam2
+{
+namespace Cameras
+{
+	/*
+	 * Video4Linux2 capture with memory-mapped streaming I/O (Linux only).
+	 *
+	 * The driver fills NumBuffers mmap'ed buffers; the capture thread copies each dequeued buffer into the ring and
+	 * queues it again right away, so the driver never runs out of buffers while a frame is being converted.
+	 * Auto format selection tries YUY2, NV12 and RGB24. MJPG is only used if requested explicitly, as there is no
+	 * JPEG decoder outside Windows.
+	 */
+	class V4L2Backend : public CaptureBackend
+	{
+	public:
+		static const int NumBuffers = 4;
+
+		explicit V4L2Backend(const char* devicePath);
+		virtual ~V4L2Backend();
+
+		virtual bool Start(const CaptureRequest& request, FrameRing* ring, CaptureFormat& format);
+		virtual void Stop();
+
+	private:
+		V4L2Backend(const V4L2Backend&);
+		V4L2Backend& operator=(const V4L2Backend&);
+
+		struct Impl;
+		Impl* m_impl;
+	};
+}
+}
@@ -344,7 +344,172 @@ bool WebCam::DirectShowRePrepareConnect(DirectShowPointers^ dsPointers, String^
     return false; 
 }
 
-ISampleGrabber* WebCam::DirectShowConnect(DirectShowPointers^ dsPointers)
+// Frees a media type returned by GetFormat or GetStreamCaps.
+static void FreeMediaType(AM_MEDIA_TYPE* pmt)
+{
+    if (pmt->cbFormat != 0)
+    {
+        CoTaskMemFree((PVOID)pmt->pbFormat);
+    }
+    if (pmt->pUnk != NULL)
+    {
+        pmt->pUnk->Release();
+    }
+    CoTaskMemFree((PVOID)pmt);
+}
+
+FrameFormat WebCam::ToFrameFormat(const GUID& subtype)
+{
+    if (subtype == MEDIASUBTYPE_RGB24)
+    {
+        return FrameFormatRgb24;
+    }
+    if (subtype == MEDIASUBTYPE_YUY2)
+    {
+        return FrameFormatYuy2;
+    }
+    if (subtype == MEDIASUBTYPE_NV12)
+    {
+        return FrameFormatNv12;
+    }
+    if (subtype == MEDIASUBTYPE_MJPG)
+    {
+        return FrameFormatMjpg;
+    }
+    return FrameFormatUnknown;
+}
+
+bool WebCam::ReadConnectedMediaType()
+{
+    AM_MEDIA_TYPE mt;
+    ZeroMemory(&mt, sizeof(mt));
+    if (directShowPointers->pGrabber->GetConnectedMediaType(&mt) < 0)
+    {
+        return false;
+    }
+
+    FrameFormat format = ToFrameFormat(mt.subtype);
+    bool valid = (FrameFormatUnknown != format) &&
+        (mt.formattype == FORMAT_VideoInfo) &&
+        (mt.cbFormat >= sizeof(VIDEOINFOHEADER)) &&
+        (mt.pbFormat != NULL);
+    if (valid)
+    {
+        VIDEOINFOHEADER *pVih = (VIDEOINFOHEADER*)mt.pbFormat;
+
+        this->nColumns = pVih->bmiHeader.biWidth;
+        this->nRows = Math::Abs(pVih->bmiHeader.biHeight);
+        this->nChannels = 3;
+        // biSizeImage is the maximum size of a compressed frame; only RGB DIBs with a positive height are bottom-up
+        captureCore->SetFormat(CaptureCore::DescribeFormat(format, nColumns, nRows, pVih->bmiHeader.biHeight > 0, (int)pVih->bmiHeader.biSizeImage));
+    }
+
+    if (mt.cbFormat != 0)
+    {
+        CoTaskMemFree((PVOID)mt.pbFormat);
+    }
+    if (mt.pUnk != NULL)
+    {
+        mt.pUnk->Release();
+    }
+    return valid;
+}
+
+GUID WebCam::NegotiateFormat(DirectShowPointers^ dsPointers, String^ videoFormat, int width, int height, float frameRate)
+{
+    IAMStreamConfig* pVSC = dsPointers->pVSC;
+    int count = 0;
+    int size = 0;
+    if (pVSC->GetNumberOfCapabilities(&count, &size) < 0 || size != sizeof(VIDEO_STREAM_CONFIG_CAPS))
+    {
+        log->Warn("Could not enumerate the video formats, using RGB24.");
+        return MEDIASUBTYPE_RGB24;
+    }
+
+    // without an explicit resolution, stay at the one the driver currently uses
+    AM_MEDIA_TYPE* pCurrent = NULL;
+    if ((width <= 0 || height <= 0) && pVSC->GetFormat(&pCurrent) >= 0)
+    {
+        if (pCurrent->formattype == FORMAT_VideoInfo && pCurrent->cbFormat >= sizeof(VIDEOINFOHEADER))
+        {
+            VIDEOINFOHEADER* pvi = (VIDEOINFOHEADER*)pCurrent->pbFormat;
+            width = (width > 0) ? width : pvi->bmiHeader.biWidth;
+            height = (height > 0) ? height : Math::Abs(pvi->bmiHeader.biHeight);
+        }
+        FreeMediaType(pCurrent);
+    }
+
+    // Auto prefers formats which are cheap to convert; MJPG is only used if nothing else has the requested mode
+    const FrameFormat preference[] = { FrameFormatYuy2, FrameFormatNv12, FrameFormatRgb24, FrameFormatMjpg };
+    const int numPreferences = sizeof(preference) / sizeof(preference[0]);
+    int bestIndex = -1;
+    int bestRank = numPreferences;
+    for (int i = 0; i < count; i++)
+    {
+        VIDEO_STREAM_CONFIG_CAPS scc;
+        AM_MEDIA_TYPE* pmt = NULL;
+        if (pVSC->GetStreamCaps(i, &pmt, (BYTE*)&scc) < 0)
+        {
+            continue;
+        }
+
+        FrameFormat format = ToFrameFormat(pmt->subtype);
+        bool candidate = format != FrameFormatUnknown
+            && pmt->formattype == FORMAT_VideoInfo
+            && pmt->cbFormat >= sizeof(VIDEOINFOHEADER);
+        if (candidate)
+        {
+            VIDEOINFOHEADER* pvi = (VIDEOINFOHEADER*)pmt->pbFormat;
+            candidate = pvi->bmiHeader.biWidth == width
+                && Math::Abs(pvi->bmiHeader.biHeight) == height
+                && (frameRate <= 0 || scc.MinFrameInterval <= (LONGLONG)(10000000 / frameRate) + 1)
+                && (videoFormat == VideoFormatAuto || videoFormat == VideoFormatName(format));
+        }
+        if (candidate)
+        {
+            int rank = 0;
+            while (rank < numPreferences && preference[rank] != format)
+            {
+                rank++;
+            }
+            if (rank < bestRank)
+            {
+                bestRank = rank;
+                bestIndex = i;
+            }
+        }
+        FreeMediaType(pmt);
+    }
+
+    if (bestIndex < 0)
+    {
+        log->WarnFormat("The camera does not offer {0} at {1}x{2}@{3} fps, using RGB24.", videoFormat, width, height, frameRate);
+        return MEDIASUBTYPE_RGB24;
+    }
+
+    VIDEO_STREAM_CONFIG_CAPS scc;
+    AM_MEDIA_TYPE* pmt = NULL;
+    GUID subtype = MEDIASUBTYPE_RGB24;
+    if (pVSC->GetStreamCaps(bestIndex, &pmt, (BYTE*)&scc) >= 0)
+    {
+        if (frameRate > 0)
+        {
+            ((VIDEOINFOHEADER*)pmt->pbFormat)->AvgTimePerFrame = (LONGLONG)(10000000 / frameRate);
+        }
+        if (pVSC->SetFormat(pmt) >= 0)
+        {
+            subtype = pmt->subtype;
+        }
+        else
+        {
+            log->Warn("Setting the video format failed, using RGB24.");
+        }
+        FreeMediaType(pmt);
+    }
+    return subtype;
+}
+
+ISampleGrabber* WebCam::DirectShowConnect(DirectShowPointers^ dsPointers, ISampleGrabberCB* callback, const GUID& subtype)
 {
     HRESULT hr;
     //For the connected WebCam
@@ -387,34 +552,47 @@ ISampleGrabber* WebCam::DirectShowConnect(DirectShowPointers^ dsPointers)
     AM_MEDIA_TYPE mt;
     ZeroMemory(&mt, sizeof(mt));
     mt.majortype = MEDIATYPE_Video;
-    mt.subtype = MEDIASUBTYPE_RGB24;
+    mt.subtype = subtype;
 
-    hr = ((ISampleGrabber*)ppGrabber)->SetMediaType(&mt);
-    if (hr < 0)
+    // If the grabber cannot take the native format, fall back to RGB24 and let DirectShow insert a decoder.
+    for (int attempt = 0; attempt < 2; attempt++)
     {
-        DirectShowDisconnect(dsPointers, nullptr); 
-        return NULL;
-    }
+        hr = ((ISampleGrabber*)ppGrabber)->SetMediaType(&mt);
+        if (hr < 0)
+        {
+            DirectShowDisconnect(dsPointers, nullptr); 
+            return NULL;
+        }
 
-    hr = ((IBaseFilter*)ppSrcFilter)->EnumPins((IEnumPins**)(&ppEnum));
-    if (hr < 0)
-    {
-        DirectShowDisconnect(dsPointers, nullptr); 
-        return NULL;
-    }
+        hr = ((IBaseFilter*)ppSrcFilter)->EnumPins((IEnumPins**)(&ppEnum));
+        if (hr < 0)
+        {
+            DirectShowDisconnect(dsPointers, nullptr); 
+            return NULL;
+        }
 
-    while (S_OK == ((IEnumPins*)ppEnum)->Next(1, (IPin**)(&ppPin), NULL))
-    {
-        hr = ConnectFilters((IGraphBuilder*)ppGraph, (IPin*)ppPin, (IBaseFilter*)ppGrabberF);
-        if (ppPin)
+        while (S_OK == ((IEnumPins*)ppEnum)->Next(1, (IPin**)(&ppPin), NULL))
         {
-            ((IPin*)ppPin)->Release(); 
-            dsPointers->pPin=NULL;
+            hr = ConnectFilters((IGraphBuilder*)ppGraph, (IPin*)ppPin, (IBaseFilter*)ppGrabberF);
+            if (ppPin)
+            {
+                ((IPin*)ppPin)->Release(); 
+                dsPointers->pPin=NULL;
+            }
+            if (hr >= 0)
+            {
+                break;
+            }
         }
-        if (hr >= 0)
+
+        if (hr >= 0 || mt.subtype == MEDIASUBTYPE_RGB24)
         {
             break;
         }
+        log->Warn("Could not connect the sample grabber with the native format, using RGB24.");
+        ((IEnumPins*)ppEnum)->Release();
+        ppEnum = nullptr;
+        mt.subtype = MEDIASUBTYPE_RGB24;
     }
 
     if (hr < 0)
@@ -445,20 +623,32 @@ ISampleGrabber* WebCam::DirectShowConnect(DirectShowPointers^ dsPointers)
         return NULL;
     }
 
-    hr = ((ISampleGrabber*)ppGrabber)->SetOneShot(TRUE);
+    // With a callback the graph keeps running and every sample is handed to BufferCB,
+    // otherwise it stops after each sample, which is then fetched with GetCurrentBuffer.
+    hr = ((ISampleGrabber*)ppGrabber)->SetOneShot(NULL == callback);
     if (hr < 0)
     {
         DirectShowDisconnect(dsPointers, nullptr); 
         return NULL;
     }
 
-    hr = ((ISampleGrabber*)ppGrabber)->SetBufferSamples(TRUE);
+    hr = ((ISampleGrabber*)ppGrabber)->SetBufferSamples(NULL == callback);
     if (hr < 0)
     {
         DirectShowDisconnect(dsPointers, nullptr); 
         return NULL;
     }
 
+    if (NULL != callback)
+    {
+        hr = ((ISampleGrabber*)ppGrabber)->SetCallback(callback, 1); // 1: BufferCB
+        if (hr < 0)
+        {
+            DirectShowDisconnect(dsPointers, nullptr); 
+            return NULL;
+        }
+    }
+
     hr = ((IMediaControl*)ppControl)->Run();
     if (hr < 0)
     {
@@ -4,6 +4,8 @@
 #pragma once
 
 #include "MetriQEdit.h"
+#include "CaptureCore.h"
+#include "SampleGrabberCallback.h"
 
 using namespace System;
 using namespace System::Collections::Generic;
@@ -72,7 +74,6 @@ namespace MetriCam2
 			String^ serialNumberToConnect;
 			String^ connectedSerialNumber;
 			int nPixels;
-			unsigned char* sourceData;
 			int activeChannel;
 			int nColumns;
 			int nRows;
@@ -81,10 +82,18 @@ namespace MetriCam2
 			int frameNumber;
 			long currentCbBuffer;
 			byte* pBuffer;
-			int stride;
-			//Buffer size
-			int bufferSize;
 			bool flipV;
+			// streaming mode: the graph keeps running and the grabber callback fills the ring of captureCore
+			bool streamingMode;
+			// frame ring, format and conversion; the current frame is in pBuffer or held in the ring
+			CaptureCore* captureCore;
+			SampleGrabberCallback* grabberCallback;
+			static const int FrameTimeout = 5000; // ms
+			// requested video mode, applied on connect
+			String^ videoFormat;
+			int frameWidth;
+			int frameHeight;
+			float frameRate;
 			static List<DirectShowPointers^>^ availableDSWebcams;
 			static List<String^>^ availableSerials;
 			static List<String^>^ serialsMarkedForConnect;
@@ -97,13 +106,35 @@ namespace MetriCam2
 			static HRESULT IsPinConnected(IPin *pPin, BOOL *pResult);
 			static HRESULT IsPinDirection(IPin *pPin, PIN_DIRECTION dir, BOOL *pResult);
 			static bool DirectShowRePrepareConnect(DirectShowPointers^ dsPointers, String^ serialToRePrepare);
-			static ISampleGrabber* DirectShowConnect(DirectShowPointers^ dsPointers);
+			static FrameFormat ToFrameFormat(const GUID& subtype);
+			bool ReadConnectedMediaType();
+			static GUID NegotiateFormat(DirectShowPointers^ dsPointers, String^ videoFormat, int width, int height, float frameRate);
+			static ISampleGrabber* DirectShowConnect(DirectShowPointers^ dsPointers, ISampleGrabberCB* callback, const GUID& subtype);
 			static void DirectShowDisconnect(DirectShowPointers^ dsPointers, String^ serialNumber);
 			static void DirectShowReleasePrepareConnect(DirectShowPointers^ dsPointers);
 			static Object^ serialsMarkedForConnectListLock;
 			DirectShowPointers^ GetDirectShowPointersForSerialNumber(String^ serialNumber);
 
+			static String^ VideoFormatName(FrameFormat format)
+			{
+				switch (format)
+				{
+				case FrameFormatRgb24:
+					return "RGB24";
+				case FrameFormatYuy2:
+					return "YUY2";
+				case FrameFormatNv12:
+					return "NV12";
+				case FrameFormatMjpg:
+					return "MJPG";
+				default:
+					return nullptr;
+				}
+			}
+
 		public:
+			literal String^ VideoFormatAuto = "Auto";
+
 			static WebCam(void)
 			{
 				availableDSWebcams = gcnew List<DirectShowPointers^>();
@@ -125,6 +156,13 @@ namespace MetriCam2
 				this->ActivateChannel(ChannelNames::Color);
 				this->serialNumberToConnect = nullptr;
 				this->mirrorImage = false;
+				this->streamingMode = false;
+				this->captureCore = NULL;
+				this->grabberCallback = NULL;
+				this->videoFormat = VideoFormatAuto;
+				this->frameWidth = 0;
+				this->frameHeight = 0;
+				this->frameRate = 0;
 			}
 
 			WebCam::~WebCam(void)
@@ -134,6 +172,8 @@ namespace MetriCam2
 					this->currentCbBuffer = 0;
 					CoTaskMemFree(this->pBuffer);
 				}
+				delete captureCore;
+				captureCore = NULL;
 			}
 
 #if !NETSTANDARD2_0
@@ -154,6 +194,62 @@ namespace MetriCam2
 				void set(bool value) { mirrorImage = value; }
 			}
 
+			/// <summary>
+			/// Keep the filter graph running and receive every frame through a sample grabber callback.
+			/// If false (default), the graph is run in one-shot mode for each <see cref="Update"/>, which reaches only a fraction of the camera's frame rate.
+			/// </summary>
+			property bool StreamingMode
+			{
+				bool get() { return streamingMode; }
+				void set(bool value) { streamingMode = value; }
+			}
+
+			/// <summary>
+			/// Pixel format requested from the camera: RGB24, YUY2, NV12 or MJPG.
+			/// Auto picks the cheapest format to convert which offers the requested resolution and frame rate.
+			/// If the camera does not support the request, RGB24 is used and DirectShow converts the frames.
+			/// </summary>
+			property String^ VideoFormat
+			{
+				String^ get() { return videoFormat; }
+				void set(String^ value) { videoFormat = value; }
+			}
+
+			/// <summary>
+			/// Pixel format of the frames actually delivered, known after the first <see cref="Update"/>.
+			/// </summary>
+			property String^ ActiveVideoFormat
+			{
+				String^ get() { return (NULL == captureCore) ? nullptr : VideoFormatName(captureCore->Format().format); }
+			}
+
+			/// <summary>
+			/// Requested frame width in pixels, 0 to keep the driver's current resolution.
+			/// </summary>
+			property int FrameWidth
+			{
+				int get() { return frameWidth; }
+				void set(int value) { frameWidth = value; }
+			}
+
+			/// <summary>
+			/// Requested frame height in pixels, 0 to keep the driver's current resolution.
+			/// </summary>
+			property int FrameHeight
+			{
+				int get() { return frameHeight; }
+				void set(int value) { frameHeight = value; }
+			}
+
+			/// <summary>
+			/// Requested frame rate, 0 for the driver's default.
+			/// </summary>
+			property float FrameRate
+			{
+				float get() { return frameRate; }
+				void set(float value) { frameRate = value; }
+			}
+
 			static array<String^, 1>^ ScanForCameras()
 			{
 				log->EnterMethod();
@@ -497,21 +593,72 @@ namespace MetriCam2
 					throw gcnew MetriCam2::Exceptions::ConnectionFailedException("WebCam: error_connectionFailed");
 				}
 
-				ISampleGrabber* dummy = DirectShowConnect(directShowPointers);
+				captureCore = new CaptureCore();
+				ISampleGrabberCB* callback = NULL;
+				if (streamingMode)
+				{
+					grabberCallback = new SampleGrabberCallback(&captureCore->Ring());
+					callback = grabberCallback;
+				}
+				GUID subtype = NegotiateFormat(directShowPointers, videoFormat, frameWidth, frameHeight, frameRate);
+				ISampleGrabber* grabber = DirectShowConnect(directShowPointers, callback, subtype);
 				connectedSerialNumber = gcnew String(serialNumberToConnect);
 				frameNumber = -1;
 				flipV = true;
+
+				if (NULL == grabber)
+				{
+					if (NULL != grabberCallback)
+					{
+						grabberCallback->Release();
+						grabberCallback = NULL;
+					}
+					delete captureCore;
+					captureCore = NULL;
+					this->directShowPointers = nullptr;
+					throw gcnew MetriCam2::Exceptions::ConnectionFailedException("WebCam: error_connectionFailed - could not build the filter graph.");
+				}
+				if (!ReadConnectedMediaType())
+				{
+					DisconnectImpl();
+					throw gcnew MetriCam2::Exceptions::ConnectionFailedException("WebCam: error_connectionFailed - unsupported media type.");
+				}
+				if (!streamingMode)
+				{
+					// one-shot mode: GetCurrentBuffer copies each frame into this buffer
+					int frameSize = captureCore->Format().frameSize;
+					CoTaskMemFree(this->pBuffer);
+					this->currentCbBuffer = frameSize;
+					this->pBuffer = (BYTE*)CoTaskMemAlloc(frameSize);
+					if (!this->pBuffer)
+					{
+						this->currentCbBuffer = 0;
+						DisconnectImpl();
+						throw gcnew OutOfMemoryException("error_outOfMemoryBitmapBuffer");
+					}
+				}
 			}
 
 			virtual void DisconnectImpl() override
 			{
 				if (directShowPointers->IsConnected)
 				{
+					if (NULL != grabberCallback)
+					{
+						// Stop waits for the streaming thread, so the callback is not called afterwards
+						directShowPointers->pControl->Stop();
+						directShowPointers->pGrabber->SetCallback(NULL, 1);
+					}
+					captureCore->Stop();
 					DirectShowDisconnect(directShowPointers, this->connectedSerialNumber);
+					if (NULL != grabberCallback)
+					{
+						grabberCallback->Release();
+						grabberCallback = NULL;
+					}
+					delete captureCore;
+					captureCore = NULL;
 					this->directShowPointers = nullptr;
-					delete[] sourceData;
-					sourceData = NULL;
-					this->bufferSize = 0;
 				}
 			}
 
@@ -523,91 +670,57 @@ namespace MetriCam2
 				}
 
 				HRESULT hr;
-				long evCode;
-				pin_ptr<IMediaEventEx> ppEvent = directShowPointers->pEvent;
-				hr = ((IMediaEventEx*)ppEvent)->WaitForCompletion(INFINITE, &evCode);
-
-				// Find the required buffer size.
-				long cbBuffer;
 				pin_ptr<ISampleGrabber> ppGrabber = directShowPointers->pGrabber;
+				long cbBuffer;
 
-				if (((ISampleGrabber*)ppGrabber)->GetCurrentBuffer(&cbBuffer, NULL) < 0)
-				{
-					return;
-				}
-
-				// If buffer size changed, allocate new buffer
-				if (currentCbBuffer != cbBuffer)
+				if (streamingMode)
 				{
-					this->currentCbBuffer = cbBuffer;
-					CoTaskMemFree(this->pBuffer);
-					this->pBuffer = (BYTE*)CoTaskMemAlloc(cbBuffer);
-					if (!this->pBuffer)
+					// the frame stays in the ring until the next Update, so it is not copied again
+					if (!captureCore->Acquire(FrameTimeout))
 					{
-						hr = E_OUTOFMEMORY;
-						throw gcnew OutOfMemoryException("error_outOfMemoryBitmapBuffer");
+						throw gcnew MetriCam2::Exceptions::ImageAcquisitionFailedException(String::Format("WebCam: no frame received within {0} ms.", FrameTimeout));
 					}
 				}
-
-				if (((ISampleGrabber*)ppGrabber)->GetCurrentBuffer(&cbBuffer, (long*)pBuffer) < 0)
-				{
-					return;
-				}
-
-				AM_MEDIA_TYPE mt;
-				ZeroMemory(&mt, sizeof(mt));
-				mt.majortype = MEDIATYPE_Video;
-				mt.subtype = MEDIASUBTYPE_RGB24;
-
-				if (((ISampleGrabber*)ppGrabber)->GetConnectedMediaType(&mt) < 0)
-				{
-					return;
-				}
-
-				// Examine the format block.
-				if ((mt.formattype == FORMAT_VideoInfo) &&
-					(mt.cbFormat >= sizeof(VIDEOINFOHEADER)) &&
-					(mt.pbFormat != NULL))
+				else
 				{
-					VIDEOINFOHEADER *pVih = (VIDEOINFOHEADER*)mt.pbFormat;
-
-					this->nColumns = pVih->bmiHeader.biWidth;
-					this->nRows = pVih->bmiHeader.biHeight;
-					this->nChannels = pVih->bmiHeader.biBitCount / 8;
-					this->stride = 3 * this->nColumns;
-					int newBufferSize = this->stride * this->nRows;
+					long evCode;
+					pin_ptr<IMediaEventEx> ppEvent = directShowPointers->pEvent;
+					hr = ((IMediaEventEx*)ppEvent)->WaitForCompletion(INFINITE, &evCode);
 
-					frameNumber++;
-					if (bufferSize != newBufferSize)
+					cbBuffer = currentCbBuffer;
+					hr = ((ISampleGrabber*)ppGrabber)->GetCurrentBuffer(&cbBuffer, (long*)pBuffer);
+					if (E_OUTOFMEMORY == hr)
 					{
-						this->bufferSize = newBufferSize;
-						if (sourceData != NULL)
+						// a compressed frame larger than announced: grow the buffer and fetch again
+						if (((ISampleGrabber*)ppGrabber)->GetCurrentBuffer(&cbBuffer, NULL) < 0)
+						{
+							return;
+						}
+						this->currentCbBuffer = cbBuffer;
+						CoTaskMemFree(this->pBuffer);
+						this->pBuffer = (BYTE*)CoTaskMemAlloc(cbBuffer);
+						if (!this->pBuffer)
 						{
-							delete[] sourceData;
+							this->currentCbBuffer = 0;
+							throw gcnew OutOfMemoryException("error_outOfMemoryBitmapBuffer");
 						}
-						sourceData = new unsigned char[this->bufferSize];
+						hr = ((ISampleGrabber*)ppGrabber)->GetCurrentBuffer(&cbBuffer, (long*)pBuffer);
 					}
-					memcpy(sourceData, (unsigned char*)pBuffer, Math::Min(cbBuffer, bufferSize) * sizeof(unsigned char));
-				}
-				else
-				{
-					// Invalid format.
-					hr = VFW_E_INVALIDMEDIATYPE;
-				}
-
-				if (mt.cbFormat != 0)
-				{
-					CoTaskMemFree((PVOID)mt.pbFormat);
-					mt.cbFormat = 0;
-					mt.pbFormat = NULL;
+					if (hr < 0)
+					{
+						return;
+					}
+					captureCore->SetFrame(pBuffer, cbBuffer);
 				}
 
-				if (mt.pUnk != NULL)
+				if (!captureCore->IsComplete())
 				{
-					// pUnk should not be used.
-					mt.pUnk->Release();
-					mt.pUnk = NULL;
+					throw gcnew MetriCam2::Exceptions::ImageAcquisitionFailedException(String::Format("WebCam: incomplete frame ({0} of {1} bytes).", (int)captureCore->CurrentFrame().size, captureCore->Format().frameSize));
 				}
+				// In streaming mode the frame arrived before Update. FrameRing::HostTime and Stopwatch both read QueryPerformanceCounter,
+				// so the frames of all cameras are stamped on the common clock of TimeStamp.
+				SetFrameArrival((long long)(captureCore->CurrentFrame().hostTime * System::Diagnostics::Stopwatch::Frequency));
+				frameNumber++;
 			}
 
 			virtual void LoadAllAvailableChannels() override
@@ -626,32 +739,18 @@ namespace MetriCam2
 				}
 
 				Bitmap^ bmp = gcnew Bitmap(this->nColumns, this->nRows, System::Drawing::Imaging::PixelFormat::Format24bppRgb);
-				Bitmap^ bmpNew = gcnew Bitmap(this->nColumns, this->nRows, System::Drawing::Imaging::PixelFormat::Format24bppRgb);
-				Graphics^ graphics = Graphics::FromImage(bmpNew);
-				graphics->DrawImage(bmp, Point(0, 0));
-				delete graphics;
-				delete bmp;
-
-				BitmapData^ bData = bmpNew->LockBits(System::Drawing::Rectangle(System::Drawing::Point(0, 0), bmpNew->Size), System::Drawing::Imaging::ImageLockMode::WriteOnly, bmpNew->PixelFormat);
+				BitmapData^ bData = bmp->LockBits(System::Drawing::Rectangle(System::Drawing::Point(0, 0), bmp->Size), System::Drawing::Imaging::ImageLockMode::WriteOnly, bmp->PixelFormat);
 
-				if (bData->Stride != this->stride)
-				{
-					throw gcnew Exception("error_strideMatch");
-				}
+				bool converted = captureCore->Convert((uint8_t*)bData->Scan0.ToPointer(), bData->Stride, mirrorImage);
 
-				memcpy((void*)bData->Scan0, this->sourceData, this->stride * this->nRows);
+				bmp->UnlockBits(bData);
 
-				bmpNew->UnlockBits(bData);
-				if (mirrorImage)
+				if (!converted)
 				{
-					bmpNew->RotateFlip(RotateFlipType::RotateNoneFlipXY);
-				}
-				else
-				{
-					bmpNew->RotateFlip(RotateFlipType::RotateNoneFlipY);
+					throw gcnew MetriCam2::Exceptions::ImageAcquisitionFailedException("WebCam: could not convert frame.");
 				}
 
-				return gcnew ColorImage(bmpNew);
+				return gcnew ColorImage(bmp);
 			}
 
 		private:
@@ -674,6 +773,76 @@ namespace MetriCam2
 				return availableCameras;
 			}
 
+			property ParamDesc<bool>^ StreamingModeDesc
+			{
+				inline ParamDesc<bool>^ get()
+				{
+					ParamDesc<bool>^ res = gcnew ParamDesc<bool>();
+					res->Unit = "";
+					res->Description = "Stream continuously instead of one-shot capture.";
+					res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+					res->WritableWhen = ParamDesc::ConnectionStates::Disconnected;
+					return res;
+				}
+			}
+
+			property ParamDesc<String^>^ VideoFormatDesc
+			{
+				inline ParamDesc<String^>^ get()
+				{
+					List<String^>^ allowedValues = gcnew List<String^>();
+					allowedValues->Add(VideoFormatAuto);
+					allowedValues->Add(VideoFormatName(FrameFormatRgb24));
+					allowedValues->Add(VideoFormatName(FrameFormatYuy2));
+					allowedValues->Add(VideoFormatName(FrameFormatNv12));
+					allowedValues->Add(VideoFormatName(FrameFormatMjpg));
+					ParamDesc<String^>^ res = ParamDesc::BuildListParamDesc(allowedValues);
+					res->Description = "Pixel format requested from the camera.";
+					res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+					res->WritableWhen = ParamDesc::ConnectionStates::Disconnected;
+					return res;
+				}
+			}
+
+			property ParamDesc<int>^ FrameWidthDesc
+			{
+				inline ParamDesc<int>^ get()
+				{
+					ParamDesc<int>^ res = ParamDesc::BuildRangeParamDesc(0, 8192);
+					res->Unit = "px";
+					res->Description = "Requested frame width (0: driver default).";
+					res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+					res->WritableWhen = ParamDesc::ConnectionStates::Disconnected;
+					return res;
+				}
+			}
+
+			property ParamDesc<int>^ FrameHeightDesc
+			{
+				inline ParamDesc<int>^ get()
+				{
+					ParamDesc<int>^ res = ParamDesc::BuildRangeParamDesc(0, 8192);
+					res->Unit = "px";
+					res->Description = "Requested frame height (0: driver default).";
+					res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+					res->WritableWhen = ParamDesc::ConnectionStates::Disconnected;
+					return res;
+				}
+			}
+
+			property ParamDesc<float>^ FrameRateDesc
+			{
+				inline ParamDesc<float>^ get()
+				{
+					ParamDesc<float>^ res = ParamDesc::BuildRangeParamDesc(0.0f, 1000.0f);
+					res->Unit = "fps";
+					res->Description = "Requested frame rate (0: driver default).";
+					res->ReadableWhen = ParamDesc::ConnectionStates::Connected | ParamDesc::ConnectionStates::Disconnected;
+					res->WritableWhen = ParamDesc::ConnectionStates::Disconnected;
+					return res;
+				}
+			}
+
 			property ParamDesc<bool>^ MirrorImageDesc
 			{
 				inline ParamDesc<bool>^ get()
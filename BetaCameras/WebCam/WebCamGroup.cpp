@@ -0,0 +1,61 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "stdafx.h"
+
+#include "WebCamGroup.h"
+
+using namespace MetriCam2::Cameras;
+using namespace System::Threading::Tasks;
+
+WebCamGroup::WebCamGroup()
+{
+	cameras = gcnew List<WebCam^>();
+}
+
+void WebCamGroup::ConnectAll()
+{
+	for (int i = 0; i < cameras->Count; i++)
+	{
+		try
+		{
+			cameras[i]->Connect();
+		}
+		catch (Exception^)
+		{
+			for (int j = 0; j < i; j++)
+			{
+				cameras[j]->Disconnect();
+			}
+			throw;
+		}
+	}
+}
+
+void WebCamGroup::DisconnectAll()
+{
+	for each (WebCam^ cam in cameras)
+	{
+		if (cam->IsConnected)
+		{
+			cam->Disconnect();
+		}
+	}
+}
+
+array<ColorImage^>^ WebCamGroup::UpdateAll()
+{
+	array<ColorImage^>^ images = gcnew array<ColorImage^>(cameras->Count);
+
+	// The rings fill concurrently: while waiting for one camera, the frames of the others keep arriving,
+	// so their Update returns right away.
+	for each (WebCam^ cam in cameras)
+	{
+		cam->Update();
+	}
+
+	// Conversion only touches the frame held by each camera, so it runs in parallel.
+	Parallel::For(0, cameras->Count, gcnew Action<int>(gcnew FrameConverter(cameras, images), &FrameConverter::Convert));
+
+	return images;
+}
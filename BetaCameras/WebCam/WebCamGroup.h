@@ -0,0 +1,75 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#pragma once
+
+#include "WebCam.h"
+
+using namespace System;
+using namespace System::Collections::Generic;
+using namespace Metrilus::Util;
+
+namespace MetriCam2
+{
+	namespace Cameras
+	{
+		/// <summary>
+		/// Captures from several webcams at once.
+		/// </summary>
+		/// <remarks>
+		/// In streaming mode (see <see cref="WebCam::StreamingMode"/>) each camera fills its own frame ring from its own DirectShow streaming thread,
+		/// so <see cref="UpdateAll"/> waits as long as the slowest camera instead of the sum of all cameras.
+		/// Cameras in one-shot mode are still captured one after the other.
+		/// </remarks>
+		public ref class WebCamGroup
+		{
+		public:
+			WebCamGroup();
+
+			/// <summary>
+			/// Cameras of the group. Configure them (e.g. <see cref="Camera::SerialNumber"/>) before <see cref="ConnectAll"/>.
+			/// </summary>
+			property List<WebCam^>^ Cameras
+			{
+				List<WebCam^>^ get() { return cameras; }
+			}
+
+			/// <summary>
+			/// Connects all cameras. If one fails, the cameras connected so far are disconnected again.
+			/// </summary>
+			void ConnectAll();
+
+			void DisconnectAll();
+
+			/// <summary>
+			/// Updates all cameras and returns the newest Color image of each, in the order of <see cref="Cameras"/>.
+			/// </summary>
+			/// <remarks>
+			/// The TimeStamp of each image is the arrival of its frame on the host, on the clock shared by all cameras.
+			/// </remarks>
+			/// <exception cref="AggregateException">If the conversion of a frame failed.</exception>
+			array<ColorImage^>^ UpdateAll();
+
+		private:
+			// converts the frames of one UpdateAll into its own array, so that UpdateAll keeps no state between calls
+			ref class FrameConverter
+			{
+			public:
+				FrameConverter(List<WebCam^>^ cameras, array<ColorImage^>^ images)
+					: cameras(cameras), images(images)
+				{ }
+
+				void Convert(int index)
+				{
+					images[index] = (ColorImage^)cameras[index]->CalcChannel(ChannelNames::Color);
+				}
+
+			private:
+				List<WebCam^>^ cameras;
+				array<ColorImage^>^ images;
+			};
+
+			List<WebCam^>^ cameras;
+		};
+	}
+}
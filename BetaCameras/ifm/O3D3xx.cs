@@ -1032,7 +1032,7 @@ namespace MetriCam2.Cameras
 
         private FloatImage CalcAmplidueImge()
         {
-            FloatImage amplitudeImage = new FloatImage(_width, _height);
+            FloatImage amplitudeImage = ImagePool.RentFloatImage(_width, _height);
 
             using (MemoryStream stream = new MemoryStream(_frontBuffer))
             using (BinaryReader reader = new BinaryReader(stream))
@@ -1052,7 +1052,7 @@ namespace MetriCam2.Cameras
 
         private FloatImage CalcDistanceImage()
         {
-            FloatImage distanceImage = new FloatImage(_width, _height);
+            FloatImage distanceImage = ImagePool.RentFloatImage(_width, _height);
 
             using (MemoryStream stream = new MemoryStream(_frontBuffer))
             using (BinaryReader reader = new BinaryReader(stream))
@@ -1072,10 +1072,10 @@ namespace MetriCam2.Cameras
 
         private Point3fImage CalcPoint3fImage()
         {
-            Point3fImage point3fImage = new Point3fImage(_width, _height);
-            FloatImage xImage = new FloatImage(_width, _height);
-            FloatImage yImage = new FloatImage(_width, _height);
-            FloatImage zImage = new FloatImage(_width, _height);
+            Point3fImage point3fImage = ImagePool.RentPoint3fImage(_width, _height);
+            FloatImage xImage = ImagePool.RentFloatImage(_width, _height);
+            FloatImage yImage = ImagePool.RentFloatImage(_width, _height);
+            FloatImage zImage = ImagePool.RentFloatImage(_width, _height);
 
             using (MemoryStream stream = new MemoryStream(_frontBuffer))
             using (BinaryReader reader = new BinaryReader(stream))
@@ -1115,13 +1115,16 @@ namespace MetriCam2.Cameras
                     point3fImage[y, x] = new Point3f(xImage[y, x], yImage[y, x], zImage[y, x]);
                 }
             }
+            ImagePool.Return(xImage);
+            ImagePool.Return(yImage);
+            ImagePool.Return(zImage);
 
             return point3fImage;
         }
 
         private FloatImage CalcZImage()
         {
-            FloatImage zImage = new FloatImage(_width, _height);
+            FloatImage zImage = ImagePool.RentFloatImage(_width, _height);
 
             using (MemoryStream stream = new MemoryStream(_frontBuffer))
             using (BinaryReader reader = new BinaryReader(stream))
@@ -13,7 +13,10 @@ using System.Diagnostics;
 using System.Globalization;
 using System.IO;
 using System.Reflection;
+using System.Runtime.CompilerServices;
 using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
 
 namespace MetriCam2
 {
@@ -915,6 +918,33 @@ namespace MetriCam2
         /// Cache for extrinsic calibrations.
         /// </summary>
         private Dictionary<string, RigidBodyTransformation> extrinsicsCache = new Dictionary<string, RigidBodyTransformation>();
+        /// <summary>
+        /// Cache for the results of <see cref="CalcChannel(string)"/>: channel name -> (frame number, image).
+        /// </summary>
+        /// <remarks>Only accessed inside lock(calcChannelCache).</remarks>
+        private Dictionary<string, KeyValuePair<int, ImageBase>> calcChannelCache = new Dictionary<string, KeyValuePair<int, ImageBase>>();
+        /// <summary>
+        /// Incremented whenever <see cref="calcChannelCache"/> is invalidated, so that images computed before are not stored afterwards.
+        /// </summary>
+        private int calcChannelCacheGeneration = 0;
+        /// <summary>
+        /// <see cref="DateTime.UtcNow"/> minus <see cref="Stopwatch"/> time (both in ticks), taken once, so that all cameras stamp their frames with the same monotonic clock.
+        /// </summary>
+        private static readonly long timeStampOffset = DateTime.UtcNow.Ticks - StopwatchToTicks(Stopwatch.GetTimestamp());
+        /// <summary>
+        /// Arrival of the current frame as reported by <see cref="SetFrameArrival"/> during <see cref="UpdateImpl"/>, -1 if not reported.
+        /// </summary>
+        private long frameArrival = -1;
+        /// <summary>
+        /// Device timestamp of the current frame as reported by <see cref="SetDeviceTimeStamp"/> during <see cref="UpdateImpl"/>.
+        /// </summary>
+        private long frameDeviceTime = 0;
+        private bool hasFrameDeviceTime = false;
+        /// <summary>
+        /// Images handed out to several callers, see <see cref="MarkShared(ImageBase, string)"/>. Weak keys, so the marks do not keep the images alive.
+        /// </summary>
+        private readonly ConditionalWeakTable<ImageBase, object> sharedImages = new ConditionalWeakTable<ImageBase, object>();
+        private static readonly object sharedMarker = new object();
 
         private int id;
         private static int lastId = -1;
@@ -936,6 +966,27 @@ namespace MetriCam2
         /// </remarks>
         protected bool enableImplicitThreadSafety = false;
         /// <summary>
+        /// Publish each frame as <see cref="FrameSnapshot"/>.
+        /// </summary>
+        /// <remarks>
+        /// If enabled, <see cref="Update"/> calls <see cref="CaptureFrameImpl"/> after <see cref="UpdateImpl"/> and publishes the result, see <see cref="AcquireCurrentFrame"/>.
+        /// <see cref="CalcChannel(string, FrameSnapshot)"/> then computes channels via <see cref="CalcChannelImpl(string, object)"/> without entering <see cref="cameraLock"/>,
+        /// so processing of frame N can overlap the acquisition of frame N+1.
+        /// Implementations which enable this must override both methods, and <see cref="ReleaseFrameImpl"/> if the frame data hold resources.
+        /// </remarks>
+        protected bool enableFrameSnapshots = false;
+        /// <summary>
+        /// Cache the results of <see cref="CalcChannel(string)"/> per frame.
+        /// </summary>
+        /// <remarks>
+        /// If enabled, repeated calls of <see cref="CalcChannel(string)"/> for the same channel and frame return a copy of the image computed first, instead of calling <see cref="CalcChannelImpl(string)"/> again.
+        /// Storing the image costs a copy already on the first call, so enable it only if channels are typically requested several times per frame, e.g. because the implementation computes channels from other channels via <see cref="CalcChannel(string)"/>.
+        /// Only <see cref="FloatImage"/>, <see cref="ByteImage"/> and <see cref="Point3fImage"/> are cached. Images marked with <see cref="MarkShared(ImageBase, string)"/> are neither copied nor cached.
+        /// The cache is cleared by <see cref="Update"/>, <see cref="ActivateChannel"/>, <see cref="DeactivateChannel"/> and by changing parameters via <see cref="SetParameter"/>.
+        /// Implementations which enable it have to call <see cref="InvalidateCalcChannelCache"/> wherever else channel data change, in particular in property setters, which can be used directly instead of <see cref="SetParameter"/>.
+        /// </remarks>
+        protected bool enableCalcChannelCache = false;
+        /// <summary>
         /// Currently selected channel.
         /// </summary>
         protected string selectedChannel = "";
@@ -952,6 +1003,11 @@ namespace MetriCam2
         /// </summary>
         /// <remarks>This flag is checked in <see cref="CalcChannel"/> to catch this common error in end user software.</remarks>
         private bool hasUpdateBeenCalled = false;
+        /// <summary>
+        /// Latest frame published by <see cref="Update"/>, if <see cref="enableFrameSnapshots"/> is set.
+        /// </summary>
+        /// <remarks>Holds one reference to the frame, which is dropped when the next frame is published or the camera is disconnected.</remarks>
+        private volatile FrameSnapshot currentFrame = null;
 #if !NETSTANDARD2_0
         private static string calibrationPathRegistry = null;
 #endif
@@ -1121,11 +1177,63 @@ namespace MetriCam2
         }
         /// <summary>TimeStamp of the current frame.</summary>
         /// <remarks>
-        /// By default the TimeStamp is set to DateTime.UtcNow.Ticks at the beginning of <see cref="Update"/>.
-        /// Individual cameras may override this behaviour and e.g. use a timestamp delivered by the camera itself.
+        /// The TimeStamp is in UTC ticks, but taken from the monotonic high-resolution <see cref="Stopwatch"/> clock, which is shared by all cameras.
+        /// It may deviate from <see cref="DateTime.UtcNow"/> by the corrections of the system time since the start of the process.
+        /// By default it is the time at which <see cref="UpdateImpl"/> returned, or the arrival of the frame if the camera reports it (see <see cref="ReceivedTimeStamp"/>).
+        /// Cameras which deliver device timestamps map them to the host clock via <see cref="DeviceClock"/>.
         /// </remarks>
         public long TimeStamp { get; private set; }
 
+        private ParamDesc<long> ReceivedTimeStampDesc
+        {
+            get
+            {
+                return new ParamDesc<long>()
+                {
+                    Description = "Arrival of latest frame on the host.",
+                    ReadableWhen = ParamDesc.ConnectionStates.Connected | ParamDesc.ConnectionStates.Disconnected,
+                    Unit = "ticks",
+                };
+            }
+        }
+        /// <summary>Time at which the current frame arrived on the host, on the same clock as <see cref="TimeStamp"/>.</summary>
+        /// <remarks>Equals <see cref="TimeStamp"/> unless the camera delivers device timestamps. Then the difference is the latency of the frame.</remarks>
+        public long ReceivedTimeStamp { get; private set; }
+
+        /// <summary>Model of the device clock, which maps device timestamps to <see cref="TimeStamp"/>.</summary>
+        /// <remarks><c>null</c> for cameras which do not deliver device timestamps.</remarks>
+        /// <seealso cref="SetDeviceTimeStamp"/>
+        public ClockModel DeviceClock { get; protected set; }
+
+        /// <summary>Takes a snapshot of the latest frame.</summary>
+        /// <returns>The snapshot, which has to be disposed when done. <c>null</c> for cameras which do not support frame snapshots, before the first <see cref="Update"/> and after <see cref="Disconnect"/>.</returns>
+        /// <remarks>The frame data are kept by the driver until the snapshot is disposed, also while <see cref="Update"/> acquires newer frames.</remarks>
+        /// <seealso cref="CalcChannel(string, FrameSnapshot)"/>
+        public FrameSnapshot AcquireCurrentFrame()
+        {
+            while (true)
+            {
+                FrameSnapshot frame = currentFrame;
+                if (null == frame)
+                {
+                    return null;
+                }
+                // fails only if Update has just replaced and released this frame; then take the new one
+                FrameSnapshot reference = frame.TryAddReference();
+                if (null != reference)
+                {
+                    return reference;
+                }
+            }
+        }
+
+        /// <summary>Pool of image buffers of this camera.</summary>
+        /// <remarks>
+        /// Camera implementations rent the images they hand out from this pool; consumers give them back with <see cref="ReleaseImage"/>.
+        /// Its statistics show how many images were reused.
+        /// </remarks>
+        public ImagePool ImagePool { get; private set; }
+
 #if !NETSTANDARD2_0
         /// <summary>
         /// Provides an icon that represents the camera.
@@ -1165,6 +1273,7 @@ namespace MetriCam2
 
             Channels = new List<ChannelRegistry.ChannelDescriptor>();
             ActiveChannels = new List<ChannelRegistry.ChannelDescriptor>();
+            ImagePool = new ImagePool();
 
             LoadAllAvailableChannels();
 
@@ -1223,6 +1332,8 @@ namespace MetriCam2
 
             FrameNumber = -1;
             TimeStamp = -1;
+            ReceivedTimeStamp = -1;
+            InvalidateCalcChannelCache();
 
             if (OnConnecting != null)
             {
@@ -1290,19 +1401,29 @@ namespace MetriCam2
             }
 
             this.IsConnected = false;
+            InvalidateCalcChannelCache();
 
             if (useLockedCall)
             {
                 lock (cameraLock)
                 {
+                    ReleaseCurrentFrame();
                     DisconnectImpl();
                 }
             }
             else
             {
+                ReleaseCurrentFrame();
                 DisconnectImpl();
             }
 
+            // image sizes may be different after the next connect
+            ImagePool.Clear();
+            if (null != DeviceClock)
+            {
+                DeviceClock.Reset();
+            }
+
             if (OnDisconnected != null)
             {
                 OnDisconnected(this);
@@ -1326,10 +1447,84 @@ namespace MetriCam2
             lock (cameraLock)
             {
                 this.hasUpdateBeenCalled = true;
+                InvalidateCalcChannelCache();
                 this.FrameNumber++;
+                frameArrival = -1;
+                hasFrameDeviceTime = false;
                 UpdateImpl();
-                this.TimeStamp = DateTime.UtcNow.Ticks;
+                UpdateTimeStamps();
+
+                if (enableFrameSnapshots)
+                {
+                    List<string> activeChannelNames = new List<string>();
+                    foreach (ChannelRegistry.ChannelDescriptor c in ActiveChannels)
+                    {
+                        activeChannelNames.Add(c.Name);
+                    }
+                    FrameSnapshot previousFrame = Interlocked.Exchange(ref currentFrame, new FrameSnapshot(this, FrameNumber, TimeStamp, activeChannelNames, CaptureFrameImpl()));
+                    if (null != previousFrame)
+                    {
+                        // snapshots still held by consumers keep the frame alive
+                        previousFrame.Dispose();
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Asynchronous variant of <see cref="Update"/>.
+        /// </summary>
+        /// <param name="cancellationToken">Cancels waiting for the next frame.</param>
+        /// <remarks>
+        /// If the camera implementation can signal new frames (see <see cref="WaitForFrameAsync"/>, e.g. mvBlueSirius with its acquisition thread), no thread is blocked while waiting for the frame.
+        /// Otherwise <see cref="Update"/> runs on the thread pool and blocks a pool thread until the frame has arrived, i.e. one thread per camera which is being updated.
+        /// When updating many such cameras at a time (e.g. with one <see cref="FrameStream"/> each), raise the minimum number of pool threads (<see cref="ThreadPool.SetMinThreads"/>), since the pool adds threads only slowly beyond it.
+        /// Cancellation is observed until <see cref="UpdateImpl"/> starts; an <see cref="UpdateImpl"/> in progress is not aborted.
+        /// </remarks>
+        /// <exception cref="InvalidOperationException">If the instance is not connected to a camera.</exception>
+        /// <exception cref="OperationCanceledException">If <paramref name="cancellationToken"/> was cancelled before the update started.</exception>
+        public async Task UpdateAsync(CancellationToken cancellationToken)
+        {
+            if (!IsConnected)
+            {
+                throw ExceptionBuilder.Build(typeof(InvalidOperationException), Name, "error_cameraNotConnected");
+            }
+
+            if (await WaitForFrameAsync(cancellationToken).ConfigureAwait(false))
+            {
+                // the frame is there, so Update will not block for long
+                cancellationToken.ThrowIfCancellationRequested();
+                Update();
+                return;
             }
+            await Task.Run(() => Update(), cancellationToken).ConfigureAwait(false);
+        }
+
+        /// <summary>
+        /// Starts a background producer which acquires frames and computes the given channels for each of them.
+        /// </summary>
+        /// <param name="channelNames">Active channels to compute for each frame.</param>
+        /// <param name="capacity">Maximum number of buffered frames.</param>
+        /// <param name="cancellationToken">Stops the producer.</param>
+        /// <returns>The stream. Dispose it to stop the producer.</returns>
+        /// <remarks>Do not call <see cref="Update"/> while the stream is running, otherwise frames are missing from the stream.</remarks>
+        /// <exception cref="InvalidOperationException">If the instance is not connected to a camera.</exception>
+        /// <exception cref="ArgumentException">If one of the channels is not active.</exception>
+        public FrameStream StartFrameStream(IEnumerable<string> channelNames, int capacity, CancellationToken cancellationToken)
+        {
+            if (!IsConnected)
+            {
+                throw ExceptionBuilder.Build(typeof(InvalidOperationException), Name, "error_cameraNotConnected");
+            }
+            foreach (string channelName in channelNames)
+            {
+                if (!IsChannelActive(channelName))
+                {
+                    throw ExceptionBuilder.Build(typeof(ArgumentException), Name, "error_inactiveChannelName", channelName);
+                }
+            }
+
+            return new FrameStream(this, channelNames, capacity, cancellationToken);
         }
 
         /// <summary>
@@ -1353,6 +1548,7 @@ namespace MetriCam2
             {
                 if (!IsChannelActive(channelName))
                 {
+                    InvalidateCalcChannelCache();
                     ActivateChannelImpl(channelName);
                     AddToActiveChannels(channelName);
                     log.InfoFormat("Activated channel {0}.", channelName);
@@ -1378,6 +1574,7 @@ namespace MetriCam2
 
                 if (IsChannelActive(channelName))
                 {
+                    InvalidateCalcChannelCache();
                     DeactivateChannelImpl(channelName);
                     ActiveChannels.Remove(GetChannelDescriptor(channelName));
                     log.InfoFormat("Deactivated channel {0}.", channelName);
@@ -1552,21 +1749,27 @@ namespace MetriCam2
         /// </summary>
         /// <param name="channelName">Registered channel name.</param>
         /// <returns>Current frame for this channel.</returns>
-        /// <remarks>Calls camera-specific <see cref="CalcChannelImpl"/>.</remarks>
+        /// <remarks>
+        /// Calls camera-specific <see cref="CalcChannelImpl"/>.
+        /// Repeated calls within the same frame may be served from a cache, see <see cref="enableCalcChannelCache"/>.
+        /// Each call returns an image of its own, which the caller may modify.
+        /// </remarks>
         /// <exception cref="ArgumentException">If the specified channel is not active.</exception>
         /// <seealso cref="enableImplicitThreadSafety"/>
         public ImageBase CalcChannel(string channelName)
         {
-            // TODO: Deactivated because of bug: see ticket #0003324.
-            //if (calcChannelCache.ContainsKey(channelName))
-            //{
-            //    return calcChannelCache[channelName];
-            //}
-
             if (!hasUpdateBeenCalled)
             {
                 throw ExceptionBuilder.Build(typeof(InvalidOperationException), Name, "error_updateMustBeCalledBeforeCalcChannel");
             }
+
+            ImageBase cached = GetCachedChannel(channelName);
+            if (null != cached)
+            {
+                return cached;
+            }
+            int cacheGeneration = Volatile.Read(ref calcChannelCacheGeneration);
+
             ImageBase img;
             if (enableImplicitThreadSafety)
             {
@@ -1592,12 +1795,68 @@ namespace MetriCam2
             }
 
             if (img != null)
+            {
+                // shared images are stamped once by MarkShared; other callers may be reading them
+                if (!IsShared(img))
+                {
+                    if (img.FrameNumber < 1)
+                    {
+                        img.FrameNumber = FrameNumber;
+                    }
+                    img.TimeStamp = TimeStamp;
+                    if (string.IsNullOrWhiteSpace(img.ChannelName))
+                    {
+                        img.ChannelName = channelName;
+                    }
+                }
+
+                img = AddToCalcChannelCache(channelName, img, cacheGeneration);
+            }
+
+            return img;
+        }
+
+        /// <summary>
+        /// Computes (image) data for a channel of a specific frame.
+        /// </summary>
+        /// <param name="channelName">Registered channel name.</param>
+        /// <param name="frame">Frame snapshot of this camera, see <see cref="AcquireCurrentFrame"/>.</param>
+        /// <returns>Data of this channel in <paramref name="frame"/>.</returns>
+        /// <remarks>
+        /// Calls camera-specific <see cref="CalcChannelImpl(string, object)"/> without entering <see cref="cameraLock"/>, also if <see cref="enableImplicitThreadSafety"/> is set.
+        /// It may therefore run concurrently to <see cref="Update"/>.
+        /// </remarks>
+        /// <exception cref="ArgumentNullException">If <paramref name="frame"/> is null.</exception>
+        /// <exception cref="ArgumentException">If <paramref name="frame"/> was not acquired by this camera, or the channel was not active in it.</exception>
+        /// <exception cref="ObjectDisposedException">If <paramref name="frame"/> has been disposed.</exception>
+        public ImageBase CalcChannel(string channelName, FrameSnapshot frame)
+        {
+            if (null == frame)
+            {
+                throw new ArgumentNullException("frame");
+            }
+            if (frame.IsDisposed)
+            {
+                throw new ObjectDisposedException("frame");
+            }
+            if (this != frame.Camera)
+            {
+                throw new ArgumentException(string.Format("{0}: The frame snapshot was acquired by a different camera.", Name), "frame");
+            }
+            if (!frame.IsChannelActive(channelName))
+            {
+                throw ExceptionBuilder.Build(typeof(ArgumentException), Name, "error_inactiveChannelName", channelName);
+            }
+
+            ImageBase img = CalcChannelImpl(channelName, frame.State);
+
+            if (img != null && !IsShared(img))
             {
                 if (img.FrameNumber < 1)
                 {
-                    img.FrameNumber = FrameNumber;
+                    img.FrameNumber = frame.FrameNumber;
                 }
-                img.TimeStamp = TimeStamp;
+                img.TimeStamp = frame.TimeStamp;
                 if (string.IsNullOrWhiteSpace(img.ChannelName))
                 {
                     img.ChannelName = channelName;
@@ -1606,6 +1865,20 @@ namespace MetriCam2
 
             return img;
         }
+
+        /// <summary>
+        /// Hands an image obtained from <see cref="CalcChannel(string)"/> back to the camera, so that its buffer is reused for one of the next frames.
+        /// </summary>
+        /// <param name="image">The image. It must not be used any more afterwards.</param>
+        /// <returns><c>true</c> if the image was rented from <see cref="ImagePool"/> and has been taken back.</returns>
+        /// <remarks>
+        /// Releasing images is optional. Images of camera implementations which do not use the pool are ignored.
+        /// So are images which the camera hands out to several callers (see <see cref="MarkShared(ImageBase, string)"/>), since the others may still read them.
+        /// </remarks>
+        public bool ReleaseImage(ImageBase image)
+        {
+            return ImagePool.Return(image);
+        }
         #endregion
 
         #region Parameter Settings
@@ -2316,6 +2589,141 @@ namespace MetriCam2
             }
 
             log.InfoFormat("{0}: {1} <- {2}", this.Name, name, myItem);
+            InvalidateCalcChannelCache();
+        }
+
+        /// <summary>
+        /// Looks up the image of <paramref name="channelName"/> for the current frame in <see cref="calcChannelCache"/>.
+        /// </summary>
+        /// <returns>A copy of the cached image, or <c>null</c>.</returns>
+        private ImageBase GetCachedChannel(string channelName)
+        {
+            if (!enableCalcChannelCache)
+            {
+                return null;
+            }
+
+            KeyValuePair<int, ImageBase> entry;
+            lock (calcChannelCache)
+            {
+                if (!calcChannelCache.TryGetValue(channelName, out entry) || entry.Key != FrameNumber)
+                {
+                    return null;
+                }
+            }
+            return CopyImage(entry.Value);
+        }
+
+        /// <summary>
+        /// Stores a freshly computed image in <see cref="calcChannelCache"/>.
+        /// </summary>
+        /// <param name="channelName">Channel name.</param>
+        /// <param name="img">The image computed by <see cref="CalcChannelImpl(string)"/>.</param>
+        /// <param name="cacheGeneration">Value of <see cref="calcChannelCacheGeneration"/> before <paramref name="img"/> was computed.</param>
+        /// <returns>The image to hand out. If <paramref name="img"/> was cached, this is a copy, so the caller cannot modify the cached image.</returns>
+        private ImageBase AddToCalcChannelCache(string channelName, ImageBase img, int cacheGeneration)
+        {
+            // shared images are read-only and the implementation hands them out again anyway
+            if (!enableCalcChannelCache || IsShared(img))
+            {
+                return img;
+            }
+
+            ImageBase copy = CopyImage(img);
+            if (null == copy)
+            {
+                // type cannot be copied, so it is not cached
+                return img;
+            }
+
+            lock (calcChannelCache)
+            {
+                // the cache has been invalidated while img was computed, so img may be outdated
+                if (cacheGeneration != calcChannelCacheGeneration)
+                {
+                    ImagePool.Return(copy);
+                    return img;
+                }
+                calcChannelCache[channelName] = new KeyValuePair<int, ImageBase>(FrameNumber, img);
+            }
+            return copy;
+        }
+
+        private void UpdateTimeStamps()
+        {
+            long arrival = (frameArrival >= 0) ? frameArrival : Stopwatch.GetTimestamp();
+            long capture = arrival;
+            if (hasFrameDeviceTime)
+            {
+                DeviceClock.AddSample(frameDeviceTime, arrival);
+                capture = DeviceClock.ToHostTime(frameDeviceTime);
+            }
+            this.ReceivedTimeStamp = ToTimeStamp(arrival);
+            this.TimeStamp = ToTimeStamp(capture);
+        }
+
+        /// <summary>
+        /// Drops the reference of the camera to the latest frame snapshot.
+        /// </summary>
+        private void ReleaseCurrentFrame()
+        {
+            FrameSnapshot frame = Interlocked.Exchange(ref currentFrame, null);
+            if (null != frame)
+            {
+                frame.Dispose();
+            }
+        }
+
+        /// <summary>
+        /// Hands the data of a frame back to the driver when its last snapshot has been disposed.
+        /// </summary>
+        internal void ReleaseFrame(object frameState)
+        {
+            ReleaseFrameImpl(frameState);
+        }
+
+        private static long StopwatchToTicks(long stopwatchTime)
+        {
+            return (long)(stopwatchTime * ((double)TimeSpan.TicksPerSecond / Stopwatch.Frequency));
+        }
+
+        /// <summary>
+        /// Deep copy of an image including its meta data, rented from <see cref="ImagePool"/>.
+        /// </summary>
+        /// <returns>The copy, or <c>null</c> if the image type is not supported.</returns>
+        private ImageBase CopyImage(ImageBase img)
+        {
+            ImageBase copy;
+            if (img is FloatImage)
+            {
+                FloatImage src = (FloatImage)img;
+                FloatImage dst = ImagePool.RentFloatImage(src.Width, src.Height);
+                Array.Copy(src.Data, dst.Data, src.Data.Length);
+                copy = dst;
+            }
+            else if (img is ByteImage)
+            {
+                ByteImage src = (ByteImage)img;
+                ByteImage dst = ImagePool.RentByteImage(src.Width, src.Height);
+                Array.Copy(src.Data, dst.Data, src.Data.Length);
+                copy = dst;
+            }
+            else if (img is Point3fImage)
+            {
+                Point3fImage src = (Point3fImage)img;
+                Point3fImage dst = ImagePool.RentPoint3fImage(src.Width, src.Height);
+                Array.Copy(src.Data, dst.Data, src.Data.Length);
+                copy = dst;
+            }
+            else
+            {
+                return null;
+            }
+
+            copy.FrameNumber = img.FrameNumber;
+            copy.TimeStamp = img.TimeStamp;
+            copy.ChannelName = img.ChannelName;
+            return copy;
         }
         #endregion
         #endregion
@@ -2456,6 +2864,148 @@ namespace MetriCam2
 #endif
         }
 
+        /// <summary>
+        /// Clears the cache of <see cref="CalcChannel(string)"/>.
+        /// </summary>
+        /// <remarks>Call this if channel data change without a call to <see cref="Update"/> or <see cref="SetParameter"/>, e.g. in a property setter that is used directly.</remarks>
+        /// <seealso cref="enableCalcChannelCache"/>
+        protected void InvalidateCalcChannelCache()
+        {
+            lock (calcChannelCache)
+            {
+                calcChannelCacheGeneration++;
+                // the cached images have only been handed out as copies, so they can be reused
+                foreach (KeyValuePair<int, ImageBase> entry in calcChannelCache.Values)
+                {
+                    ImagePool.Return(entry.Value);
+                }
+                calcChannelCache.Clear();
+            }
+        }
+
+        /// <summary>
+        /// Marks an image which <see cref="CalcChannelImpl(string)"/> hands out to several callers, and stamps it with the current frame.
+        /// </summary>
+        /// <param name="img">The shared image.</param>
+        /// <param name="channelName">Channel of the image.</param>
+        /// <remarks>
+        /// To be called when the image is handed out for the first time. Does nothing if the image is marked already.
+        /// <see cref="CalcChannel(string)"/> does not modify the meta data of shared images afterwards, since other callers may be reading them.
+        /// Shared images must be treated as read-only by all callers.
+        /// If the image was rented from <see cref="ImagePool"/>, it can no longer be returned to it, also not by <see cref="ReleaseImage"/>.
+        /// </remarks>
+        /// <exception cref="ArgumentException">If <paramref name="img"/> is a <see cref="ColorImage"/>: its Bitmap cannot be used by several threads at a time.</exception>
+        protected void MarkShared(ImageBase img, string channelName)
+        {
+            MarkShared(img, channelName, FrameNumber, TimeStamp);
+        }
+
+        /// <summary>
+        /// Marks an image which <see cref="CalcChannelImpl(string, object)"/> hands out to several callers, and stamps it with the frame it was computed from.
+        /// </summary>
+        /// <param name="img">The shared image.</param>
+        /// <param name="channelName">Channel of the image.</param>
+        /// <param name="frameNumber">Number of the frame, see <see cref="FrameSnapshot.FrameNumber"/>.</param>
+        /// <param name="timeStamp">Timestamp of the frame, see <see cref="FrameSnapshot.TimeStamp"/>.</param>
+        /// <remarks>For images of older frames, which must not be stamped with the current frame. See <see cref="MarkShared(ImageBase, string)"/>.</remarks>
+        /// <exception cref="ArgumentException">If <paramref name="img"/> is a <see cref="ColorImage"/>.</exception>
+        protected void MarkShared(ImageBase img, string channelName, int frameNumber, long timeStamp)
+        {
+            if (img is ColorImage)
+            {
+                throw new ArgumentException(string.Format("{0}: Color images cannot be shared, because their Bitmap must not be used by several threads at a time.", Name), "img");
+            }
+
+            lock (sharedImages)
+            {
+                object marker;
+                if (sharedImages.TryGetValue(img, out marker))
+                {
+                    return;
+                }
+                img.FrameNumber = frameNumber;
+                img.TimeStamp = timeStamp;
+                img.ChannelName = channelName;
+                // before the mark is visible, so no caller can release the image in between
+                ImagePool.Untrack(img);
+                sharedImages.Add(img, sharedMarker);
+            }
+        }
+
+        /// <summary>
+        /// Whether an image has been marked with <see cref="MarkShared(ImageBase, string)"/>.
+        /// </summary>
+        protected bool IsShared(ImageBase img)
+        {
+            object marker;
+            return sharedImages.TryGetValue(img, out marker);
+        }
+
+        /// <summary>
+        /// Reports when the current frame arrived on the host.
+        /// </summary>
+        /// <param name="arrival">Arrival, in <see cref="Stopwatch"/> ticks.</param>
+        /// <remarks>
+        /// To be called from <see cref="UpdateImpl"/> by implementations which receive frames before <see cref="Update"/> is called, e.g. in an acquisition thread.
+        /// Otherwise the frame is stamped with the time at which <see cref="UpdateImpl"/> returned.
+        /// </remarks>
+        /// <seealso cref="ReceivedTimeStamp"/>
+        protected void SetFrameArrival(long arrival)
+        {
+            frameArrival = arrival;
+        }
+
+        /// <summary>
+        /// Reports the device timestamp of the current frame.
+        /// </summary>
+        /// <param name="deviceTime">Device timestamp, in ticks of the <see cref="DeviceClock"/>.</param>
+        /// <remarks>
+        /// To be called from <see cref="UpdateImpl"/>.
+        /// The timestamp and the arrival of the frame are added to <see cref="DeviceClock"/>, and <see cref="TimeStamp"/> is the device timestamp mapped to the host clock.
+        /// </remarks>
+        /// <exception cref="InvalidOperationException">If <see cref="DeviceClock"/> has not been set.</exception>
+        protected void SetDeviceTimeStamp(long deviceTime)
+        {
+            if (null == DeviceClock)
+            {
+                throw new InvalidOperationException(string.Format("{0}: DeviceClock has to be set before device timestamps can be used.", Name));
+            }
+            frameDeviceTime = deviceTime;
+            hasFrameDeviceTime = true;
+        }
+
+        /// <summary>
+        /// Converts a <see cref="Stopwatch"/> time to the clock of <see cref="TimeStamp"/>.
+        /// </summary>
+        /// <param name="stopwatchTime">Time in <see cref="Stopwatch"/> ticks.</param>
+        /// <returns>Time in UTC ticks.</returns>
+        protected static long ToTimeStamp(long stopwatchTime)
+        {
+            return timeStampOffset + StopwatchToTicks(stopwatchTime);
+        }
+
+        /// <summary>
+        /// Waits asynchronously for a wait handle, without blocking a thread.
+        /// </summary>
+        /// <param name="waitHandle">Wait handle, e.g. the event an acquisition thread sets for new frames.</param>
+        /// <param name="timeout">Timeout in ms, or <see cref="Timeout.Infinite"/>.</param>
+        /// <param name="cancellationToken">Cancels the wait.</param>
+        /// <returns>A task which results in <c>true</c> if the handle was signaled, <c>false</c> on timeout.</returns>
+        /// <remarks>Helper for implementations of <see cref="WaitForFrameAsync"/>.</remarks>
+        protected static Task<bool> WaitOneAsync(WaitHandle waitHandle, int timeout, CancellationToken cancellationToken)
+        {
+            TaskCompletionSource<bool> tcs = new TaskCompletionSource<bool>();
+            RegisteredWaitHandle registration = ThreadPool.RegisterWaitForSingleObject(waitHandle,
+                (state, timedOut) => tcs.TrySetResult(!timedOut), null, timeout, true);
+            CancellationTokenRegistration cancellation = cancellationToken.Register(() => tcs.TrySetCanceled());
+            tcs.Task.ContinueWith(t =>
+            {
+                registration.Unregister(null);
+                cancellation.Dispose();
+            }, TaskContinuationOptions.ExecuteSynchronously);
+            return tcs.Task;
+        }
+
         /// <summary>
         /// Adds a channel to the list of <see cref="ActiveChannels"/> if it is not in it already.
         /// </summary>
@@ -2531,6 +3081,60 @@ namespace MetriCam2
         /// If your implementation needs locking, use <see cref="Camera.cameraLock"/>.
         /// </remarks>
         protected abstract ImageBase CalcChannelImpl(string channelName);
+
+        /// <summary>
+        /// Captures the data of the frame just acquired by <see cref="UpdateImpl"/>.
+        /// </summary>
+        /// <returns>Driver-specific frame data. It must not be modified by later calls to <see cref="UpdateImpl"/>.</returns>
+        /// <remarks>
+        /// Only called if <see cref="enableFrameSnapshots"/> is set.
+        /// This method is implicitly called by <see cref="Camera.Update"/> inside the camera lock, right after <see cref="UpdateImpl"/>.
+        /// </remarks>
+        protected virtual object CaptureFrameImpl()
+        {
+            throw new NotSupportedException(string.Format("{0} does not support frame snapshots.", Name));
+        }
+
+        /// <summary>Computes (image) data for a given channel of a frame snapshot.</summary>
+        /// <param name="channelName">Channel name.</param>
+        /// <param name="frameState">Frame data as returned by <see cref="CaptureFrameImpl"/>.</param>
+        /// <returns>(Image) Data.</returns>
+        /// <remarks>
+        /// This method is implicitly called by <see cref="Camera.CalcChannel(string, FrameSnapshot)"/>, non-locked, possibly while <see cref="UpdateImpl"/> is running.
+        /// </remarks>
+        protected virtual ImageBase CalcChannelImpl(string channelName, object frameState)
+        {
+            throw new NotSupportedException(string.Format("{0} does not support frame snapshots.", Name));
+        }
+
+        /// <summary>
+        /// Releases the data of a frame snapshot, e.g. hands buffers back to the device.
+        /// </summary>
+        /// <param name="frameState">Frame data as returned by <see cref="CaptureFrameImpl"/>.</param>
+        /// <remarks>
+        /// Called exactly once per frame, when the camera has published a newer frame (or was disconnected) and all snapshots of the frame have been disposed.
+        /// It may therefore be called on any thread, also after <see cref="DisconnectImpl"/>, and concurrently to <see cref="UpdateImpl"/>.
+        /// The default implementation does nothing.
+        /// </remarks>
+        protected virtual void ReleaseFrameImpl(object frameState)
+        {
+            /*empty*/
+        }
+
+        /// <summary>
+        /// Waits asynchronously until a frame is available, so that <see cref="UpdateImpl"/> does not block for long.
+        /// </summary>
+        /// <param name="cancellationToken">Cancels the wait.</param>
+        /// <returns><c>true</c> if a frame is available, <c>false</c> if the implementation cannot tell. The default implementation cannot tell.</returns>
+        /// <remarks>
+        /// This method is implicitly called by <see cref="Camera.UpdateAsync"/>, non-locked.
+        /// Implementations which get notified of new frames, e.g. by an acquisition thread or an SDK callback, override it to let <see cref="UpdateAsync"/> wait without blocking a thread.
+        /// See <see cref="WaitOneAsync"/>.
+        /// </remarks>
+        protected virtual Task<bool> WaitForFrameAsync(CancellationToken cancellationToken)
+        {
+            return Task.FromResult(false);
+        }
 #endregion
 
 #region Private Methods
@@ -0,0 +1,236 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using System;
+using System.Diagnostics;
+
+namespace MetriCam2
+{
+    /// <summary>
+    /// Online linear model of a device clock, which maps device timestamps to the host clock (<see cref="Stopwatch"/>).
+    /// </summary>
+    /// <remarks>
+    /// Each frame contributes a sample: its device timestamp and the host time at which it arrived.
+    /// The model fits host = offset + (1 + drift) * device with exponentially decaying weights, so it follows slow changes of the drift (e.g. by temperature).
+    /// The arrival times scatter by the transfer jitter, which only delays frames.
+    /// Therefore the offset is taken from the lower envelope of the latest samples, i.e. <see cref="ToHostTime"/> yields the arrival time of an undelayed frame.
+    /// A constant transfer delay cannot be observed from the host and is still contained in the result.
+    ///
+    /// If the device clock jumps (backwards, or by more than a second against the model), the model starts anew, e.g. after a device reset.
+    /// This class is thread-safe.
+    /// </remarks>
+    /// <seealso cref="Camera.DeviceClock"/>
+    public sealed class ClockModel
+    {
+        #region Constants
+        /// <summary>
+        /// Default for the forgetting factor: the weight of a sample halves after about 700 samples.
+        /// </summary>
+        public const double DefaultForgettingFactor = 0.999;
+        /// <summary>Deviation between a sample and the model (in s) at which the model is reset.</summary>
+        private const double ResetThreshold = 1.0;
+        /// <summary>Largest drift (as ratio) the fit may yield; crystal clocks stay well below. Bounds the fit while the samples span only a short time.</summary>
+        private const double MaxDrift = 500e-6;
+        /// <summary>Number of latest samples the lower envelope is taken from.</summary>
+        private const int EnvelopeWindow = 256;
+        #endregion
+
+        #region Private Fields
+        private readonly object modelLock = new object();
+        private readonly double deviceTicksPerSecond;
+        private readonly double forgettingFactor;
+        // device and host time of the first sample; the sums below are relative to them and in seconds, to keep the precision
+        private long deviceReference;
+        private long hostReference;
+        private long lastDeviceTime;
+        private double weightSum;
+        private double meanDevice;
+        private double meanHost;
+        private double varDevice;
+        private double covDeviceHost;
+        private double envelope;
+        private int numSamples;
+        // latest samples (relative, in s) as ring buffer, for the envelope
+        private readonly double[] windowDevice = new double[EnvelopeWindow];
+        private readonly double[] windowHost = new double[EnvelopeWindow];
+        #endregion
+
+        #region Constructors
+        /// <summary>
+        /// Creates an empty model with the <see cref="DefaultForgettingFactor"/>.
+        /// </summary>
+        /// <param name="deviceTicksPerSecond">Nominal frequency of the device clock.</param>
+        public ClockModel(double deviceTicksPerSecond)
+            : this(deviceTicksPerSecond, DefaultForgettingFactor)
+        { /* empty */ }
+
+        /// <summary>
+        /// Creates an empty model.
+        /// </summary>
+        /// <param name="deviceTicksPerSecond">Nominal frequency of the device clock.</param>
+        /// <param name="forgettingFactor">Factor by which the weights of older samples decay with each new sample, in (0, 1]. 1 weighs all samples equally.</param>
+        /// <exception cref="ArgumentOutOfRangeException">If one of the arguments is out of range.</exception>
+        public ClockModel(double deviceTicksPerSecond, double forgettingFactor)
+        {
+            if (!(deviceTicksPerSecond > 0))
+            {
+                throw new ArgumentOutOfRangeException("deviceTicksPerSecond", deviceTicksPerSecond, "The device clock frequency must be positive.");
+            }
+            if (!(forgettingFactor > 0 && forgettingFactor <= 1))
+            {
+                throw new ArgumentOutOfRangeException("forgettingFactor", forgettingFactor, "The forgetting factor must be in (0, 1].");
+            }
+
+            this.deviceTicksPerSecond = deviceTicksPerSecond;
+            this.forgettingFactor = forgettingFactor;
+        }
+        #endregion
+
+        #region Public Properties
+        /// <summary>Nominal frequency of the device clock.</summary>
+        public double DeviceTicksPerSecond
+        {
+            get { return deviceTicksPerSecond; }
+        }
+
+        /// <summary>Number of samples since the model was (re)started.</summary>
+        public int NumSamples
+        {
+            get { lock (modelLock) { return numSamples; } }
+        }
+
+        /// <summary>
+        /// Deviation of the device clock rate from the host clock rate, in ppm.
+        /// Positive if the device clock is slower than its nominal frequency relative to the host.
+        /// </summary>
+        /// <remarks>0 until there are two samples at different device times. Limited to +-500 ppm.</remarks>
+        public double Drift
+        {
+            get { lock (modelLock) { return (Slope() - 1.0) * 1e6; } }
+        }
+        #endregion
+
+        #region Public Methods
+        /// <summary>
+        /// Adds the device timestamp of a frame and its arrival time on the host.
+        /// </summary>
+        /// <param name="deviceTime">Device timestamp, in device ticks.</param>
+        /// <param name="hostTime">Arrival on the host, in <see cref="Stopwatch"/> ticks.</param>
+        public void AddSample(long deviceTime, long hostTime)
+        {
+            lock (modelLock)
+            {
+                if (numSamples > 0)
+                {
+                    double deviation = ToHostSeconds(deviceTime) - HostSeconds(hostTime);
+                    if (deviceTime < lastDeviceTime || Math.Abs(deviation) > ResetThreshold)
+                    {
+                        ResetModel();
+                    }
+                }
+                if (0 == numSamples)
+                {
+                    deviceReference = deviceTime;
+                    hostReference = hostTime;
+                }
+                lastDeviceTime = deviceTime;
+
+                // exponentially weighted mean and covariance, updated incrementally
+                double x = DeviceSeconds(deviceTime);
+                double y = HostSeconds(hostTime);
+                weightSum = forgettingFactor * weightSum + 1.0;
+                double alpha = 1.0 / weightSum;
+                double dx = x - meanDevice;
+                double dy = y - meanHost;
+                meanDevice += alpha * dx;
+                meanHost += alpha * dy;
+                varDevice = (1.0 - alpha) * (varDevice + alpha * dx * dx);
+                covDeviceHost = (1.0 - alpha) * (covDeviceHost + alpha * dx * dy);
+                numSamples++;
+
+                // the least delayed of the latest samples against the current fit
+                int slot = (numSamples - 1) % EnvelopeWindow;
+                windowDevice[slot] = x;
+                windowHost[slot] = y;
+                envelope = double.MaxValue;
+                for (int i = 0; i < Math.Min(numSamples, EnvelopeWindow); i++)
+                {
+                    envelope = Math.Min(envelope, windowHost[i] - Fit(windowDevice[i]));
+                }
+            }
+        }
+
+        /// <summary>
+        /// Maps a device timestamp to the host clock.
+        /// </summary>
+        /// <param name="deviceTime">Device timestamp, in device ticks.</param>
+        /// <returns>The corresponding host time, in <see cref="Stopwatch"/> ticks.</returns>
+        /// <exception cref="InvalidOperationException">If the model has no samples yet.</exception>
+        public long ToHostTime(long deviceTime)
+        {
+            lock (modelLock)
+            {
+                if (0 == numSamples)
+                {
+                    throw new InvalidOperationException("The clock model has no samples yet.");
+                }
+                return hostReference + (long)Math.Round(ToHostSeconds(deviceTime) * Stopwatch.Frequency);
+            }
+        }
+
+        /// <summary>
+        /// Discards all samples, e.g. when the device is reconnected.
+        /// </summary>
+        public void Reset()
+        {
+            lock (modelLock)
+            {
+                ResetModel();
+            }
+        }
+        #endregion
+
+        #region Private Methods
+        private void ResetModel()
+        {
+            weightSum = 0;
+            meanDevice = 0;
+            meanHost = 0;
+            varDevice = 0;
+            covDeviceHost = 0;
+            envelope = 0;
+            numSamples = 0;
+        }
+
+        private double DeviceSeconds(long deviceTime)
+        {
+            return (deviceTime - deviceReference) / deviceTicksPerSecond;
+        }
+
+        private double HostSeconds(long hostTime)
+        {
+            return (double)(hostTime - hostReference) / Stopwatch.Frequency;
+        }
+
+        /// <summary>Host seconds per device second; the nominal 1 until the device times spread.</summary>
+        private double Slope()
+        {
+            if (!(varDevice > 0))
+            {
+                return 1.0;
+            }
+            return Math.Max(1.0 - MaxDrift, Math.Min(1.0 + MaxDrift, covDeviceHost / varDevice));
+        }
+
+        private double Fit(double x)
+        {
+            return meanHost + Slope() * (x - meanDevice);
+        }
+
+        private double ToHostSeconds(long deviceTime)
+        {
+            return Fit(DeviceSeconds(deviceTime)) + envelope;
+        }
+        #endregion
+    }
+}
@@ -0,0 +1,51 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using Metrilus.Util;
+using System.Collections.Generic;
+
+namespace MetriCam2
+{
+    /// <summary>
+    /// The images of several channels of one frame, as delivered by a <see cref="FrameStream"/>.
+    /// </summary>
+    public sealed class FrameSet
+    {
+        internal FrameSet(Camera camera, int frameNumber, long timeStamp, Dictionary<string, ImageBase> images)
+        {
+            Camera = camera;
+            FrameNumber = frameNumber;
+            TimeStamp = timeStamp;
+            Images = images;
+        }
+
+        /// <summary>The camera which acquired the frame.</summary>
+        public Camera Camera { get; private set; }
+        /// <summary>Number of the frame, see <see cref="Camera.FrameNumber"/>.</summary>
+        public int FrameNumber { get; private set; }
+        /// <summary>Timestamp of the frame, see <see cref="Camera.TimeStamp"/>.</summary>
+        public long TimeStamp { get; private set; }
+        /// <summary>Channel name -> image.</summary>
+        public IReadOnlyDictionary<string, ImageBase> Images { get; private set; }
+
+        /// <summary>The image of a channel.</summary>
+        /// <param name="channelName">Channel name.</param>
+        /// <exception cref="KeyNotFoundException">If the channel is not part of the stream.</exception>
+        public ImageBase this[string channelName]
+        {
+            get { return Images[channelName]; }
+        }
+
+        /// <summary>
+        /// Hands all images back to the camera's <see cref="Camera.ImagePool"/>, see <see cref="Camera.ReleaseImage"/>.
+        /// </summary>
+        /// <remarks>The images must not be used any more afterwards.</remarks>
+        public void Release()
+        {
+            foreach (ImageBase img in Images.Values)
+            {
+                Camera.ReleaseImage(img);
+            }
+        }
+    }
+}
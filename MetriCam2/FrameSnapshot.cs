@@ -0,0 +1,122 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using System;
+using System.Collections.Generic;
+using System.Threading;
+
+namespace MetriCam2
+{
+    /// <summary>
+    /// Immutable view of one frame, published by <see cref="Camera.Update"/> for cameras which support frame snapshots.
+    /// </summary>
+    /// <remarks>
+    /// A snapshot stays valid after the camera acquired newer frames, until it is disposed.
+    /// Pass it to <see cref="Camera.CalcChannel(string, FrameSnapshot)"/> to compute channels of exactly this frame, e.g. on a processing thread while another thread already calls <see cref="Camera.Update"/> for the next one.
+    /// Each snapshot obtained from <see cref="Camera.AcquireCurrentFrame"/> holds a reference to the frame data of the driver;
+    /// the driver gets them back (see <see cref="Camera.ReleaseFrameImpl"/>) when the camera has moved on and all snapshots of the frame are disposed.
+    /// </remarks>
+    /// <seealso cref="Camera.AcquireCurrentFrame"/>
+    public sealed class FrameSnapshot : IDisposable
+    {
+        /// <summary>The data shared by all snapshots of one frame.</summary>
+        private sealed class Frame
+        {
+            public Camera Camera;
+            public int FrameNumber;
+            public long TimeStamp;
+            public HashSet<string> ActiveChannels;
+            public object State;
+            public int RefCount = 1;
+        }
+
+        private readonly Frame frame;
+        private int disposed = 0;
+
+        internal FrameSnapshot(Camera camera, int frameNumber, long timeStamp, IEnumerable<string> activeChannels, object state)
+        {
+            frame = new Frame();
+            frame.Camera = camera;
+            frame.FrameNumber = frameNumber;
+            frame.TimeStamp = timeStamp;
+            frame.ActiveChannels = new HashSet<string>(activeChannels);
+            frame.State = state;
+        }
+
+        private FrameSnapshot(Frame frame)
+        {
+            this.frame = frame;
+        }
+
+        /// <summary>The camera which acquired the frame.</summary>
+        public Camera Camera
+        {
+            get { return frame.Camera; }
+        }
+        /// <summary>Number of the frame, see <see cref="Camera.FrameNumber"/>.</summary>
+        public int FrameNumber
+        {
+            get { return frame.FrameNumber; }
+        }
+        /// <summary>Timestamp of the frame, see <see cref="Camera.TimeStamp"/>.</summary>
+        public long TimeStamp
+        {
+            get { return frame.TimeStamp; }
+        }
+        /// <summary>Whether this snapshot has been disposed; it cannot be used for computing channels any more then.</summary>
+        public bool IsDisposed
+        {
+            get { return 0 != Volatile.Read(ref disposed); }
+        }
+
+        /// <summary>
+        /// Driver-specific data of the frame, as returned by <see cref="Camera.CaptureFrameImpl"/>.
+        /// </summary>
+        internal object State
+        {
+            get { return frame.State; }
+        }
+
+        /// <summary>Tests if a channel was active when the frame was acquired.</summary>
+        /// <param name="channelName">Channel name.</param>
+        public bool IsChannelActive(string channelName)
+        {
+            return frame.ActiveChannels.Contains(channelName);
+        }
+
+        /// <summary>
+        /// Drops the reference of this snapshot to the frame data.
+        /// </summary>
+        /// <remarks>Images computed from the snapshot stay valid. Calling it again does nothing.</remarks>
+        public void Dispose()
+        {
+            if (0 != Interlocked.Exchange(ref disposed, 1))
+            {
+                return;
+            }
+            if (0 == Interlocked.Decrement(ref frame.RefCount))
+            {
+                frame.Camera.ReleaseFrame(frame.State);
+            }
+        }
+
+        /// <summary>
+        /// Creates another snapshot of the same frame, unless the frame has been released already.
+        /// </summary>
+        /// <returns>The new snapshot, or <c>null</c> if all snapshots of the frame have been disposed.</returns>
+        internal FrameSnapshot TryAddReference()
+        {
+            int count = Volatile.Read(ref frame.RefCount);
+            while (count > 0)
+            {
+                int previous = Interlocked.CompareExchange(ref frame.RefCount, count + 1, count);
+                if (previous == count)
+                {
+                    return new FrameSnapshot(frame);
+                }
+                count = previous;
+            }
+            return null;
+        }
+    }
+}
@@ -0,0 +1,202 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using Metrilus.Logging;
+using Metrilus.Util;
+using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace MetriCam2
+{
+    /// <summary>
+    /// Asynchronous stream of frames of a camera, filled by a background producer.
+    /// </summary>
+    /// <remarks>
+    /// The producer calls <see cref="Camera.UpdateAsync"/> and computes the selected channels of each frame.
+    /// Unless the camera can signal new frames, this blocks a pool thread while waiting for each frame, see <see cref="Camera.UpdateAsync"/>.
+    /// At most <see cref="Capacity"/> frames are buffered; while the buffer is full the producer waits for the consumer (backpressure), so no frame is dropped by the stream itself.
+    /// Consume it with
+    /// <code>
+    /// FrameSet frame;
+    /// while (null != (frame = await stream.ReadAsync(cancellationToken)))
+    /// {
+    ///     ...
+    /// }
+    /// </code>
+    /// The producer stops when the stream is disposed, its cancellation token is cancelled, or an error occurs.
+    /// An <see cref="Camera.Update"/> in progress is not aborted, so stopping may take until the frame it waits for has arrived.
+    /// In the last case <see cref="ReadAsync"/> throws that error after the buffered frames have been read.
+    /// </remarks>
+    /// <seealso cref="Camera.StartFrameStream"/>
+    public sealed class FrameStream : IDisposable
+    {
+        #region Private Fields
+        private static MetriLog log = new MetriLog("MetriCam2.FrameStream");
+
+        private readonly Camera camera;
+        private readonly string[] channelNames;
+        private readonly ConcurrentQueue<FrameSet> frames = new ConcurrentQueue<FrameSet>();
+        /// <summary>Counts buffered frames; released once more when the producer has finished.</summary>
+        private readonly SemaphoreSlim framesAvailable = new SemaphoreSlim(0);
+        /// <summary>Counts free buffer slots, which is what makes the producer wait for the consumer.</summary>
+        private readonly SemaphoreSlim freeSlots;
+        private readonly CancellationTokenSource stopSource;
+        private Exception producerError = null;
+        private long numFrames = 0;
+        private int disposed = 0;
+        #endregion
+
+        #region Constructor
+        internal FrameStream(Camera camera, IEnumerable<string> channelNames, int capacity, CancellationToken cancellationToken)
+        {
+            if (capacity < 1)
+            {
+                throw new ArgumentOutOfRangeException("capacity", capacity, "The capacity must be at least 1.");
+            }
+
+            this.camera = camera;
+            this.channelNames = new List<string>(channelNames).ToArray();
+            Capacity = capacity;
+            freeSlots = new SemaphoreSlim(capacity);
+            stopSource = CancellationTokenSource.CreateLinkedTokenSource(cancellationToken);
+            Completion = Task.Run(() => ProduceAsync(stopSource.Token));
+        }
+        #endregion
+
+        #region Public Properties
+        /// <summary>Maximum number of buffered frames.</summary>
+        public int Capacity { get; private set; }
+
+        /// <summary>Number of frames buffered at the moment.</summary>
+        public int Count
+        {
+            get { return frames.Count; }
+        }
+
+        /// <summary>Number of frames produced so far.</summary>
+        public long NumFrames
+        {
+            get { return Interlocked.Read(ref numFrames); }
+        }
+
+        /// <summary>
+        /// Completes when the producer has stopped. It is faulted if the producer stopped because of an error.
+        /// </summary>
+        public Task Completion { get; private set; }
+        #endregion
+
+        #region Public Methods
+        /// <summary>
+        /// Takes the oldest buffered frame, waiting asynchronously until one is available.
+        /// </summary>
+        /// <param name="cancellationToken">Cancels the wait.</param>
+        /// <returns>The frame, or <c>null</c> if the producer has stopped and all frames have been read.</returns>
+        /// <exception cref="OperationCanceledException">If <paramref name="cancellationToken"/> was cancelled.</exception>
+        /// <exception cref="Exception">The error which stopped the producer, once all frames before it have been read.</exception>
+        public async Task<FrameSet> ReadAsync(CancellationToken cancellationToken)
+        {
+            await framesAvailable.WaitAsync(cancellationToken).ConfigureAwait(false);
+
+            FrameSet frame;
+            if (frames.TryDequeue(out frame))
+            {
+                freeSlots.Release();
+                return frame;
+            }
+
+            // woken because the producer has finished: pass the wake-up on to further readers
+            framesAvailable.Release();
+            if (null != producerError)
+            {
+                throw producerError;
+            }
+            return null;
+        }
+
+        /// <summary>
+        /// Stops the producer and releases the images of all frames which have not been read.
+        /// </summary>
+        public void Dispose()
+        {
+            if (0 != Interlocked.Exchange(ref disposed, 1))
+            {
+                return;
+            }
+
+            stopSource.Cancel();
+            try
+            {
+                Completion.Wait();
+            }
+            catch (AggregateException)
+            {
+                // the error has been handed to the readers already
+            }
+
+            FrameSet frame;
+            while (frames.TryDequeue(out frame))
+            {
+                frame.Release();
+            }
+            stopSource.Dispose();
+        }
+        #endregion
+
+        #region Private Methods
+        private async Task ProduceAsync(CancellationToken stopToken)
+        {
+            try
+            {
+                while (!stopToken.IsCancellationRequested)
+                {
+                    await freeSlots.WaitAsync(stopToken).ConfigureAwait(false);
+                    await camera.UpdateAsync(stopToken).ConfigureAwait(false);
+                    frames.Enqueue(CalcFrameSet());
+                    Interlocked.Increment(ref numFrames);
+                    framesAvailable.Release();
+                }
+            }
+            catch (OperationCanceledException)
+            {
+                // stopped regularly
+            }
+            catch (Exception e)
+            {
+                log.ErrorFormat("{0}: Frame stream stopped: {1}", camera.Name, e.Message);
+                producerError = e;
+                throw;
+            }
+            finally
+            {
+                framesAvailable.Release();
+            }
+        }
+
+        private FrameSet CalcFrameSet()
+        {
+            Dictionary<string, ImageBase> images = new Dictionary<string, ImageBase>();
+            using (FrameSnapshot snapshot = camera.AcquireCurrentFrame())
+            {
+                if (null != snapshot)
+                {
+                    // computing from the snapshot does not need the camera lock, see Camera.enableFrameSnapshots
+                    foreach (string channelName in channelNames)
+                    {
+                        images[channelName] = camera.CalcChannel(channelName, snapshot);
+                    }
+                    return new FrameSet(camera, snapshot.FrameNumber, snapshot.TimeStamp, images);
+                }
+            }
+
+            foreach (string channelName in channelNames)
+            {
+                images[channelName] = camera.CalcChannel(channelName);
+            }
+            return new FrameSet(camera, camera.FrameNumber, camera.TimeStamp, images);
+        }
+        #endregion
+    }
+}
@@ -0,0 +1,301 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using Metrilus.Util;
+using System;
+using System.Collections.Generic;
+using System.Runtime.CompilerServices;
+
+namespace MetriCam2
+{
+    /// <summary>
+    /// Pool of image buffers, keyed by image type and size.
+    /// </summary>
+    /// <remarks>
+    /// Camera implementations rent the images they compute in <see cref="Camera.CalcChannelImpl(string)"/> from <see cref="Camera.ImagePool"/> instead of allocating them.
+    /// Consumers which are done with an image hand it back with <see cref="Camera.ReleaseImage"/>, so the next frame reuses its buffer instead of allocating a new one on the large object heap.
+    /// Images which are never released are simply collected by the GC.
+    ///
+    /// A rented image has the content of its previous use, so it has to be overwritten completely.
+    /// Only images rented from a pool are taken back, and each only once per rental. Shared images are never taken back.
+    /// This class is thread-safe.
+    /// </remarks>
+    public sealed class ImagePool
+    {
+        #region Types
+        private struct PoolKey : IEquatable<PoolKey>
+        {
+            public readonly Type Type;
+            public readonly int Width;
+            public readonly int Height;
+
+            public PoolKey(Type type, int width, int height)
+            {
+                Type = type;
+                Width = width;
+                Height = height;
+            }
+
+            public bool Equals(PoolKey other)
+            {
+                return Type == other.Type && Width == other.Width && Height == other.Height;
+            }
+
+            public override bool Equals(object obj)
+            {
+                return obj is PoolKey && Equals((PoolKey)obj);
+            }
+
+            public override int GetHashCode()
+            {
+                return (Type.GetHashCode() * 31 + Width) * 31 + Height;
+            }
+        }
+        #endregion
+
+        #region Constants
+        /// <summary>
+        /// Default for <see cref="MaxPooledPerKey"/>.
+        /// </summary>
+        public const int DefaultMaxPooledPerKey = 4;
+        #endregion
+
+        #region Private Fields
+        private Dictionary<PoolKey, Stack<ImageBase>> pools = new Dictionary<PoolKey, Stack<ImageBase>>();
+        /// <summary>
+        /// Images currently rented out. Weak keys, so images which are never returned do not stay alive.
+        /// </summary>
+        private ConditionalWeakTable<ImageBase, object> rentedImages = new ConditionalWeakTable<ImageBase, object>();
+        private static readonly object rentedMarker = new object();
+        private int maxPooledPerKey;
+        private long numRented = 0;
+        private long numReused = 0;
+        private long numReturned = 0;
+        private long numDiscarded = 0;
+        private int numPooled = 0;
+        private long pooledBytes = 0;
+        #endregion
+
+        #region Constructors
+        /// <summary>
+        /// Creates an empty pool which keeps up to <see cref="DefaultMaxPooledPerKey"/> images per type and size.
+        /// </summary>
+        public ImagePool()
+            : this(DefaultMaxPooledPerKey)
+        { /* empty */ }
+
+        /// <summary>
+        /// Creates an empty pool.
+        /// </summary>
+        /// <param name="maxPooledPerKey">Number of images kept per type and size.</param>
+        public ImagePool(int maxPooledPerKey)
+        {
+            MaxPooledPerKey = maxPooledPerKey;
+        }
+        #endregion
+
+        #region Public Properties
+        /// <summary>
+        /// Number of images kept per type and size. Images returned beyond that are left to the GC.
+        /// </summary>
+        /// <exception cref="ArgumentOutOfRangeException">If the value is negative.</exception>
+        public int MaxPooledPerKey
+        {
+            get { return maxPooledPerKey; }
+            set
+            {
+                if (value < 0)
+                {
+                    throw new ArgumentOutOfRangeException("value", value, "MaxPooledPerKey must not be negative.");
+                }
+                maxPooledPerKey = value;
+            }
+        }
+
+        /// <summary>Number of images rented in total.</summary>
+        public long NumRented
+        {
+            get { lock (pools) { return numRented; } }
+        }
+
+        /// <summary>Number of rentals which reused a pooled image instead of allocating a new one.</summary>
+        public long NumReused
+        {
+            get { lock (pools) { return numReused; } }
+        }
+
+        /// <summary>Number of images returned to the pool.</summary>
+        public long NumReturned
+        {
+            get { lock (pools) { return numReturned; } }
+        }
+
+        /// <summary>Number of returned images which were not kept, because <see cref="MaxPooledPerKey"/> images of their type and size were pooled already.</summary>
+        public long NumDiscarded
+        {
+            get { lock (pools) { return numDiscarded; } }
+        }
+
+        /// <summary>Number of images currently in the pool.</summary>
+        public int NumPooled
+        {
+            get { lock (pools) { return numPooled; } }
+        }
+
+        /// <summary>Size of the pixel data of all images currently in the pool.</summary>
+        public long PooledBytes
+        {
+            get { lock (pools) { return pooledBytes; } }
+        }
+        #endregion
+
+        #region Public Methods
+        /// <summary>Rents a <see cref="FloatImage"/>.</summary>
+        /// <param name="width">Image width.</param>
+        /// <param name="height">Image height.</param>
+        /// <returns>A pooled or new image. Its pixels have to be overwritten.</returns>
+        public FloatImage RentFloatImage(int width, int height)
+        {
+            FloatImage img = (FloatImage)Take(new PoolKey(typeof(FloatImage), width, height), sizeof(float));
+            return img ?? Track(new FloatImage(width, height));
+        }
+
+        /// <summary>Rents a <see cref="ByteImage"/>.</summary>
+        /// <param name="width">Image width.</param>
+        /// <param name="height">Image height.</param>
+        /// <returns>A pooled or new image. Its pixels have to be overwritten.</returns>
+        public ByteImage RentByteImage(int width, int height)
+        {
+            ByteImage img = (ByteImage)Take(new PoolKey(typeof(ByteImage), width, height), sizeof(byte));
+            return img ?? Track(new ByteImage(width, height));
+        }
+
+        /// <summary>Rents a <see cref="Point3fImage"/>.</summary>
+        /// <param name="width">Image width.</param>
+        /// <param name="height">Image height.</param>
+        /// <returns>A pooled or new image. Its pixels have to be overwritten.</returns>
+        public Point3fImage RentPoint3fImage(int width, int height)
+        {
+            Point3fImage img = (Point3fImage)Take(new PoolKey(typeof(Point3fImage), width, height), 3 * sizeof(float));
+            return img ?? Track(new Point3fImage(width, height));
+        }
+
+        /// <summary>
+        /// Hands a rented image back to the pool.
+        /// </summary>
+        /// <param name="image">An image rented from this pool. It must not be used any more afterwards.</param>
+        /// <returns><c>true</c> if the image was taken back, <c>false</c> if it was not rented from this pool, has been returned already, or is <c>null</c>.</returns>
+        public bool Return(ImageBase image)
+        {
+            if (null == image)
+            {
+                return false;
+            }
+
+            lock (pools)
+            {
+                object marker;
+                if (!rentedImages.TryGetValue(image, out marker))
+                {
+                    return false;
+                }
+                rentedImages.Remove(image);
+                numReturned++;
+
+                PoolKey key = new PoolKey(image.GetType(), image.Width, image.Height);
+                Stack<ImageBase> pool;
+                if (!pools.TryGetValue(key, out pool))
+                {
+                    pool = new Stack<ImageBase>();
+                    pools.Add(key, pool);
+                }
+                if (pool.Count >= maxPooledPerKey)
+                {
+                    numDiscarded++;
+                    return true;
+                }
+
+                image.FrameNumber = 0;
+                image.TimeStamp = 0;
+                image.ChannelName = null;
+                pool.Push(image);
+                numPooled++;
+                pooledBytes += BytesOf(image);
+            }
+            return true;
+        }
+
+        /// <summary>
+        /// Drops all pooled images, e.g. when the image sizes change.
+        /// </summary>
+        /// <remarks>Images rented out at that time can still be returned afterwards.</remarks>
+        public void Clear()
+        {
+            lock (pools)
+            {
+                pools.Clear();
+                numPooled = 0;
+                pooledBytes = 0;
+            }
+        }
+
+        /// <summary>
+        /// Stops tracking a rented image, so that it can no longer be returned.
+        /// </summary>
+        /// <param name="image">An image rented from this pool.</param>
+        /// <remarks>For images which are handed out to several callers, see <see cref="Camera.MarkShared(ImageBase, string)"/>: none of them may return the buffer while the others still read it.</remarks>
+        internal void Untrack(ImageBase image)
+        {
+            lock (pools)
+            {
+                rentedImages.Remove(image);
+            }
+        }
+        #endregion
+
+        #region Private Methods
+        private ImageBase Take(PoolKey key, int bytesPerPixel)
+        {
+            lock (pools)
+            {
+                numRented++;
+                Stack<ImageBase> pool;
+                if (!pools.TryGetValue(key, out pool) || 0 == pool.Count)
+                {
+                    return null;
+                }
+
+                ImageBase image = pool.Pop();
+                numReused++;
+                numPooled--;
+                pooledBytes -= (long)key.Width * key.Height * bytesPerPixel;
+                rentedImages.Add(image, rentedMarker);
+                return image;
+            }
+        }
+
+        private T Track<T>(T image) where T : ImageBase
+        {
+            lock (pools)
+            {
+                rentedImages.Add(image, rentedMarker);
+            }
+            return image;
+        }
+
+        private static long BytesOf(ImageBase image)
+        {
+            long numPixels = (long)image.Width * image.Height;
+            if (image is FloatImage)
+            {
+                return numPixels * sizeof(float);
+            }
+            if (image is Point3fImage)
+            {
+                return numPixels * 3 * sizeof(float);
+            }
+            return numPixels;
+        }
+        #endregion
+    }
+}
@@ -0,0 +1,323 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using Metrilus.Logging;
+using Metrilus.Util;
+using System;
+
+namespace MetriCam2.Tests.CalcChannelCacheTest
+{
+    /// <summary>
+    /// Fake camera which counts how often a channel is computed.
+    /// </summary>
+    /// <remarks>
+    /// Each pixel of the ZImage is 1000 * FrameNumber + Offset.
+    /// The Distance image has the same values; if ZImage is active, it is computed from the ZImage via CalcChannel, like AzureKinect does.
+    /// The Amplitude image is computed once per frame and handed out shared.
+    /// </remarks>
+    class CountingCamera : Camera
+    {
+        private int offset = 0;
+        private bool binned = false;
+        private FloatImage amplitude = null;
+
+        public int NumCalcs { get; private set; }
+        public int NumZCalcs { get; private set; }
+
+        private ParamDesc<int> OffsetDesc
+        {
+            get
+            {
+                return new ParamDesc<int>()
+                {
+                    Description = "Value added to each pixel.",
+                    ReadableWhen = ParamDesc.ConnectionStates.Connected | ParamDesc.ConnectionStates.Disconnected,
+                    WritableWhen = ParamDesc.ConnectionStates.Connected | ParamDesc.ConnectionStates.Disconnected,
+                };
+            }
+        }
+        public int Offset
+        {
+            get { return offset; }
+            set
+            {
+                offset = value;
+                // the setter can be used directly, bypassing SetParameter
+                InvalidateCalcChannelCache();
+            }
+        }
+
+        /// <summary>
+        /// Halves the size of ZImage and Distance, like a depth mode setter of a driver.
+        /// </summary>
+        public bool Binned
+        {
+            get { return binned; }
+            set
+            {
+                lock (cameraLock)
+                {
+                    binned = value;
+                    InvalidateCalcChannelCache();
+                }
+            }
+        }
+
+        public CountingCamera(bool useCache)
+            : base("CountingCamera")
+        {
+            enableCalcChannelCache = useCache;
+        }
+
+        protected override void LoadAllAvailableChannels()
+        {
+            ChannelRegistry cr = ChannelRegistry.Instance;
+            Channels.Clear();
+            Channels.Add(cr.RegisterChannel(ChannelNames.Distance));
+            Channels.Add(cr.RegisterChannel(ChannelNames.Amplitude));
+            Channels.Add(cr.RegisterChannel(ChannelNames.ZImage));
+        }
+
+        protected override void ConnectImpl()
+        {
+            ActivateChannel(ChannelNames.Distance);
+        }
+
+        protected override void DisconnectImpl()
+        { /* empty */ }
+
+        protected override void UpdateImpl()
+        {
+            amplitude = null;
+        }
+
+        protected override ImageBase CalcChannelImpl(string channelName)
+        {
+            NumCalcs++;
+            if (ChannelNames.Amplitude == channelName)
+            {
+                if (null == amplitude)
+                {
+                    amplitude = new FloatImage(4, 3);
+                    MarkShared(amplitude, channelName);
+                }
+                return amplitude;
+            }
+
+            if (ChannelNames.Distance == channelName && IsChannelActive(ChannelNames.ZImage))
+            {
+                FloatImage zImage = (FloatImage)CalcChannel(ChannelNames.ZImage);
+                FloatImage distance = new FloatImage(zImage.Width, zImage.Height);
+                Array.Copy(zImage.Data, distance.Data, zImage.Data.Length);
+                ReleaseImage(zImage);
+                return distance;
+            }
+
+            if (ChannelNames.ZImage == channelName)
+            {
+                NumZCalcs++;
+            }
+            FloatImage img = binned ? new FloatImage(2, 2) : new FloatImage(4, 3);
+            for (int i = 0; i < img.Data.Length; i++)
+            {
+                img.Data[i] = 1000 * FrameNumber + Offset;
+            }
+            return img;
+        }
+    }
+
+    class Program
+    {
+        private static MetriLog log = new MetriLog("CalcChannelCacheTest");
+        private static int numErrors = 0;
+
+        static int Main(string[] args)
+        {
+            CountingCamera cam = new CountingCamera(true);
+            cam.Connect();
+
+            TestRepeatedCallsInOneFrame(cam);
+            TestModifiedImageDoesNotPoisonCache(cam);
+            TestUpdateInvalidatesCache(cam);
+            TestParameterChangeInvalidatesCache(cam);
+            TestPropertySetterInvalidatesCache(cam);
+            TestChannelActivationInvalidatesCache(cam);
+            TestSharedImagesAreNotCopied(cam);
+            TestDerivedChannelUsesCache(cam);
+            TestModeSetterInvalidatesDerivedChannel(cam);
+
+            cam.Disconnect();
+
+            TestCacheIsOptIn();
+
+            if (numErrors > 0)
+            {
+                log.ErrorFormat("{0} check(s) failed.", numErrors);
+                return 1;
+            }
+            log.Info("All checks passed.");
+            return 0;
+        }
+
+        private static void TestRepeatedCallsInOneFrame(CountingCamera cam)
+        {
+            log.Info("Testing repeated CalcChannel calls within one frame");
+            cam.Update();
+            int numCalcs = cam.NumCalcs;
+            FloatImage first = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            FloatImage second = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+
+            Check(cam.NumCalcs == numCalcs + 1, "The channel should have been computed once, but was computed {0} times.", cam.NumCalcs - numCalcs);
+            Check(!ReferenceEquals(first, second), "Both calls returned the same instance.");
+            Check(first.Data[0] == second.Data[0], "The cached image differs from the computed one ({0} != {1}).", second.Data[0], first.Data[0]);
+            Check(first.FrameNumber == second.FrameNumber, "The cached image has frame number {0} instead of {1}.", second.FrameNumber, first.FrameNumber);
+        }
+
+        /// <summary>
+        /// The scenario of ticket #0003324: a caller modifies the image it got, and another caller of the same frame must still get the original data.
+        /// </summary>
+        private static void TestModifiedImageDoesNotPoisonCache(CountingCamera cam)
+        {
+            log.Info("Testing that modifying a returned image does not affect later calls");
+            cam.Update();
+            FloatImage first = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            float expected = first.Data[0];
+            for (int i = 0; i < first.Data.Length; i++)
+            {
+                first.Data[i] = -1;
+            }
+            FloatImage second = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            Check(second.Data[0] == expected, "The modification of a returned image leaked into the cache ({0} != {1}).", second.Data[0], expected);
+        }
+
+        private static void TestUpdateInvalidatesCache(CountingCamera cam)
+        {
+            log.Info("Testing that Update invalidates the cache");
+            cam.Update();
+            FloatImage before = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            cam.Update();
+            FloatImage after = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            Check(after.Data[0] == before.Data[0] + 1000, "After Update the image of the previous frame was returned ({0}).", after.Data[0]);
+            Check(after.FrameNumber == cam.FrameNumber, "The image has frame number {0} instead of {1}.", after.FrameNumber, cam.FrameNumber);
+        }
+
+        private static void TestParameterChangeInvalidatesCache(CountingCamera cam)
+        {
+            log.Info("Testing that SetParameter invalidates the cache");
+            cam.Update();
+            FloatImage before = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            cam.SetParameter("Offset", 7);
+            FloatImage after = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            Check(after.Data[0] == before.Data[0] + 7, "After SetParameter the outdated image was returned ({0}).", after.Data[0]);
+            cam.SetParameter("Offset", 0);
+        }
+
+        private static void TestPropertySetterInvalidatesCache(CountingCamera cam)
+        {
+            log.Info("Testing that a property setter used directly invalidates the cache");
+            cam.Update();
+            FloatImage before = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            cam.Offset = 5;
+            FloatImage after = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            Check(after.Data[0] == before.Data[0] + 5, "After setting the property the outdated image was returned ({0}).", after.Data[0]);
+            cam.Offset = 0;
+        }
+
+        private static void TestChannelActivationInvalidatesCache(CountingCamera cam)
+        {
+            log.Info("Testing that DeactivateChannel and ActivateChannel invalidate the cache");
+            cam.Update();
+            cam.CalcChannel(ChannelNames.Distance);
+            int numCalcs = cam.NumCalcs;
+            cam.DeactivateChannel(ChannelNames.Distance);
+            cam.ActivateChannel(ChannelNames.Distance);
+            cam.CalcChannel(ChannelNames.Distance);
+            Check(cam.NumCalcs == numCalcs + 1, "After re-activating the channel the cached image was returned.");
+        }
+
+        private static void TestSharedImagesAreNotCopied(CountingCamera cam)
+        {
+            log.Info("Testing that shared images are handed out without copies");
+            cam.ActivateChannel(ChannelNames.Amplitude);
+            cam.Update();
+            long numRented = cam.ImagePool.NumRented;
+            ImageBase first = cam.CalcChannel(ChannelNames.Amplitude);
+            ImageBase second = cam.CalcChannel(ChannelNames.Amplitude);
+            Check(ReferenceEquals(first, second), "The shared image was copied.");
+            Check(cam.ImagePool.NumRented == numRented, "The cache rented {0} images for a shared image.", cam.ImagePool.NumRented - numRented);
+            cam.DeactivateChannel(ChannelNames.Amplitude);
+        }
+
+        /// <summary>
+        /// A channel computed from another one via CalcChannel (Distance from ZImage in AzureKinect) reuses the cached source.
+        /// </summary>
+        private static void TestDerivedChannelUsesCache(CountingCamera cam)
+        {
+            log.Info("Testing that a channel computed from another channel reuses its cached image");
+            cam.ActivateChannel(ChannelNames.ZImage);
+            cam.Update();
+            int numZCalcs = cam.NumZCalcs;
+            FloatImage zImage = (FloatImage)cam.CalcChannel(ChannelNames.ZImage);
+            FloatImage distance = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            Check(cam.NumZCalcs == numZCalcs + 1, "The ZImage was computed {0} times for ZImage and Distance.", cam.NumZCalcs - numZCalcs);
+            Check(distance.Data[0] == zImage.Data[0], "The Distance image was not computed from the ZImage ({0} != {1}).", distance.Data[0], zImage.Data[0]);
+
+            cam.Update();
+            numZCalcs = cam.NumZCalcs;
+            cam.CalcChannel(ChannelNames.Distance);
+            cam.CalcChannel(ChannelNames.ZImage);
+            Check(cam.NumZCalcs == numZCalcs + 1, "Requested after Distance, the ZImage was computed {0} times.", cam.NumZCalcs - numZCalcs);
+            cam.DeactivateChannel(ChannelNames.ZImage);
+        }
+
+        /// <summary>
+        /// A setter which changes the channel data (like DepthMode of AzureKinect), used directly instead of SetParameter, within one frame.
+        /// </summary>
+        private static void TestModeSetterInvalidatesDerivedChannel(CountingCamera cam)
+        {
+            log.Info("Testing that a mode setter used directly invalidates derived channels");
+            cam.ActivateChannel(ChannelNames.ZImage);
+            cam.Update();
+            cam.CalcChannel(ChannelNames.ZImage);
+            cam.CalcChannel(ChannelNames.Distance);
+
+            cam.Binned = true;
+            int numZCalcs = cam.NumZCalcs;
+            FloatImage distance = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            FloatImage zImage = (FloatImage)cam.CalcChannel(ChannelNames.ZImage);
+            Check(distance.Width == 2 && distance.Height == 2, "After the mode change the Distance image has the outdated size {0}x{1}.", distance.Width, distance.Height);
+            Check(zImage.Width == 2 && zImage.Height == 2, "After the mode change the ZImage has the outdated size {0}x{1}.", zImage.Width, zImage.Height);
+            Check(cam.NumZCalcs == numZCalcs + 1, "After the mode change the ZImage was computed {0} times.", cam.NumZCalcs - numZCalcs);
+
+            cam.Binned = false;
+            distance = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            Check(distance.Width == 4 && distance.Height == 3, "After the mode was reset the Distance image has the outdated size {0}x{1}.", distance.Width, distance.Height);
+            cam.DeactivateChannel(ChannelNames.ZImage);
+        }
+
+        private static void TestCacheIsOptIn()
+        {
+            log.Info("Testing that the cache is only used if the camera enables it");
+            CountingCamera cam = new CountingCamera(false);
+            cam.Connect();
+            cam.Update();
+            int numCalcs = cam.NumCalcs;
+            long numRented = cam.ImagePool.NumRented;
+            cam.CalcChannel(ChannelNames.Distance);
+            cam.CalcChannel(ChannelNames.Distance);
+            Check(cam.NumCalcs == numCalcs + 2, "Without cache the channel should have been computed twice, but was computed {0} times.", cam.NumCalcs - numCalcs);
+            Check(cam.ImagePool.NumRented == numRented, "Without cache {0} copies were rented.", cam.ImagePool.NumRented - numRented);
+            cam.Disconnect();
+        }
+
+        private static void Check(bool condition, string format, params object[] args)
+        {
+            if (condition)
+            {
+                return;
+            }
+            numErrors++;
+            log.ErrorFormat(format, args);
+        }
+    }
+}
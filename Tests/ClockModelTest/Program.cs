@@ -0,0 +1,240 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using Metrilus.Logging;
+using System;
+using System.Diagnostics;
+
+namespace MetriCam2.Tests.ClockModelTest
+{
+    /// <summary>
+    /// Simulated device, whose clock runs at a given drift against the host clock and whose frames arrive delayed by a random transfer jitter.
+    /// </summary>
+    class SimulatedDevice
+    {
+        public const double TicksPerSecond = 1e6;
+        public const double FramesPerSecond = 30;
+
+        private readonly Random random = new Random(4711);
+        private readonly double driftPpm;
+        private readonly double meanJitter;
+        private readonly long hostStart;
+        private long deviceStart;
+        private int frameIndex = 0;
+
+        /// <param name="driftPpm">Drift, see <see cref="ClockModel.Drift"/>.</param>
+        /// <param name="meanJitter">Mean of the exponentially distributed transfer delay, in s.</param>
+        public SimulatedDevice(double driftPpm, double meanJitter)
+        {
+            this.driftPpm = driftPpm;
+            this.meanJitter = meanJitter;
+            hostStart = 1000 * Stopwatch.Frequency;
+            deviceStart = 123456789;
+        }
+
+        /// <summary>Device timestamp of the latest frame.</summary>
+        public long DeviceTime { get; private set; }
+        /// <summary>Host time at which the latest frame would have arrived without transfer delay.</summary>
+        public long UndelayedArrival { get; private set; }
+        /// <summary>Host time at which the latest frame arrived.</summary>
+        public long Arrival { get; private set; }
+
+        public void NextFrame()
+        {
+            double deviceSeconds = frameIndex / FramesPerSecond;
+            double hostSeconds = (frameIndex / FramesPerSecond) * (1.0 + driftPpm * 1e-6);
+            double delay = -meanJitter * Math.Log(1.0 - random.NextDouble());
+            DeviceTime = deviceStart + (long)Math.Round(deviceSeconds * TicksPerSecond);
+            UndelayedArrival = hostStart + (long)Math.Round(hostSeconds * Stopwatch.Frequency);
+            Arrival = UndelayedArrival + (long)Math.Round(delay * Stopwatch.Frequency);
+            frameIndex++;
+        }
+
+        /// <summary>Simulates a reset of the device, after which its clock starts at <paramref name="newStart"/>.</summary>
+        public void ResetClock(long newStart)
+        {
+            deviceStart = newStart - (long)Math.Round(frameIndex / FramesPerSecond * TicksPerSecond);
+        }
+    }
+
+    class Program
+    {
+        private static MetriLog log = new MetriLog("ClockModelTest");
+        private static int numErrors = 0;
+
+        static int Main(string[] args)
+        {
+            TestDrift();
+            TestOneSidedJitter();
+            TestJumpResetsModel();
+            TestDriftLimit();
+            TestArguments();
+
+            if (numErrors > 0)
+            {
+                log.ErrorFormat("{0} check(s) failed.", numErrors);
+                return 1;
+            }
+            log.Info("All checks passed.");
+            return 0;
+        }
+
+        private static void TestDrift()
+        {
+            log.Info("Testing that the model follows the drift of the device clock");
+            foreach (double driftPpm in new double[] { 80, -120 })
+            {
+                ClockModel model = new ClockModel(SimulatedDevice.TicksPerSecond);
+                SimulatedDevice device = new SimulatedDevice(driftPpm, 0.003);
+                Feed(model, device, 10 * 60 * 30);
+
+                Check(Math.Abs(model.Drift - driftPpm) < 5, "The drift is {0:F1} ppm instead of {1} ppm.", model.Drift, driftPpm);
+                double error = MaxError(model, device, 30 * 30);
+                Check(error < 0.5e-3, "With {0} ppm drift the mapped time is off by {1:F3} ms.", driftPpm, error * 1e3);
+            }
+        }
+
+        /// <summary>
+        /// The transfer jitter only delays frames, so the model has to map to the arrival of undelayed frames, not to the mean arrival.
+        /// </summary>
+        private static void TestOneSidedJitter()
+        {
+            log.Info("Testing that delayed arrivals do not bias the mapping");
+            const double meanJitter = 0.005;
+            ClockModel model = new ClockModel(SimulatedDevice.TicksPerSecond);
+            SimulatedDevice device = new SimulatedDevice(0, meanJitter);
+            Feed(model, device, 60 * 30);
+
+            double sumError = 0;
+            const int numChecks = 300;
+            for (int i = 0; i < numChecks; i++)
+            {
+                device.NextFrame();
+                model.AddSample(device.DeviceTime, device.Arrival);
+                sumError += Seconds(model.ToHostTime(device.DeviceTime) - device.UndelayedArrival);
+            }
+            double meanError = sumError / numChecks;
+            Check(Math.Abs(meanError) < 0.2 * meanJitter, "The mapped time is biased by {0:F3} ms at a mean delay of {1} ms.", meanError * 1e3, meanJitter * 1e3);
+            double maxError = MaxError(model, device, 300);
+            Check(maxError < 0.5e-3, "The mapped time is off by {0:F3} ms.", maxError * 1e3);
+        }
+
+        private static void TestJumpResetsModel()
+        {
+            log.Info("Testing that jumps of the device clock reset the model");
+            ClockModel model = new ClockModel(SimulatedDevice.TicksPerSecond);
+            SimulatedDevice device = new SimulatedDevice(50, 0.001);
+            Feed(model, device, 1000);
+            Check(model.NumSamples == 1000, "The model has {0} samples instead of 1000.", model.NumSamples);
+
+            // backwards, e.g. after a reset of the device
+            device.ResetClock(0);
+            device.NextFrame();
+            model.AddSample(device.DeviceTime, device.Arrival);
+            Check(model.NumSamples == 1, "After the device clock jumped backwards the model has {0} samples.", model.NumSamples);
+            Feed(model, device, 300);
+            double error = MaxError(model, device, 100);
+            Check(error < 1e-3, "After the backward jump the mapped time is off by {0:F3} ms.", error * 1e3);
+
+            // forwards by more than a second against the model
+            device.ResetClock(device.DeviceTime + 5 * (long)SimulatedDevice.TicksPerSecond);
+            device.NextFrame();
+            model.AddSample(device.DeviceTime, device.Arrival);
+            Check(model.NumSamples == 1, "After the device clock jumped forwards the model has {0} samples.", model.NumSamples);
+            Feed(model, device, 300);
+            error = MaxError(model, device, 100);
+            Check(error < 1e-3, "After the forward jump the mapped time is off by {0:F3} ms.", error * 1e3);
+
+            model.Reset();
+            Check(0 == model.NumSamples, "Reset left {0} samples.", model.NumSamples);
+        }
+
+        private static void TestDriftLimit()
+        {
+            log.Info("Testing that the drift is limited to +-500 ppm");
+            foreach (double driftPpm in new double[] { 2000, -2000 })
+            {
+                ClockModel model = new ClockModel(SimulatedDevice.TicksPerSecond);
+                SimulatedDevice device = new SimulatedDevice(driftPpm, 0);
+                Feed(model, device, 100);
+                Check(Math.Abs(model.Drift - Math.Sign(driftPpm) * 500) < 1e-6, "At {0} ppm the drift is {1:F1} ppm instead of the limit.", driftPpm, model.Drift);
+            }
+
+            // two frames a frame interval apart, the second one delayed: without the limit the slope would be off by 15 %
+            ClockModel shortModel = new ClockModel(SimulatedDevice.TicksPerSecond);
+            long second = (long)SimulatedDevice.TicksPerSecond;
+            shortModel.AddSample(0, 0);
+            shortModel.AddSample(second / 30, (long)(Stopwatch.Frequency * (1.15 / 30)));
+            Check(Math.Abs(shortModel.Drift) <= 500, "The drift of two close samples is {0:F1} ppm.", shortModel.Drift);
+        }
+
+        private static void TestArguments()
+        {
+            log.Info("Testing argument checks");
+            try
+            {
+                new ClockModel(0);
+                Check(false, "A device clock frequency of 0 was accepted.");
+            }
+            catch (ArgumentOutOfRangeException)
+            {
+                // expected
+            }
+            try
+            {
+                new ClockModel(1e6, 1.5);
+                Check(false, "A forgetting factor of 1.5 was accepted.");
+            }
+            catch (ArgumentOutOfRangeException)
+            {
+                // expected
+            }
+            try
+            {
+                new ClockModel(1e6).ToHostTime(0);
+                Check(false, "An empty model mapped a timestamp.");
+            }
+            catch (InvalidOperationException)
+            {
+                // expected
+            }
+        }
+
+        private static void Feed(ClockModel model, SimulatedDevice device, int numFrames)
+        {
+            for (int i = 0; i < numFrames; i++)
+            {
+                device.NextFrame();
+                model.AddSample(device.DeviceTime, device.Arrival);
+            }
+        }
+
+        /// <summary>Feeds further frames and returns the largest deviation of the mapped time from the undelayed arrival, in s.</summary>
+        private static double MaxError(ClockModel model, SimulatedDevice device, int numFrames)
+        {
+            double maxError = 0;
+            for (int i = 0; i < numFrames; i++)
+            {
+                device.NextFrame();
+                model.AddSample(device.DeviceTime, device.Arrival);
+                maxError = Math.Max(maxError, Math.Abs(Seconds(model.ToHostTime(device.DeviceTime) - device.UndelayedArrival)));
+            }
+            return maxError;
+        }
+
+        private static double Seconds(long hostTicks)
+        {
+            return (double)hostTicks / Stopwatch.Frequency;
+        }
+
+        private static void Check(bool condition, string format, params object[] args)
+        {
+            if (condition)
+            {
+                return;
+            }
+            numErrors++;
+            log.ErrorFormat(format, args);
+        }
+    }
+}
@@ -0,0 +1,255 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using Metrilus.Logging;
+using Metrilus.Util;
+using System;
+using System.Collections.Generic;
+using System.Threading;
+
+namespace MetriCam2.Tests.FrameSnapshotTest
+{
+    /// <summary>
+    /// Frame data of the fake camera, which counts how often the driver got it back.
+    /// </summary>
+    class FakeFrame
+    {
+        public int FrameNumber;
+        public int NumReleases;
+    }
+
+    /// <summary>
+    /// Fake camera which supports frame snapshots.
+    /// </summary>
+    /// <remarks>Each pixel of the Distance image is the number of the frame it was computed from.</remarks>
+    class SnapshotCamera : Camera
+    {
+        public List<FakeFrame> Frames { get; private set; }
+
+        public SnapshotCamera()
+            : base("SnapshotCamera")
+        {
+            Frames = new List<FakeFrame>();
+            enableFrameSnapshots = true;
+        }
+
+        protected override void LoadAllAvailableChannels()
+        {
+            ChannelRegistry cr = ChannelRegistry.Instance;
+            Channels.Clear();
+            Channels.Add(cr.RegisterChannel(ChannelNames.Distance));
+        }
+
+        protected override void ConnectImpl()
+        {
+            ActivateChannel(ChannelNames.Distance);
+        }
+
+        protected override void DisconnectImpl()
+        { /* empty */ }
+
+        protected override void UpdateImpl()
+        { /* empty */ }
+
+        protected override ImageBase CalcChannelImpl(string channelName)
+        {
+            throw new NotSupportedException("Only frame snapshots are tested.");
+        }
+
+        protected override object CaptureFrameImpl()
+        {
+            FakeFrame frame = new FakeFrame();
+            frame.FrameNumber = FrameNumber;
+            lock (Frames)
+            {
+                Frames.Add(frame);
+            }
+            return frame;
+        }
+
+        protected override ImageBase CalcChannelImpl(string channelName, object frameState)
+        {
+            FakeFrame frame = (FakeFrame)frameState;
+            if (frame.NumReleases > 0)
+            {
+                throw new InvalidOperationException(string.Format("Frame {0} is used after it was released.", frame.FrameNumber));
+            }
+            FloatImage img = new FloatImage(4, 3);
+            for (int i = 0; i < img.Data.Length; i++)
+            {
+                img.Data[i] = frame.FrameNumber;
+            }
+            return img;
+        }
+
+        protected override void ReleaseFrameImpl(object frameState)
+        {
+            Interlocked.Increment(ref ((FakeFrame)frameState).NumReleases);
+        }
+
+        public FakeFrame LastFrame
+        {
+            get { lock (Frames) { return Frames[Frames.Count - 1]; } }
+        }
+    }
+
+    class Program
+    {
+        private static MetriLog log = new MetriLog("FrameSnapshotTest");
+        private static int numErrors = 0;
+
+        static int Main(string[] args)
+        {
+            SnapshotCamera cam = new SnapshotCamera();
+            Check(null == cam.AcquireCurrentFrame(), "There is a snapshot before the first Update.");
+            cam.Connect();
+
+            TestOldSnapshotComputesItsFrame(cam);
+            TestReleasedWhenCameraMovesOn(cam);
+            TestReleasedAfterLastSnapshot(cam);
+            TestDisposedSnapshot(cam);
+            TestConcurrentUpdates(cam);
+            TestDisconnectReleasesCurrentFrame(cam);
+
+            if (numErrors > 0)
+            {
+                log.ErrorFormat("{0} check(s) failed.", numErrors);
+                return 1;
+            }
+            log.Info("All checks passed.");
+            return 0;
+        }
+
+        private static void TestOldSnapshotComputesItsFrame(SnapshotCamera cam)
+        {
+            log.Info("Testing that a snapshot computes its own frame after newer Updates");
+            cam.Update();
+            FrameSnapshot snapshot = cam.AcquireCurrentFrame();
+            FakeFrame frame = cam.LastFrame;
+            cam.Update();
+            cam.Update();
+
+            FloatImage img = (FloatImage)cam.CalcChannel(ChannelNames.Distance, snapshot);
+            Check(img.Data[0] == snapshot.FrameNumber, "The image was computed from frame {0} instead of {1}.", img.Data[0], snapshot.FrameNumber);
+            Check(img.FrameNumber == snapshot.FrameNumber, "The image has frame number {0} instead of {1}.", img.FrameNumber, snapshot.FrameNumber);
+            Check(img.TimeStamp == snapshot.TimeStamp, "The image has timestamp {0} instead of {1}.", img.TimeStamp, snapshot.TimeStamp);
+            Check(0 == frame.NumReleases, "The frame was released while a snapshot held it.");
+
+            snapshot.Dispose();
+            Check(1 == frame.NumReleases, "The frame was released {0} times after disposing its last snapshot.", frame.NumReleases);
+        }
+
+        private static void TestReleasedWhenCameraMovesOn(SnapshotCamera cam)
+        {
+            log.Info("Testing that a frame nobody holds is released by the next Update");
+            cam.Update();
+            FakeFrame frame = cam.LastFrame;
+            Check(0 == frame.NumReleases, "The current frame was released.");
+            cam.Update();
+            Check(1 == frame.NumReleases, "The previous frame was released {0} times by Update.", frame.NumReleases);
+        }
+
+        private static void TestReleasedAfterLastSnapshot(SnapshotCamera cam)
+        {
+            log.Info("Testing that a frame is released once, after all of its snapshots are disposed");
+            cam.Update();
+            FakeFrame frame = cam.LastFrame;
+            FrameSnapshot first = cam.AcquireCurrentFrame();
+            FrameSnapshot second = cam.AcquireCurrentFrame();
+            Check(first.FrameNumber == second.FrameNumber, "Two snapshots of the current frame have frame numbers {0} and {1}.", first.FrameNumber, second.FrameNumber);
+
+            first.Dispose();
+            Check(0 == frame.NumReleases, "The current frame was released by disposing a snapshot.");
+            cam.Update();
+            Check(0 == frame.NumReleases, "The frame was released while a snapshot held it.");
+            second.Dispose();
+            Check(1 == frame.NumReleases, "The frame was released {0} times after disposing its last snapshot.", frame.NumReleases);
+            second.Dispose();
+            first.Dispose();
+            Check(1 == frame.NumReleases, "Disposing snapshots twice released the frame {0} times.", frame.NumReleases);
+        }
+
+        private static void TestDisposedSnapshot(SnapshotCamera cam)
+        {
+            log.Info("Testing that a disposed snapshot cannot be used");
+            cam.Update();
+            FrameSnapshot snapshot = cam.AcquireCurrentFrame();
+            snapshot.Dispose();
+            Check(snapshot.IsDisposed, "The snapshot does not report that it is disposed.");
+            try
+            {
+                cam.CalcChannel(ChannelNames.Distance, snapshot);
+                Check(false, "CalcChannel accepted a disposed snapshot.");
+            }
+            catch (ObjectDisposedException)
+            {
+                // expected
+            }
+        }
+
+        /// <summary>
+        /// Takes and disposes snapshots on one thread while another one calls Update.
+        /// </summary>
+        private static void TestConcurrentUpdates(SnapshotCamera cam)
+        {
+            log.Info("Testing snapshots taken while Update runs on another thread");
+            const int numUpdates = 2000;
+            int numBadImages = 0;
+            Thread updater = new Thread(() =>
+            {
+                for (int i = 0; i < numUpdates; i++)
+                {
+                    cam.Update();
+                }
+            });
+            updater.Start();
+            while (updater.IsAlive)
+            {
+                using (FrameSnapshot snapshot = cam.AcquireCurrentFrame())
+                {
+                    FloatImage img = (FloatImage)cam.CalcChannel(ChannelNames.Distance, snapshot);
+                    if (img.Data[0] != snapshot.FrameNumber)
+                    {
+                        numBadImages++;
+                    }
+                }
+            }
+            updater.Join();
+            Check(0 == numBadImages, "{0} images were not computed from the frame of their snapshot.", numBadImages);
+
+            FakeFrame current = cam.LastFrame;
+            int numBadReleases = 0;
+            lock (cam.Frames)
+            {
+                foreach (FakeFrame frame in cam.Frames)
+                {
+                    if (frame.NumReleases != ((frame == current) ? 0 : 1))
+                    {
+                        numBadReleases++;
+                    }
+                }
+            }
+            Check(0 == numBadReleases, "{0} frames were not released exactly once.", numBadReleases);
+        }
+
+        private static void TestDisconnectReleasesCurrentFrame(SnapshotCamera cam)
+        {
+            log.Info("Testing that Disconnect releases the current frame");
+            cam.Update();
+            FakeFrame frame = cam.LastFrame;
+            cam.Disconnect();
+            Check(1 == frame.NumReleases, "The current frame was released {0} times by Disconnect.", frame.NumReleases);
+            Check(null == cam.AcquireCurrentFrame(), "There is a snapshot after Disconnect.");
+        }
+
+        private static void Check(bool condition, string format, params object[] args)
+        {
+            if (condition)
+            {
+                return;
+            }
+            numErrors++;
+            log.ErrorFormat(format, args);
+        }
+    }
+}
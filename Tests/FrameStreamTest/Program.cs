@@ -0,0 +1,359 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using MetriCam2.Exceptions;
+using Metrilus.Logging;
+using Metrilus.Util;
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace MetriCam2.Tests.FrameStreamTest
+{
+    /// <summary>
+    /// Fake camera whose frames are pushed by the test.
+    /// </summary>
+    /// <remarks>
+    /// UpdateImpl takes the next pushed frame and blocks until there is one.
+    /// If <see cref="SignalFrames"/> is set, WaitForFrameAsync lets UpdateAsync wait for pushed frames without blocking.
+    /// Each pixel of the Distance image, which is rented from the image pool, is the number of the frame.
+    /// </remarks>
+    class PushCamera : Camera
+    {
+        private readonly object pendingLock = new object();
+        private int numPending = 0;
+        /// <summary>Set while frames are pending, guarded by pendingLock.</summary>
+        private readonly ManualResetEvent framePending = new ManualResetEvent(false);
+        private int numBlockingWaits = 0;
+
+        public bool SignalFrames { get; set; }
+        /// <summary>Thrown by the next UpdateImpl.</summary>
+        public Exception Error { get; set; }
+
+        public int NumPending
+        {
+            get { lock (pendingLock) { return numPending; } }
+        }
+
+        /// <summary>Number of times UpdateImpl had to block until a frame was pushed.</summary>
+        public int NumBlockingWaits
+        {
+            get { return Volatile.Read(ref numBlockingWaits); }
+        }
+
+        public PushCamera()
+            : base("PushCamera")
+        { /* empty */ }
+
+        public void PushFrames(int count)
+        {
+            lock (pendingLock)
+            {
+                numPending += count;
+                framePending.Set();
+            }
+        }
+
+        public void DropFrames()
+        {
+            lock (pendingLock)
+            {
+                numPending = 0;
+                framePending.Reset();
+            }
+        }
+
+        protected override void LoadAllAvailableChannels()
+        {
+            ChannelRegistry cr = ChannelRegistry.Instance;
+            Channels.Clear();
+            Channels.Add(cr.RegisterChannel(ChannelNames.Distance));
+        }
+
+        protected override void ConnectImpl()
+        {
+            ActivateChannel(ChannelNames.Distance);
+        }
+
+        protected override void DisconnectImpl()
+        { /* empty */ }
+
+        protected override void UpdateImpl()
+        {
+            if (null != Error)
+            {
+                throw Error;
+            }
+            while (true)
+            {
+                lock (pendingLock)
+                {
+                    if (numPending > 0)
+                    {
+                        numPending--;
+                        if (0 == numPending)
+                        {
+                            framePending.Reset();
+                        }
+                        return;
+                    }
+                }
+                Interlocked.Increment(ref numBlockingWaits);
+                if (!framePending.WaitOne(5000))
+                {
+                    throw new ImageAcquisitionFailedException("No frame was pushed in time.");
+                }
+            }
+        }
+
+        protected override Task<bool> WaitForFrameAsync(CancellationToken cancellationToken)
+        {
+            if (!SignalFrames)
+            {
+                return Task.FromResult(false);
+            }
+            return WaitOneAsync(framePending, Timeout.Infinite, cancellationToken);
+        }
+
+        protected override ImageBase CalcChannelImpl(string channelName)
+        {
+            FloatImage img = ImagePool.RentFloatImage(4, 3);
+            for (int i = 0; i < img.Data.Length; i++)
+            {
+                img.Data[i] = FrameNumber;
+            }
+            return img;
+        }
+    }
+
+    class Program
+    {
+        private static MetriLog log = new MetriLog("FrameStreamTest");
+        private static int numErrors = 0;
+        private static readonly string[] channels = new string[] { ChannelNames.Distance };
+
+        static int Main(string[] args)
+        {
+            PushCamera cam = new PushCamera();
+            cam.Connect();
+
+            TestUpdateAsyncWithSignal(cam);
+            TestUpdateAsyncWithoutSignal(cam);
+            TestUpdateAsyncCancellation(cam);
+            TestBoundedBuffer(cam);
+            TestDisposeReleasesBufferedFrames(cam);
+            TestReadCancellation(cam);
+            TestStreamCancellation(cam);
+            TestProducerError(cam);
+
+            cam.Disconnect();
+
+            if (numErrors > 0)
+            {
+                log.ErrorFormat("{0} check(s) failed.", numErrors);
+                return 1;
+            }
+            log.Info("All checks passed.");
+            return 0;
+        }
+
+        private static void TestUpdateAsyncWithSignal(PushCamera cam)
+        {
+            log.Info("Testing UpdateAsync with a camera which signals frames");
+            cam.SignalFrames = true;
+            int frameNumber = cam.FrameNumber;
+            int numBlockingWaits = cam.NumBlockingWaits;
+
+            Task update = cam.UpdateAsync(CancellationToken.None);
+            Thread.Sleep(100);
+            Check(!update.IsCompleted, "UpdateAsync completed before a frame was pushed.");
+            cam.PushFrames(1);
+            Check(update.Wait(5000), "UpdateAsync did not complete after a frame was pushed.");
+            Check(cam.FrameNumber == frameNumber + 1, "UpdateAsync updated {0} frames instead of one.", cam.FrameNumber - frameNumber);
+            Check(cam.NumBlockingWaits == numBlockingWaits, "UpdateAsync blocked a thread although the camera signals frames.");
+        }
+
+        private static void TestUpdateAsyncWithoutSignal(PushCamera cam)
+        {
+            log.Info("Testing UpdateAsync with a camera which does not signal frames");
+            cam.SignalFrames = false;
+            int frameNumber = cam.FrameNumber;
+
+            Task update = cam.UpdateAsync(CancellationToken.None);
+            Thread.Sleep(100);
+            Check(!update.IsCompleted, "UpdateAsync completed before a frame was pushed.");
+            cam.PushFrames(1);
+            Check(update.Wait(5000), "UpdateAsync did not complete after a frame was pushed.");
+            Check(cam.FrameNumber == frameNumber + 1, "UpdateAsync updated {0} frames instead of one.", cam.FrameNumber - frameNumber);
+        }
+
+        private static void TestUpdateAsyncCancellation(PushCamera cam)
+        {
+            log.Info("Testing cancellation of UpdateAsync");
+            cam.SignalFrames = true;
+            int frameNumber = cam.FrameNumber;
+
+            using (CancellationTokenSource cancellation = new CancellationTokenSource())
+            {
+                Task update = cam.UpdateAsync(cancellation.Token);
+                Thread.Sleep(50);
+                cancellation.Cancel();
+                Check(WaitCanceled(update), "UpdateAsync was not cancelled while waiting for a frame.");
+            }
+
+            cam.SignalFrames = false;
+            using (CancellationTokenSource cancellation = new CancellationTokenSource())
+            {
+                cancellation.Cancel();
+                Task update = cam.UpdateAsync(cancellation.Token);
+                Check(WaitCanceled(update), "UpdateAsync with a cancelled token was not cancelled.");
+            }
+            Check(cam.FrameNumber == frameNumber, "A cancelled UpdateAsync updated the camera.");
+        }
+
+        private static void TestBoundedBuffer(PushCamera cam)
+        {
+            log.Info("Testing that a frame stream buffers at most its capacity and delivers all frames in order");
+            cam.SignalFrames = true;
+            const int capacity = 2;
+            const int numFrames = 10;
+            cam.PushFrames(numFrames);
+
+            FrameStream stream = cam.StartFrameStream(channels, capacity, CancellationToken.None);
+            Check(WaitUntil(() => stream.NumFrames == capacity), "The stream produced {0} frames instead of {1}.", stream.NumFrames, capacity);
+            Thread.Sleep(200);
+            Check(stream.NumFrames == capacity && stream.Count == capacity, "The producer did not wait for the consumer: {0} frames produced, {1} buffered.", stream.NumFrames, stream.Count);
+            Check(cam.NumPending == numFrames - capacity, "The producer took {0} frames from the camera.", numFrames - cam.NumPending);
+
+            int previous = -1;
+            for (int i = 0; i < numFrames; i++)
+            {
+                FrameSet frame = stream.ReadAsync(CancellationToken.None).GetAwaiter().GetResult();
+                Check(previous < 0 || frame.FrameNumber == previous + 1, "Frame {0} follows frame {1}.", frame.FrameNumber, previous);
+                Check(((FloatImage)frame[ChannelNames.Distance]).Data[0] == frame.FrameNumber, "The image of frame {0} belongs to another frame.", frame.FrameNumber);
+                previous = frame.FrameNumber;
+                frame.Release();
+            }
+
+            // the producer is waiting for the next frame now, which Dispose cancels
+            Stopwatch sw = Stopwatch.StartNew();
+            stream.Dispose();
+            Check(sw.ElapsedMilliseconds < 2000, "Dispose took {0} ms.", sw.ElapsedMilliseconds);
+            Check(stream.Completion.IsCompleted && !stream.Completion.IsFaulted, "The producer did not stop regularly.");
+            Check(null == stream.ReadAsync(CancellationToken.None).GetAwaiter().GetResult(), "ReadAsync returned a frame after Dispose.");
+            stream.Dispose();
+        }
+
+        private static void TestDisposeReleasesBufferedFrames(PushCamera cam)
+        {
+            log.Info("Testing that Dispose releases the frames which have not been read");
+            cam.SignalFrames = true;
+            const int capacity = 3;
+            cam.PushFrames(capacity);
+
+            FrameStream stream = cam.StartFrameStream(channels, capacity, CancellationToken.None);
+            Check(WaitUntil(() => stream.Count == capacity), "The stream buffered {0} frames instead of {1}.", stream.Count, capacity);
+            long numReturned = cam.ImagePool.NumReturned;
+            stream.Dispose();
+            Check(cam.ImagePool.NumReturned == numReturned + capacity, "Dispose released {0} images instead of {1}.", cam.ImagePool.NumReturned - numReturned, capacity);
+        }
+
+        private static void TestReadCancellation(PushCamera cam)
+        {
+            log.Info("Testing cancellation of ReadAsync");
+            cam.SignalFrames = true;
+            using (FrameStream stream = cam.StartFrameStream(channels, 1, CancellationToken.None))
+            using (CancellationTokenSource cancellation = new CancellationTokenSource(100))
+            {
+                Task<FrameSet> read = stream.ReadAsync(cancellation.Token);
+                Check(WaitCanceled(read), "ReadAsync was not cancelled while no frame was buffered.");
+
+                cam.PushFrames(1);
+                read = stream.ReadAsync(CancellationToken.None);
+                Check(read.Wait(5000) && null != read.Result, "The stream did not deliver a frame after a cancelled read.");
+            }
+        }
+
+        private static void TestStreamCancellation(PushCamera cam)
+        {
+            log.Info("Testing the cancellation token of a frame stream");
+            cam.SignalFrames = true;
+            cam.PushFrames(1);
+            using (CancellationTokenSource cancellation = new CancellationTokenSource())
+            using (FrameStream stream = cam.StartFrameStream(channels, 2, cancellation.Token))
+            {
+                Check(null != stream.ReadAsync(CancellationToken.None).GetAwaiter().GetResult(), "The stream did not deliver the pushed frame.");
+                cancellation.Cancel();
+                Task<FrameSet> read = stream.ReadAsync(CancellationToken.None);
+                Check(read.Wait(5000) && null == read.Result, "ReadAsync did not report the end of the cancelled stream.");
+                Check(stream.Completion.IsCompleted && !stream.Completion.IsFaulted, "The producer did not stop regularly.");
+            }
+        }
+
+        private static void TestProducerError(PushCamera cam)
+        {
+            log.Info("Testing that errors of the producer are handed to the reader after the buffered frames");
+            cam.SignalFrames = true;
+            cam.PushFrames(1);
+            using (FrameStream stream = cam.StartFrameStream(channels, 4, CancellationToken.None))
+            {
+                Check(WaitUntil(() => stream.NumFrames == 1), "The stream did not produce the pushed frame.");
+                cam.Error = new ImageAcquisitionFailedException("Test error");
+                cam.PushFrames(1);
+
+                Check(null != stream.ReadAsync(CancellationToken.None).GetAwaiter().GetResult(), "The frame buffered before the error was lost.");
+                try
+                {
+                    stream.ReadAsync(CancellationToken.None).GetAwaiter().GetResult();
+                    Check(false, "ReadAsync did not throw the error of the producer.");
+                }
+                catch (ImageAcquisitionFailedException e)
+                {
+                    Check(ReferenceEquals(e, cam.Error), "ReadAsync threw another error: {0}", e.Message);
+                }
+                Check(WaitUntil(() => stream.Completion.IsFaulted), "The completion of the stream is not faulted.");
+            }
+            cam.Error = null;
+            cam.DropFrames();
+        }
+
+        private static bool WaitCanceled(Task task)
+        {
+            try
+            {
+                task.Wait(5000);
+            }
+            catch (AggregateException e)
+            {
+                return e.InnerException is OperationCanceledException && task.IsCanceled;
+            }
+            return false;
+        }
+
+        private static bool WaitUntil(Func<bool> condition)
+        {
+            Stopwatch sw = Stopwatch.StartNew();
+            while (!condition())
+            {
+                if (sw.ElapsedMilliseconds > 5000)
+                {
+                    return false;
+                }
+                Thread.Sleep(10);
+            }
+            return true;
+        }
+
+        private static void Check(bool condition, string format, params object[] args)
+        {
+            if (condition)
+            {
+                return;
+            }
+            numErrors++;
+            log.ErrorFormat(format, args);
+        }
+    }
+}
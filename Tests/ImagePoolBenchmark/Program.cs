@@ -0,0 +1,142 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using Metrilus.Logging;
+using Metrilus.Util;
+using System;
+using System.Diagnostics;
+
+namespace MetriCam2.Tests.ImagePoolBenchmark
+{
+    /// <summary>
+    /// Fake camera which computes a Distance and a Point3DImage per frame, either from the image pool or freshly allocated.
+    /// </summary>
+    class FakeCamera : Camera
+    {
+        public const int Width = 1280;
+        public const int Height = 960;
+
+        public bool UsePool { get; set; }
+
+        public FakeCamera()
+            : base("FakeCamera")
+        { /* empty */ }
+
+        protected override void LoadAllAvailableChannels()
+        {
+            ChannelRegistry cr = ChannelRegistry.Instance;
+            Channels.Clear();
+            Channels.Add(cr.RegisterChannel(ChannelNames.Distance));
+            Channels.Add(cr.RegisterChannel(ChannelNames.Point3DImage));
+        }
+
+        protected override void ConnectImpl()
+        {
+            ActivateChannel(ChannelNames.Distance);
+            ActivateChannel(ChannelNames.Point3DImage);
+        }
+
+        protected override void DisconnectImpl()
+        { /* empty */ }
+
+        protected override void UpdateImpl()
+        { /* empty */ }
+
+        protected override ImageBase CalcChannelImpl(string channelName)
+        {
+            if (ChannelNames.Distance == channelName)
+            {
+                FloatImage img = UsePool ? ImagePool.RentFloatImage(Width, Height) : new FloatImage(Width, Height);
+                for (int i = 0; i < img.Data.Length; i++)
+                {
+                    img.Data[i] = FrameNumber;
+                }
+                return img;
+            }
+            if (ChannelNames.Point3DImage == channelName)
+            {
+                Point3fImage img = UsePool ? ImagePool.RentPoint3fImage(Width, Height) : new Point3fImage(Width, Height);
+                Point3f p = new Point3f(0, 0, FrameNumber);
+                for (int i = 0; i < img.Data.Length; i++)
+                {
+                    img.Data[i] = p;
+                }
+                return img;
+            }
+            return null;
+        }
+    }
+
+    class Program
+    {
+        const int NumWarmupFrames = 20;
+        const int NumFrames = 500;
+
+        static MetriLog log = new MetriLog();
+
+        static void Main(string[] args)
+        {
+            log.LogLevel = MetriLog.Levels.Info;
+
+            FakeCamera cam = new FakeCamera();
+            cam.Connect();
+
+            Measure(cam, false);
+            Measure(cam, true);
+
+            cam.Disconnect();
+        }
+
+        static void Measure(FakeCamera cam, bool usePool)
+        {
+            cam.UsePool = usePool;
+            for (int i = 0; i < NumWarmupFrames; i++)
+            {
+                ProcessFrame(cam, usePool);
+            }
+
+            GC.Collect();
+            GC.WaitForPendingFinalizers();
+            int gen0 = GC.CollectionCount(0);
+            int gen2 = GC.CollectionCount(2);
+            long rented = cam.ImagePool.NumRented;
+            long reused = cam.ImagePool.NumReused;
+
+            Stopwatch total = Stopwatch.StartNew();
+            Stopwatch frame = new Stopwatch();
+            double maxFrameMs = 0;
+            for (int i = 0; i < NumFrames; i++)
+            {
+                frame.Restart();
+                ProcessFrame(cam, usePool);
+                maxFrameMs = Math.Max(maxFrameMs, frame.Elapsed.TotalMilliseconds);
+            }
+            total.Stop();
+
+            log.InfoFormat("{0}: {1:F2} ms per frame (max {2:F2} ms), {3} gen0 / {4} gen2 collections",
+                usePool ? "Pooled images" : "Fresh images",
+                total.Elapsed.TotalMilliseconds / NumFrames, maxFrameMs, GC.CollectionCount(0) - gen0, GC.CollectionCount(2) - gen2);
+            if (usePool)
+            {
+                log.InfoFormat("Pool: {0} rented, {1} reused, {2} images ({3:F1} MB) pooled",
+                    cam.ImagePool.NumRented - rented, cam.ImagePool.NumReused - reused, cam.ImagePool.NumPooled, cam.ImagePool.PooledBytes / (1024.0 * 1024.0));
+            }
+        }
+
+        static void ProcessFrame(FakeCamera cam, bool usePool)
+        {
+            cam.Update();
+            FloatImage distances = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            Point3fImage points = (Point3fImage)cam.CalcChannel(ChannelNames.Point3DImage);
+            if (distances.Data[0] != points.Data[0].Z)
+            {
+                log.Error("Inconsistent frame.");
+            }
+            if (usePool)
+            {
+                cam.ReleaseImage(distances);
+                cam.ReleaseImage(points);
+            }
+        }
+    }
+}
@@ -0,0 +1,138 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using MetriCam2.Cameras;
+using Metrilus.Logging;
+using Metrilus.Util;
+using System;
+using System.Diagnostics;
+using System.Drawing;
+using System.Drawing.Imaging;
+
+namespace MetriCam2.Tests.MvBlueSiriusBenchmark
+{
+    class Program
+    {
+        const int NumWarmupFrames = 10;
+        const int NumFrames = 200;
+        const int NumConsumers = 4;
+
+        static MetriLog log = new MetriLog();
+
+        static void Main(string[] args)
+        {
+            log.LogLevel = MetriLog.Levels.Info;
+
+            MvBlueSirius cam = new MvBlueSirius();
+            cam.Connect();
+            log.InfoFormat("Connected {0} camera with S/N \"{1}\".", cam.Name, cam.SerialNumber);
+
+            ColorImage img = null;
+            for (int i = 0; i < NumWarmupFrames; i++)
+            {
+                cam.Update();
+                img = (ColorImage)cam.CalcChannel(ChannelNames.Color);
+            }
+
+            Stopwatch singlePass = new Stopwatch();
+            for (int i = 0; i < NumFrames; i++)
+            {
+                cam.Update();
+                singlePass.Start();
+                img = (ColorImage)cam.CalcChannel(ChannelNames.Color);
+                singlePass.Stop();
+            }
+
+            double copyMs = MeasureConsumers(cam, false);
+            double readOnlyMs = MeasureConsumers(cam, true);
+            cam.Disconnect();
+
+            // replay the previous implementation on the last frame, with the SDK's RGB pixel order as input
+            byte[] rgb = ToRgb(img);
+            byte[] bgr = new byte[rgb.Length];
+            Stopwatch twoPass = Stopwatch.StartNew();
+            for (int i = 0; i < NumFrames; i++)
+            {
+                TwoPass(rgb, bgr, img.Width, img.Height);
+            }
+            twoPass.Stop();
+
+            double singlePassMs = singlePass.Elapsed.TotalMilliseconds / NumFrames;
+            double twoPassMs = twoPass.Elapsed.TotalMilliseconds / NumFrames;
+            log.InfoFormat("Color {0}x{1}", img.Width, img.Height);
+            log.InfoFormat("Two-pass:    {0:F2} ms per frame", twoPassMs);
+            log.InfoFormat("Single-pass: {0:F2} ms per frame ({1:F1}x)", singlePassMs, twoPassMs / singlePassMs);
+            log.InfoFormat("{0} consumers of {1}: {2:F2} ms per frame with copies, {3:F2} ms with ReadOnlyImages ({4:F1}x)", NumConsumers, ChannelNames.Distance, copyMs, readOnlyMs, copyMs / readOnlyMs);
+
+            log.Info("Press any key to close.");
+            Console.ReadKey();
+        }
+
+        private static double MeasureConsumers(MvBlueSirius cam, bool readOnlyImages)
+        {
+            cam.ReadOnlyImages = readOnlyImages;
+            Stopwatch calcWatch = new Stopwatch();
+            for (int i = 0; i < NumFrames; i++)
+            {
+                cam.Update();
+                calcWatch.Start();
+                for (int j = 0; j < NumConsumers; j++)
+                {
+                    cam.CalcChannel(ChannelNames.Distance);
+                }
+                calcWatch.Stop();
+            }
+            cam.ReadOnlyImages = false;
+            return calcWatch.Elapsed.TotalMilliseconds / NumFrames;
+        }
+
+        private static unsafe byte[] ToRgb(ColorImage img)
+        {
+            byte[] rgb = new byte[3 * img.Width * img.Height];
+            BitmapData bitmapData = img.Data.LockBits(new Rectangle(0, 0, img.Width, img.Height), ImageLockMode.ReadOnly, PixelFormat.Format32bppArgb);
+            int i = 0;
+            for (int y = 0; y < img.Height; y++)
+            {
+                byte* linePtr = (byte*)bitmapData.Scan0 + bitmapData.Stride * y;
+                for (int x = 0; x < img.Width; x++, linePtr += 4)
+                {
+                    rgb[i++] = linePtr[2];
+                    rgb[i++] = linePtr[1];
+                    rgb[i++] = linePtr[0];
+                }
+            }
+            img.Data.UnlockBits(bitmapData);
+            return rgb;
+        }
+
+        private static unsafe ColorImage TwoPass(byte[] rgb, byte[] bgr, int width, int height)
+        {
+            // ImageData::CopyColorData, called on Update
+            int numElements = width * height;
+            for (int i = 0; i < numElements; i++)
+            {
+                bgr[(3 * i) + 0] = rgb[(3 * i) + 2];
+                bgr[(3 * i) + 1] = rgb[(3 * i) + 1];
+                bgr[(3 * i) + 2] = rgb[(3 * i) + 0];
+            }
+
+            // CalcColorImage
+            ColorImage cImage = new ColorImage(width, height);
+            BitmapData bitmapData = cImage.Data.LockBits(new Rectangle(0, 0, width, height), ImageLockMode.WriteOnly, cImage.Data.PixelFormat);
+            int colorIdx = 0;
+            for (int y = 0; y < height; y++)
+            {
+                byte* linePtr = (byte*)bitmapData.Scan0 + bitmapData.Stride * y;
+                for (int x = 0; x < width; x++)
+                {
+                    *linePtr++ = bgr[colorIdx++];
+                    *linePtr++ = bgr[colorIdx++];
+                    *linePtr++ = bgr[colorIdx++];
+                    *linePtr++ = 255;
+                }
+            }
+            cImage.Data.UnlockBits(bitmapData);
+            return cImage;
+        }
+    }
+}
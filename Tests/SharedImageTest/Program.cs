@@ -0,0 +1,182 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using Metrilus.Logging;
+using Metrilus.Util;
+using System;
+using System.Collections.Generic;
+using System.Threading;
+
+namespace MetriCam2.Tests.SharedImageTest
+{
+    /// <summary>
+    /// Fake camera which hands out the Distance image of a frame to all callers, like mvBlueSirius with ReadOnlyImages.
+    /// </summary>
+    /// <remarks>
+    /// Each pixel is the number of the frame. The images are rented from the image pool.
+    /// The Amplitude image is rented anew for each call and not shared.
+    /// </remarks>
+    class SharingCamera : Camera
+    {
+        private readonly object distanceLock = new object();
+        private FloatImage distance = null;
+
+        public SharingCamera()
+            : base("SharingCamera")
+        { /* empty */ }
+
+        protected override void LoadAllAvailableChannels()
+        {
+            ChannelRegistry cr = ChannelRegistry.Instance;
+            Channels.Clear();
+            Channels.Add(cr.RegisterChannel(ChannelNames.Distance));
+            Channels.Add(cr.RegisterChannel(ChannelNames.Amplitude));
+        }
+
+        protected override void ConnectImpl()
+        {
+            ActivateChannel(ChannelNames.Distance);
+            ActivateChannel(ChannelNames.Amplitude);
+        }
+
+        protected override void DisconnectImpl()
+        { /* empty */ }
+
+        protected override void UpdateImpl()
+        {
+            lock (distanceLock)
+            {
+                // the previous image may still be read by its callers, so it is not recycled
+                distance = null;
+            }
+        }
+
+        protected override ImageBase CalcChannelImpl(string channelName)
+        {
+            if (ChannelNames.Amplitude == channelName)
+            {
+                return Render(ImagePool.RentFloatImage(4, 3));
+            }
+
+            lock (distanceLock)
+            {
+                if (null == distance)
+                {
+                    distance = Render(ImagePool.RentFloatImage(4, 3));
+                    MarkShared(distance, channelName);
+                }
+                return distance;
+            }
+        }
+
+        private FloatImage Render(FloatImage img)
+        {
+            for (int i = 0; i < img.Data.Length; i++)
+            {
+                img.Data[i] = FrameNumber;
+            }
+            return img;
+        }
+    }
+
+    class Program
+    {
+        private static MetriLog log = new MetriLog("SharedImageTest");
+        private static int numErrors = 0;
+
+        static int Main(string[] args)
+        {
+            SharingCamera cam = new SharingCamera();
+            cam.Connect();
+
+            TestReleaseImage(cam);
+            TestFrameStream(cam);
+
+            cam.Disconnect();
+
+            if (numErrors > 0)
+            {
+                log.ErrorFormat("{0} check(s) failed.", numErrors);
+                return 1;
+            }
+            log.Info("All checks passed.");
+            return 0;
+        }
+
+        private static void TestReleaseImage(SharingCamera cam)
+        {
+            log.Info("Testing ReleaseImage on a shared image");
+            cam.Update();
+            FloatImage shared = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            FloatImage other = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            Check(ReferenceEquals(shared, other), "The fake camera did not share the image.");
+            int frameNumber = shared.FrameNumber;
+
+            Check(!cam.ReleaseImage(shared), "The shared image was taken back by the pool.");
+            Check(!cam.ImagePool.Return(shared), "The shared image was taken back by the pool directly.");
+            cam.Update();
+            FloatImage next = (FloatImage)cam.CalcChannel(ChannelNames.Distance);
+            Check(!ReferenceEquals(next, shared), "The next frame was rendered into the released shared image.");
+            CheckContent(shared, frameNumber);
+            Check(shared.FrameNumber == frameNumber, "The released shared image has frame number {0} instead of {1}.", shared.FrameNumber, frameNumber);
+
+            // images which are not shared are still recycled
+            FloatImage amplitude = (FloatImage)cam.CalcChannel(ChannelNames.Amplitude);
+            Check(cam.ReleaseImage(amplitude), "An image which is not shared was not taken back by the pool.");
+            long numReused = cam.ImagePool.NumReused;
+            cam.Update();
+            cam.CalcChannel(ChannelNames.Amplitude);
+            Check(cam.ImagePool.NumReused == numReused + 1, "The released image which is not shared was not reused.");
+        }
+
+        /// <summary>
+        /// Releases the frames of a stream, some read and some still buffered, while the producer renders further frames.
+        /// </summary>
+        private static void TestFrameStream(SharingCamera cam)
+        {
+            log.Info("Testing FrameSet.Release and FrameStream.Dispose with shared images");
+            List<FloatImage> images = new List<FloatImage>();
+            using (FrameStream stream = cam.StartFrameStream(new string[] { ChannelNames.Distance, ChannelNames.Amplitude }, 2, CancellationToken.None))
+            {
+                for (int i = 0; i < 20; i++)
+                {
+                    FrameSet frame = stream.ReadAsync(CancellationToken.None).GetAwaiter().GetResult();
+                    images.Add((FloatImage)frame[ChannelNames.Distance]);
+                    frame.Release();
+                }
+                // Dispose releases the frames still buffered
+            }
+            cam.Update();
+            cam.CalcChannel(ChannelNames.Distance);
+
+            HashSet<FloatImage> distinct = new HashSet<FloatImage>(images);
+            Check(distinct.Count == images.Count, "{0} frames of the stream were rendered into the same image.", images.Count - distinct.Count + 1);
+            foreach (FloatImage img in images)
+            {
+                CheckContent(img, img.FrameNumber);
+            }
+        }
+
+        private static void CheckContent(FloatImage img, int frameNumber)
+        {
+            for (int i = 0; i < img.Data.Length; i++)
+            {
+                if (img.Data[i] != frameNumber)
+                {
+                    Check(false, "The shared image of frame {0} was overwritten with frame {1}.", frameNumber, img.Data[i]);
+                    return;
+                }
+            }
+        }
+
+        private static void Check(bool condition, string format, params object[] args)
+        {
+            if (condition)
+            {
+                return;
+            }
+            numErrors++;
+            log.ErrorFormat(format, args);
+        }
+    }
+}
@@ -0,0 +1,70 @@
+﻿// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+using MetriCam2.Cameras;
+using Metrilus.Logging;
+using System;
+using System.Diagnostics;
+
+namespace MetriCam2.Tests.WebCamBenchmark
+{
+    class Program
+    {
+        const int NumWarmupFrames = 10;
+        const int NumFrames = 200;
+
+        static MetriLog log = new MetriLog();
+
+        static void Main(string[] args)
+        {
+            log.LogLevel = MetriLog.Levels.Info;
+
+            WebCam cam = new WebCam();
+            double oneShotFps = Measure(cam, false, out double calcMs);
+            double streamingFps = Measure(cam, true, out calcMs);
+
+            log.InfoFormat("One-shot:  {0:F1} fps", oneShotFps);
+            log.InfoFormat("Streaming: {0:F1} fps ({1:F1}x)", streamingFps, streamingFps / oneShotFps);
+
+            // per-format cost of the host-side conversion
+            foreach (string format in new string[] { "RGB24", "YUY2", "NV12", "MJPG" })
+            {
+                cam.VideoFormat = format;
+                double fps = Measure(cam, true, out calcMs);
+                log.InfoFormat("{0,-5} (delivered: {1,-5}): {2:F1} fps, {3:F2} ms per CalcChannel", format, cam.ActiveVideoFormat, fps, calcMs);
+            }
+            cam.VideoFormat = WebCam.VideoFormatAuto;
+
+            log.Info("Press any key to close.");
+            Console.ReadKey();
+        }
+
+        private static double Measure(WebCam cam, bool streamingMode, out double calcMs)
+        {
+            cam.StreamingMode = streamingMode;
+            cam.Connect();
+            log.InfoFormat("Connected {0} camera with S/N \"{1}\" (StreamingMode = {2}).", cam.Name, cam.SerialNumber, streamingMode);
+
+            for (int i = 0; i < NumWarmupFrames; i++)
+            {
+                cam.Update();
+                cam.CalcChannel(ChannelNames.Color);
+            }
+
+            Stopwatch calcWatch = new Stopwatch();
+            Stopwatch sw = Stopwatch.StartNew();
+            for (int i = 0; i < NumFrames; i++)
+            {
+                cam.Update();
+                calcWatch.Start();
+                cam.CalcChannel(ChannelNames.Color);
+                calcWatch.Stop();
+            }
+            sw.Stop();
+
+            cam.Disconnect();
+            calcMs = calcWatch.Elapsed.TotalMilliseconds / NumFrames;
+            return NumFrames / sw.Elapsed.TotalSeconds;
+        }
+    }
+}
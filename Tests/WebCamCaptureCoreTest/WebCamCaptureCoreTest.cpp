@@ -0,0 +1,190 @@
+// Copyright (c) Metrilus GmbH
+// MetriCam 2 is licensed under the MIT license. See License.txt for full license text.
+
+#include "CaptureCore.h"
+#include "SyntheticBackend.h"
+#include <chrono>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace MetriCam2::Cameras;
+
+namespace
+{
+	const int Width = 1280;
+	const int Height = 720;
+	const int NumFrames = 300;
+	const int NumConversions = 100;
+	const int AcquireTimeout = 1000; // ms
+
+	int numErrors = 0;
+
+	void Check(bool condition, const char* format, ...)
+	{
+		if (condition)
+		{
+			return;
+		}
+		numErrors++;
+		va_list args;
+		va_start(args, format);
+		fprintf(stderr, "ERROR: ");
+		vfprintf(stderr, format, args);
+		fprintf(stderr, "\n");
+		va_end(args);
+	}
+
+	const char* FormatName(FrameFormat format)
+	{
+		switch (format)
+		{
+		case FrameFormatRgb24:
+			return "RGB24";
+		case FrameFormatYuy2:
+			return "YUY2";
+		case FrameFormatNv12:
+			return "NV12";
+		default:
+			return "?";
+		}
+	}
+
+	double Seconds(std::chrono::steady_clock::duration duration)
+	{
+		return std::chrono::duration<double>(duration).count();
+	}
+
+	/*
+	 * Acquires NumFrames frames produced as fast as possible and converts each of them.
+	 * Every frame has to be the one the backend rendered for its sequence number, i.e. none was torn by the producer.
+	 */
+	void TestThroughput(FrameFormat frameFormat)
+	{
+		CaptureRequest request;
+		request.format = frameFormat;
+		request.width = Width;
+		request.height = Height;
+		request.frameRate = 0;
+
+		CaptureCore core;
+		if (!core.Start(new SyntheticBackend(), request))
+		{
+			Check(false, "%s: the synthetic backend did not start.", FormatName(frameFormat));
+			return;
+		}
+		const CaptureFormat format = core.Format();
+		Check(format.format == frameFormat && format.width == Width && format.height == Height,
+			"%s: the backend delivers format %d at %dx%d.", FormatName(frameFormat), (int)format.format, format.width, format.height);
+
+		const int dstStride = 3 * format.width;
+		std::vector<uint8_t> dst((size_t)dstStride * format.height);
+		std::vector<unsigned char> expected(format.frameSize);
+		int numTorn = 0;
+		int numNotConverted = 0;
+		int numOutOfOrder = 0;
+		uint64_t lastSequence = 0;
+		std::chrono::steady_clock::duration convertTime(0);
+
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < NumFrames; i++)
+		{
+			if (!core.Acquire(AcquireTimeout))
+			{
+				Check(false, "%s: no frame within %d ms.", FormatName(frameFormat), AcquireTimeout);
+				break;
+			}
+			const FrameRing::Frame& frame = core.CurrentFrame();
+			if (frame.sequence <= lastSequence)
+			{
+				numOutOfOrder++;
+			}
+			lastSequence = frame.sequence;
+
+			// ring sequence numbers start at 1, the backend counts from 0
+			SyntheticBackend::Render(format, frame.sequence - 1, expected.data());
+			if (frame.size != expected.size() || 0 != memcmp(frame.data, expected.data(), expected.size()))
+			{
+				numTorn++;
+			}
+
+			const std::chrono::steady_clock::time_point convertStart = std::chrono::steady_clock::now();
+			if (!core.Convert(dst.data(), dstStride, false))
+			{
+				numNotConverted++;
+			}
+			convertTime += std::chrono::steady_clock::now() - convertStart;
+		}
+		const double elapsed = Seconds(std::chrono::steady_clock::now() - start);
+		const uint64_t pushed = core.Ring().FramesPushed();
+		const uint64_t dropped = core.Ring().FramesDropped();
+		core.Stop();
+
+		Check(0 == numTorn, "%s: %d frames differ from the rendered pattern.", FormatName(frameFormat), numTorn);
+		Check(0 == numNotConverted, "%s: %d frames could not be converted.", FormatName(frameFormat), numNotConverted);
+		Check(0 == numOutOfOrder, "%s: %d frames arrived out of order.", FormatName(frameFormat), numOutOfOrder);
+		Check(lastSequence >= (uint64_t)NumFrames, "%s: only %llu frames were pushed for %d acquired ones.", FormatName(frameFormat), (unsigned long long)lastSequence, NumFrames);
+
+		// the conversion alone, always on the same frame
+		CaptureCore reference;
+		reference.SetFormat(format);
+		SyntheticBackend::Render(format, 0, expected.data());
+		reference.SetFrame(expected.data(), expected.size());
+		const std::chrono::steady_clock::time_point conversionStart = std::chrono::steady_clock::now();
+		for (int i = 0; i < NumConversions; i++)
+		{
+			reference.Convert(dst.data(), dstStride, 0 != (i & 1));
+		}
+		const double conversionTime = Seconds(std::chrono::steady_clock::now() - conversionStart) / NumConversions;
+
+		printf("%-5s %dx%d: %.1f fps acquired, %.2f ms per Convert in the loop, %.2f ms per Convert alone, %llu pushed, %llu dropped\n",
+			FormatName(frameFormat), format.width, format.height, NumFrames / elapsed, 1e3 * Seconds(convertTime) / NumFrames, 1e3 * conversionTime,
+			(unsigned long long)pushed, (unsigned long long)dropped);
+	}
+
+	/*
+	 * The first pixel of converted RGB24 frames is the pattern of the frame, also when mirrored.
+	 */
+	void TestRgb24Content()
+	{
+		CaptureCore core;
+		CaptureFormat format = CaptureCore::DescribeFormat(FrameFormatRgb24, 64, 48, false, 0);
+		core.SetFormat(format);
+		std::vector<unsigned char> frame(format.frameSize);
+		const int dstStride = 3 * format.width;
+		std::vector<uint8_t> dst((size_t)dstStride * format.height);
+
+		const uint64_t sequence = 7;
+		SyntheticBackend::Render(format, sequence, frame.data());
+		core.SetFrame(frame.data(), frame.size());
+		Check(core.Convert(dst.data(), dstStride, false), "RGB24: the frame could not be converted.");
+		Check(0 == memcmp(dst.data(), frame.data(), 3 * format.width), "RGB24: the first row was not copied as it is.");
+
+		Check(core.Convert(dst.data(), dstStride, true), "RGB24: the mirrored frame could not be converted.");
+		const uint8_t* last = dst.data() + 3 * (format.width - 1);
+		Check(last[0] == (uint8_t)sequence && last[1] == (uint8_t)sequence && last[2] == 0,
+			"RGB24: the mirrored first pixel is (%d, %d, %d).", last[0], last[1], last[2]);
+
+		core.SetFrame(frame.data(), frame.size() - 1);
+		Check(!core.Convert(dst.data(), dstStride, false), "RGB24: an incomplete frame was converted.");
+	}
+}
+
+int main()
+{
+	TestRgb24Content();
+	const FrameFormat formats[] = { FrameFormatRgb24, FrameFormatYuy2, FrameFormatNv12 };
+	for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+	{
+		TestThroughput(formats[i]);
+	}
+
+	if (numErrors > 0)
+	{
+		fprintf(stderr, "%d check(s) failed.\n", numErrors);
+		return 1;
+	}
+	printf("All checks passed.\n");
+	return 0;
+}